@@ -3,47 +3,129 @@
 
 #include <iostream>
 #include <cstring>
+#include <climits>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "page_manager.h"
-#include "utils/hash.h"
+#include "node_pool.h"
+#include "hint_cache.h"
+#include "key_codec.h"
 #include "utils/binary_search.h"
+#include "utils/skip_list.h"
+#include "utils/sort.h"
+#include "utils/alloc_check.h"
 
-class BPlusTree {
+/*
+ * Key and Value are what the public interface takes, Codec turns them into the ordered Index (see key_codec.h)
+ * node fan-out and merge thresholds follow from page_size and the entry layout, leaf_limit caps the entries of a
+ * leaf below what fits, 0 fills the page
+ * a counted tree keeps the number of entries below every child, which count, rank and select read instead of leaves
+ */
+
+template<typename Key, typename Value, typename Codec = KeyCodec<Key, Value>, int page_size = 4096, bool counted = false,
+         int leaf_limit = 0>
+class BasicBPlusTree {
 
 public:
 
-    static constexpr int leaf_size = 48, internal_size = 180;
-    static constexpr int leaf_merge_size = 16, internal_merge_size = 60;
-    static constexpr int page_size = 4096, cache_limit = 8192;
-    static constexpr char data_path[] = "data.bin", info_path[] = "info.bin", root_path[] = "root.bin";
+    typedef typename Codec::Index Index;
 
-    struct Data {
-        char str[65];
-        long long index; // hash << 32 + value
+    struct Data : Codec::Stored {
+        Index index;
 
         bool operator<(const Data &other) const {
             return index < other.index;
         }
     };
 
+    struct Message {
+        Data data;
+        long long seq;
+        int type; // 0: insert, 1: remove
+
+        bool operator<(const Message &other) const {
+            if (data.index < other.data.index)
+                return true;
+            if (other.data.index < data.index)
+                return false;
+            return seq < other.seq;
+        }
+    };
+
     typedef int FilePos;
 
+    /*
+     * a node fills its page: a leaf holds the vtable pointer, next and size besides its entries,
+     * an internal node also keeps about 15/32 of the page for its message buffer, and in a counted tree a count per child
+     */
+
+    static constexpr int buffer_size = page_size * 15 / 32 / sizeof(Message);
+    static constexpr int leaf_size = leaf_limit ? leaf_limit
+                                                : (page_size - sizeof(void *) - 2 * sizeof(int)) / sizeof(Data);
+    static constexpr int internal_size = (page_size - sizeof(void *) - 3 * sizeof(int) - buffer_size * sizeof(Message)
+                                          + sizeof(Index)) / (sizeof(Index) + sizeof(FilePos) + (counted ? sizeof(int) : 0));
+    static constexpr int leaf_merge_size = leaf_size / 3, internal_merge_size = internal_size / 3;
+    static constexpr int cache_limit = (32 << 20) / page_size; // the pool a tree opens with, see set_pool_size()
+    static constexpr char data_path[] = "data.bin", info_path[] = "info.bin", root_path[] = "root.bin";
+    static constexpr char snapshot_path[] = "snapshot.bin";
+    static constexpr char changes_path[] = "changes.bin"; // the pages changed since the last backup
+    static constexpr int backup_step_pages = 64;
+
+    static_assert(leaf_size >= 4 && internal_size >= 4, "page too small for this entry type");
+
+    struct Stats {
+        long long hint_hits, hint_stale, hint_misses, hint_memory;
+        long long append_fast_path;
+        long long sparse_queued, compacted_leaves;
+        long long flushed_pages, write_calls, flush_stalls;
+        long long prefetch_issued, prefetch_used, prefetch_wasted;
+        long long disk_bytes, written_bytes, compress_ns, decompress_ns, decompressed_pages;
+        int frame_huge_pages; // a FrameArena mode, what the kernel granted
+        bool frame_numa_placed;
+        long long resident_bytes, pool_bytes, pool_resizes; // frames holding a page, frames in the pool
+        long long epoch_retired, epoch_waits; // pages and frames waiting for readers, times a reuse had to wait
+        long long leaf_pages, internal_pages; // filled by a page scan only
+        double leaf_fill, internal_fill;
+    };
+
+    // what a PhaseProfiler attached with set_profiler() charges time and counters to
+    static constexpr int phase_other = 0, phase_descent = 1, phase_leaf = 2, phase_restructure = 3, phase_io = 4,
+            phase_count = 5;
+
+    // what insert_if_absent and replace did
+    static constexpr int write_done = 0, write_present = 1, write_missing = 2, write_ignored = 3;
+
+    struct Report {
+        long long leaf_pages, internal_pages, entries, free_pages, unreachable_pages;
+        int depth;
+        long long errors;
+        std::string messages; // the first errors found, one per line
+    };
+
     class InternalNode;
 
     class LeafNode;
 
+    class CatalogNode;
+
     class StorageInterface;
 
     class Node {
     public:
         virtual ~Node() = default;
 
-        static void serialize(std::fstream &out, Node *obj_ptr) {
+        static char *serialize(char *out, Node *obj_ptr) {
             obj_ptr->serialize(out);
+            return out;
         }
 
-        static void deserialize(std::fstream &in, char *ptr) {
+        static void deserialize(const char *in, char *ptr) {
             int node_type;
-            in.read(reinterpret_cast<char *>(&node_type), sizeof(int));
+            read(in, &node_type, sizeof(int));
 
             Node *obj_ptr;
 
@@ -52,78 +134,172 @@ public:
                     obj_ptr = new(ptr) LeafNode;
                     break;
                 case 1:
+                case 2:
                     obj_ptr = new(ptr) InternalNode;
                     break;
+                case 3:
+                    obj_ptr = new(ptr) CatalogNode;
+                    break;
             }
 
             obj_ptr->deserialize(in);
+
+            if (node_type == 2) // internal node carrying pending messages
+                static_cast<InternalNode *>(obj_ptr)->deserialize_buffer(in);
+        }
+
+        // pages are (de)serialized through a page sized buffer, the cursor advances past each field
+
+        static void write(char *&out, const void *src, size_t size) {
+            memcpy(out, src, size);
+            out += size;
+        }
+
+        static void read(const char *&in, void *dst, size_t size) {
+            memcpy(dst, in, size);
+            in += size;
         }
 
-        virtual void serialize(std::fstream &out) = 0;
+        virtual void serialize(char *&out) = 0;
 
-        virtual void deserialize(std::fstream &in) = 0;
+        virtual void deserialize(const char *&in) = 0;
     };
 
     class InternalNode : public Node {
 
     public:
 
-        long long index[internal_size - 1];
+        Index index[internal_size - 1];
         FilePos child[internal_size];
+        int count[counted ? internal_size : 1]; // entries in each child's subtree
         int size;
 
+        // write-optimized mode: operations waiting to be pushed to the children, ordered by seq
+        int buffered;
+        Message buffer[buffer_size];
 
         InternalNode() {
-            memset(index, 0, sizeof(long long) * (internal_size - 1));
+            memset(index, 0, sizeof(Index) * (internal_size - 1));
             memset(child, 0, sizeof(int) * internal_size);
+            memset(count, 0, sizeof(count));
             size = 0;
+            buffered = 0;
+        }
+
+        void serialize(char *&out) override {
+            int node_type = buffered ? 2 : 1;
+            Node::write(out, &node_type, sizeof(int));
+            Node::write(out, index, sizeof(Index) * (internal_size - 1));
+            Node::write(out, child, sizeof(int) * internal_size);
+            if (counted)
+                Node::write(out, count, sizeof(int) * internal_size);
+            Node::write(out, &size, sizeof(int));
+            if (buffered) {
+                Node::write(out, &buffered, sizeof(int));
+                Node::write(out, buffer, sizeof(Message) * buffered);
+            }
+        }
+
+        void deserialize(const char *&in) override {
+            Node::read(in, index, sizeof(Index) * (internal_size - 1));
+            Node::read(in, child, sizeof(int) * internal_size);
+            if (counted)
+                Node::read(in, count, sizeof(int) * internal_size);
+            Node::read(in, &size, sizeof(int));
+        }
+
+        void deserialize_buffer(const char *&in) {
+            Node::read(in, &buffered, sizeof(int));
+            Node::read(in, buffer, sizeof(Message) * buffered);
+        }
+
+        int route(const Index &key) {
+            return binary_search(index, size - 1, key);
         }
 
-        void serialize(std::fstream &out) override {
-            int node_type = 1;
-            out.write(reinterpret_cast<char *>(&node_type), sizeof(int));
-            out.write(reinterpret_cast<char *>(index), sizeof(long long) * (internal_size - 1));
-            out.write(reinterpret_cast<char *>(child), sizeof(int) * internal_size);
-            out.write(reinterpret_cast<char *>(&size), sizeof(int));
+        int count_messages(const Index &low, const Index &high) {
+            int count = 0;
+            for (int i = 0; i < buffered; ++i)
+                if (low < buffer[i].data.index && !(high < buffer[i].data.index))
+                    ++count;
+            return count;
         }
 
-        void deserialize(std::fstream &in) override {
-            in.read(reinterpret_cast<char *>(index), sizeof(long long) * (internal_size - 1));
-            in.read(reinterpret_cast<char *>(child), sizeof(int) * internal_size);
-            in.read(reinterpret_cast<char *>(&size), sizeof(int));
+        void take_messages(InternalNode *from, const Index &low, const Index &high) {
+
+            // moves messages with index in (low, high] from another node, merging by seq
+
+            Message moved[buffer_size];
+            int moved_size = 0, kept_size = 0;
+            for (int i = 0; i < from->buffered; ++i) {
+                if (low < from->buffer[i].data.index && !(high < from->buffer[i].data.index))
+                    moved[moved_size++] = from->buffer[i];
+                else
+                    from->buffer[kept_size++] = from->buffer[i];
+            }
+            from->buffered = kept_size;
+
+            int cursor = buffered + moved_size;
+            int i = buffered - 1, j = moved_size - 1;
+            while (j >= 0) {
+                if (i >= 0 && moved[j].seq < buffer[i].seq)
+                    buffer[--cursor] = buffer[i--];
+                else
+                    buffer[--cursor] = moved[j--];
+            }
+            buffered += moved_size;
         }
 
-        void insert(long long new_index, FilePos new_child, int cursor) {
+        void insert(const Index &new_index, FilePos new_child, int cursor, int child_count = 0) {
             if (cursor < size) {
-                memmove(index + cursor, index + cursor - 1, sizeof(long long) * (size - cursor));
+                memmove(index + cursor, index + cursor - 1, sizeof(Index) * (size - cursor));
                 memmove(child + cursor + 1, child + cursor, sizeof(FilePos) * (size - cursor));
+                if (counted)
+                    memmove(count + cursor + 1, count + cursor, sizeof(int) * (size - cursor));
             }
             index[cursor - 1] = new_index;
             child[cursor] = new_child;
+            if (counted)
+                count[cursor] = child_count;
             ++size;
         }
 
         void remove(int cursor) {
             if (cursor < size - 1) {
-                memmove(index + cursor - 1, index + cursor, sizeof(long long) * (size - cursor - 1));
+                memmove(index + cursor - 1, index + cursor, sizeof(Index) * (size - cursor - 1));
                 memmove(child + cursor, child + cursor + 1, sizeof(FilePos) * (size - cursor - 1));
+                if (counted)
+                    memmove(count + cursor, count + cursor + 1, sizeof(int) * (size - cursor - 1));
             }
             --size;
         }
 
-        void insert_head(long long new_index, FilePos new_child) {
-            memmove(index + 1, index, sizeof(long long) * (size - 1));
+        void insert_head(const Index &new_index, FilePos new_child, int child_count = 0) {
+            memmove(index + 1, index, sizeof(Index) * (size - 1));
             memmove(child + 1, child, sizeof(FilePos) * size);
             index[0] = new_index;
             child[0] = new_child;
+            if (counted) {
+                memmove(count + 1, count, sizeof(int) * size);
+                count[0] = child_count;
+            }
             ++size;
         }
 
         void remove_head() {
-            memmove(index, index + 1, sizeof(long long) * (size - 2));
+            memmove(index, index + 1, sizeof(Index) * (size - 2));
             memmove(child, child + 1, sizeof(FilePos) * (size - 1));
+            if (counted)
+                memmove(count, count + 1, sizeof(int) * (size - 1));
             --size;
         }
+
+        long long total(int from, int to) {
+            long long sum = 0;
+            for (int i = from; i < to; ++i)
+                sum += count[i];
+            return sum;
+        }
     };
 
     class LeafNode : public Node {
@@ -140,18 +316,18 @@ public:
             size = 0;
         }
 
-        void serialize(std::fstream &out) override {
+        void serialize(char *&out) override {
             int node_type = 0;
-            out.write(reinterpret_cast<char *>(&node_type), sizeof(int));
-            out.write(reinterpret_cast<char *>(data), sizeof(Data) * leaf_size);
-            out.write(reinterpret_cast<char *>(&next), sizeof(int));
-            out.write(reinterpret_cast<char *>(&size), sizeof(int));
+            Node::write(out, &node_type, sizeof(int));
+            Node::write(out, data, sizeof(Data) * leaf_size);
+            Node::write(out, &next, sizeof(int));
+            Node::write(out, &size, sizeof(int));
         }
 
-        void deserialize(std::fstream &in) override {
-            in.read(reinterpret_cast<char *>(data), sizeof(Data) * leaf_size);
-            in.read(reinterpret_cast<char *>(&next), sizeof(int));
-            in.read(reinterpret_cast<char *>(&size), sizeof(int));
+        void deserialize(const char *&in) override {
+            Node::read(in, data, sizeof(Data) * leaf_size);
+            Node::read(in, &next, sizeof(int));
+            Node::read(in, &size, sizeof(int));
         }
 
         void insert(Data &new_data, int cursor) {
@@ -168,401 +344,3570 @@ public:
         }
     };
 
-    class StorageInterface {
+    static constexpr int catalog_name_size = 32; // with the terminating 0
+
+    // page 0 of a file holding named trees, an entry per tree; see Catalog
 
-        PageManager<Node, page_size, cache_limit> pages;
+    class CatalogNode : public Node {
 
     public:
 
-        StorageInterface() :
-                pages(data_path, info_path) {}
+        struct Entry {
+            char name[catalog_name_size];
+            FilePos root;
+            bool write_optimized;
+            long long message_seq;
+        };
 
-        Node *operator[](FilePos index) {
-            char *page = pages[index];
-            return reinterpret_cast<Node *>(page);
+        static constexpr int capacity = (page_size - sizeof(void *) - sizeof(int)) / sizeof(Entry);
+
+        Entry entry[capacity];
+        int size;
+
+        CatalogNode() {
+            memset(entry, 0, sizeof(Entry) * capacity);
+            size = 0;
         }
 
-        FilePos new_leaf() {
-            return pages.alloc_page<LeafNode>();
+        void serialize(char *&out) override {
+            int node_type = 3;
+            Node::write(out, &node_type, sizeof(int));
+            Node::write(out, &size, sizeof(int));
+            Node::write(out, entry, sizeof(Entry) * size);
         }
 
-        FilePos new_internal() {
-            return pages.alloc_page<InternalNode>();
+        void deserialize(const char *&in) override {
+            Node::read(in, &size, sizeof(int));
+            Node::read(in, entry, sizeof(Entry) * size);
         }
 
-        void free(FilePos index) {
-            pages.free_page(index);
+        int find(const char *name) const {
+            for (int i = 0; i < size; ++i)
+                if (strcmp(entry[i].name, name) == 0)
+                    return i;
+            return -1;
         }
     };
 
-private:
+    static_assert(sizeof(LeafNode) <= page_size && sizeof(InternalNode) <= page_size, "node exceeds page");
 
-    StorageInterface storage;
+    class StorageInterface {
 
-    FilePos root_pos;
+        typedef PageManager<Node, page_size, cache_limit> Manager;
 
-    Vector<FilePos> recursive_par;
-    Vector<int> recursive_cursor;
+        Manager pages;
 
-    Data data_in_operation;
+        // a memory-only tree keeps its nodes here instead, pages is then an idle manager without a file
+        NodePool<Node, page_size> memory;
+        bool memory_only;
 
-    void maintain_index_recursive(long long new_index, int recursive_layer) {
+        // kept to be applied again to the manager a replica opens for every snapshot
+        int arena_huge, arena_numa;
+        int pool_frames; // 0 for the manager's own size
+        long long pool_budget;
+        double pool_miss_rate;
 
-        // called when leaf->data[0] or internal->child[0] modified
+        // a quarter of the frames may hold resident internal nodes
 
-        --recursive_layer;
-        while (recursive_layer >= 0) {
-            if (recursive_cursor[recursive_layer]) {
-                InternalNode *internal = dynamic_cast<InternalNode *>(storage[recursive_par[recursive_layer]]);
-                internal->index[recursive_cursor[recursive_layer] - 1] = new_index;
-                return;
-            }
-            --recursive_layer;
+        int pin_limit() {
+            return pages.frame_capacity() / 4;
         }
-    }
 
-    void insert_recursive(FilePos file_pos, int recursive_layer = 0) {
+        void pin_internal(FilePos index, Node *node) {
+            if (pages.pinned_size() < pin_limit() && dynamic_cast<InternalNode *>(node))
+                pages.pin(index, false);
+        }
 
-        Node *node = storage[file_pos];
+    public:
 
-        if (LeafNode *leaf = dynamic_cast<LeafNode *>(node)) {
+        class Guard {
 
-            int insert_cursor = binary_search(leaf->data, leaf->size, data_in_operation);
-            leaf->insert(data_in_operation, insert_cursor);
+            typename Manager::PinGuard guard;
+            Node *direct; // the node of a memory-only tree, which needs no pin
 
-            // insert_cursor == 0 && recursive_layer: iff left-most leaf
+        public:
 
-            if (leaf->size == leaf_size) { // split
+            Guard() : direct(nullptr) {}
 
-                FilePos next_pos = storage.new_leaf();
-                LeafNode *next = dynamic_cast<LeafNode *>(storage[next_pos]);
+            Guard(StorageInterface &storage, FilePos index, bool modify = true) : direct(nullptr) {
+                reset(storage, index, modify);
+            }
 
-                leaf->size = leaf_size / 2;
-                next->size = leaf_size / 2;
-                next->next = leaf->next;
-                leaf->next = next_pos;
-                memcpy(
-                        next->data,
-                        leaf->data + leaf_size / 2,
-                        sizeof(Data) * leaf_size / 2
-                );
+            // a guard taken with modify = false lets the page stay clean, so it is never written back for it
 
-                if (!recursive_layer) { // root
-                    root_pos = storage.new_internal();
-                    InternalNode *root = dynamic_cast<InternalNode *>(storage[root_pos]);
+            Node *reset(StorageInterface &storage, FilePos index, bool modify = true) {
+                if (storage.memory_only)
+                    return direct = reinterpret_cast<Node *>(storage.memory[index]);
+                bool fresh = !storage.pages.pinned(index);
+                guard.reset(storage.pages, index, modify);
+                if (fresh)
+                    storage.pin_internal(index, get());
+                return get();
+            }
 
-                    root->index[0] = next->data[0].index;
-                    root->child[0] = file_pos;
-                    root->child[1] = next_pos;
-                    root->size = 2;
-                }
-                else {
-                    InternalNode *par = dynamic_cast<InternalNode *>(storage[recursive_par[recursive_layer - 1]]);
-                    par->insert(next->data[0].index, next_pos, recursive_cursor[recursive_layer - 1] + 1);
-                }
+            Node *get() const {
+                return direct ? direct : reinterpret_cast<Node *>(guard.get());
             }
+        };
+
+        explicit StorageInterface(bool read_only = false, bool in_memory = false) :
+                pages(read_only || in_memory ? "" : data_path, read_only || in_memory ? "" : info_path,
+                      read_only || in_memory, changes_path),
+                memory_only(in_memory), arena_huge(FrameArena::small_pages), arena_numa(FrameArena::numa_default),
+                pool_frames(0), pool_budget(0), pool_miss_rate(0) {}
+
+        bool open_snapshot(const std::string &data, const std::string &info) {
+
+            // a replica moves to another snapshot on a fresh read-only manager, between queries while no guard holds a frame
+
+            pages.~Manager();
+            new(&pages) Manager(data, info, true);
+            if (arena_huge != FrameArena::small_pages || arena_numa != FrameArena::numa_default)
+                pages.set_frame_arena(arena_huge, arena_numa);
+            if (pool_frames)
+                pages.resize_frames(pool_frames);
+            if (pool_budget)
+                pages.set_pool_budget(pool_budget, pool_miss_rate);
+            return pages.opened();
         }
 
-        else if (InternalNode *internal = dynamic_cast<InternalNode *>(node)) {
-
-            recursive_cursor[recursive_layer] = binary_search(internal->index, internal->size - 1,
-                                                              data_in_operation.index);
-            recursive_par[recursive_layer] = file_pos;
+        bool snapshot(const std::string &data, const std::string &info) {
+            if (memory_only)
+                return memory.snapshot(data, info);
+            return pages.snapshot(data, info);
+        }
 
-            insert_recursive(internal->child[recursive_cursor[recursive_layer]], recursive_layer + 1);
+        bool load(const std::string &data, const std::string &info) {
+
+            // copies a stored tree into the memory of a memory-only one, false when there is none
+
+            Manager stored(data, info, true);
+            if (!stored.opened() || !stored.page_count())
+                return false;
+            Vector<FilePos> free_pages;
+            stored.free_list(free_pages);
+            memory.restore(stored.page_count(), free_pages);
+
+            char *free_mark = new char[stored.page_count()]();
+            for (int i = 0; i < free_pages.size(); ++i)
+                free_mark[free_pages[i]] = 1;
+            char image[page_size];
+            for (FilePos i = 0; i < stored.page_count(); ++i)
+                if (!free_mark[i]) {
+                    stored.read_image(i, image);
+                    Node::deserialize(image, memory[i]);
+                }
+            delete[] free_mark;
+            return true;
+        }
 
-            internal = dynamic_cast<InternalNode *>(storage[file_pos]); // previous cache might be evicted
+        bool in_memory() {
+            return memory_only;
+        }
 
-            if (internal->size == internal_size) {
+        bool backup_begin(const std::string &path, bool incremental, const char *meta, int meta_size) {
+            return !memory_only && pages.backup_begin(path, incremental, meta, meta_size);
+        }
 
-                FilePos next_pos = storage.new_internal();
-                InternalNode *next = dynamic_cast<InternalNode *>(storage[next_pos]);
+        long long backup_step(int count) {
+            return memory_only ? -1 : pages.backup_step(count);
+        }
 
-                long long up_move_index = internal->index[internal_size / 2 - 1];
-                internal->size = internal_size / 2;
-                next->size = internal_size / 2;
-                memcpy(
-                        next->index,
-                        internal->index + internal_size / 2,
-                        sizeof(long long) * (internal_size / 2 - 1)
-                );
-                memcpy(
-                        next->child,
-                        internal->child + internal_size / 2,
-                        sizeof(int) * internal_size / 2
-                );
+        bool backing_up() {
+            return !memory_only && pages.backing_up();
+        }
 
-                if (!recursive_layer) { // root
-                    root_pos = storage.new_internal();
-                    InternalNode *root = dynamic_cast<InternalNode *>(storage[root_pos]);
+        bool backup_full() {
+            return memory_only || pages.backup_full();
+        }
 
-                    root->index[0] = up_move_index;
-                    root->child[0] = file_pos;
-                    root->child[1] = next_pos;
-                    root->size = 2;
-                }
-                else {
-                    InternalNode *par = dynamic_cast<InternalNode *>(storage[recursive_par[recursive_layer - 1]]);
-                    par->insert(up_move_index, next_pos, recursive_cursor[recursive_layer - 1] + 1);
-                }
-            }
+        static int restore(const char *const *chain, int count, Vector<char> &meta) {
+            return Manager::restore(data_path, info_path, chain, count, meta);
         }
-    }
 
+        Node *operator[](FilePos index) {
 
-    bool remove_recursive(FilePos file_pos, int recursive_layer = 0) {
+            if (memory_only)
+                return reinterpret_cast<Node *>(memory[index]);
 
-        Node *node = storage[file_pos];
+            // internal nodes stay pinned once seen, so descents skip the replacement policy
 
-        if (LeafNode *leaf = dynamic_cast<LeafNode *>(node)) {
+            if (char *page = pages.pinned(index, true))
+                return reinterpret_cast<Node *>(page);
 
-            int remove_cursor = binary_search(leaf->data, leaf->size, data_in_operation);
+            Node *node = reinterpret_cast<Node *>(pages[index]);
+            pin_internal(index, node);
+            return node;
+        }
 
-            while (true) {
-                if (remove_cursor == leaf->size)
-                    return false;
-                if (data_in_operation.index < leaf->data[remove_cursor].index)
-                    return false;
+        bool read_copy(FilePos index, char *image, char *page) {
 
-                if (strcmp(data_in_operation.str, leaf->data[remove_cursor].str) == 0) {
-                    leaf->remove(remove_cursor);
-                    if (remove_cursor == 0 && recursive_layer) {
-                        maintain_index_recursive(leaf->data[0].index, recursive_layer);
-                        leaf = dynamic_cast<LeafNode *>(storage[file_pos]);
-                    }
-                    break;
-                }
-                ++remove_cursor;
+            // the stored page deserialized into a caller's buffer, beside the cache; false when the image is no node
+
+            if (memory_only)
+                Node::serialize(image, reinterpret_cast<Node *>(memory[index]));
+            else
+                pages.read_image(index, image);
+            int node_type, buffered;
+            memcpy(&node_type, image, sizeof(int));
+            if (node_type < 0 || node_type > 2)
+                return false;
+            if (node_type == 2) {
+                memcpy(&buffered, image + sizeof(int) + sizeof(Index) * (internal_size - 1) +
+                                  sizeof(FilePos) * internal_size * (counted ? 2 : 1) + sizeof(int), sizeof(int));
+                if (buffered < 0 || buffered > buffer_size)
+                    return false;
             }
+            Node::deserialize(image, page);
+            return true;
+        }
 
-            if (leaf->size < leaf_merge_size && recursive_layer) {
+        void checkpoint() {
+            pages.checkpoint();
+        }
 
-                InternalNode *par = dynamic_cast<InternalNode *>(storage[recursive_par[recursive_layer - 1]]);
-                int par_insert_cursor = recursive_cursor[recursive_layer - 1];
-                LeafNode *left_bro = nullptr, *right_bro = nullptr;
+        FilePos page_count() {
+            return memory_only ? memory.page_count() : pages.page_count();
+        }
 
-                if (par_insert_cursor > 0)
-                    left_bro = dynamic_cast<LeafNode *>(storage[par->child[par_insert_cursor - 1]]);
-                if (par_insert_cursor < par->size - 1)
-                    right_bro = dynamic_cast<LeafNode *>(storage[par->child[par_insert_cursor + 1]]);
+        void free_list(Vector<FilePos> &result) {
+            if (memory_only)
+                memory.free_list(result);
+            else
+                pages.free_list(result);
+        }
 
-                if (left_bro && left_bro->size > leaf_merge_size) {
-                    leaf->insert(left_bro->data[left_bro->size - 1], 0);
-                    --left_bro->size;
-                    par->index[par_insert_cursor - 1] = leaf->data[0].index;
-                }
-                else if (right_bro && right_bro->size > leaf_merge_size) {
-                    leaf->insert(right_bro->data[0], leaf->size);
-                    right_bro->remove(0);
-                    par->index[par_insert_cursor] = right_bro->data[0].index;
-                }
-                else if (left_bro) {
-                    memcpy(
-                            left_bro->data + left_bro->size,
-                            leaf->data,
-                            sizeof(Data) * leaf->size
-                    );
-                    left_bro->size += leaf->size;
-                    left_bro->next = leaf->next;
-                    storage.free(file_pos);
-                    par->remove(par_insert_cursor);
-                }
-                else if (right_bro) {
-                    memcpy(
-                            leaf->data + leaf->size,
-                            right_bro->data,
-                            sizeof(Data) * right_bro->size
-                    );
-                    leaf->size += right_bro->size;
-                    leaf->next = right_bro->next;
-                    storage.free(par->child[par_insert_cursor + 1]);
-                    par->remove(par_insert_cursor + 1);
-                }
-            }
+        const Node *read(FilePos index) {
+            if (memory_only)
+                return reinterpret_cast<const Node *>(memory[index]);
+            if (char *page = pages.pinned(index))
+                return reinterpret_cast<Node *>(page);
+            return reinterpret_cast<const Node *>(pages.read(index));
         }
 
-        else if (InternalNode *internal = dynamic_cast<InternalNode *>(node)) {
+        FilePos new_leaf() {
+            if (memory_only)
+                return memory.template alloc_page<LeafNode>();
+            return pages.template alloc_page<LeafNode>();
+        }
 
-            recursive_cursor[recursive_layer] = binary_search(internal->index, internal->size - 1,
-                                                              data_in_operation.index);
-            recursive_par[recursive_layer] = file_pos;
+        FilePos new_catalog() {
+            if (memory_only)
+                return memory.template alloc_page<CatalogNode>();
+            return pages.template alloc_page<CatalogNode>();
+        }
 
-            while (true) {
-                if (remove_recursive(internal->child[recursive_cursor[recursive_layer]], recursive_layer + 1))
-                    break;
+        FilePos new_internal() {
+            if (memory_only)
+                return memory.template alloc_page<InternalNode>();
+            FilePos index = pages.template alloc_page<InternalNode>();
+            if (pages.pinned_size() < pin_limit())
+                pages.pin(index);
+            return index;
+        }
 
-                internal = dynamic_cast<InternalNode *>(storage[file_pos]); // previous cache might be evicted
+        void free(FilePos index) {
+            if (memory_only)
+                memory.free_page(index);
+            else
+                pages.free_page(index);
+        }
 
-                if (recursive_cursor[recursive_layer] == internal->size - 1)
-                    return false;
-                if (data_in_operation.index < internal->index[recursive_cursor[recursive_layer]])
-                    return false;
+        int version(FilePos index) {
+            return memory_only ? memory.version(index) : pages.version(index);
+        }
 
-                ++recursive_cursor[recursive_layer];
-            }
+        void set_dirty_ratio(double ratio) {
+            pages.set_dirty_ratio(ratio);
+        }
 
-            internal = dynamic_cast<InternalNode *>(storage[file_pos]);
+        void reset() {
+            if (memory_only)
+                memory.reset();
+            else
+                pages.reset();
+        }
 
-            if (internal->size < internal_merge_size && recursive_layer) {
+        // the buffer pool settings below only concern a tree on disk
 
-                InternalNode *par = dynamic_cast<InternalNode *>(storage[recursive_par[recursive_layer - 1]]);
-                int par_insert_cursor = recursive_cursor[recursive_layer - 1];
-                InternalNode *left_bro = nullptr, *right_bro = nullptr;
+        bool set_compression(bool enable) {
+            return !memory_only && pages.set_compression(enable);
+        }
 
-                if (par_insert_cursor > 0)
-                    left_bro = dynamic_cast<InternalNode *>(storage[par->child[par_insert_cursor - 1]]);
-                if (par_insert_cursor < par->size - 1)
-                    right_bro = dynamic_cast<InternalNode *>(storage[par->child[par_insert_cursor + 1]]);
+        bool set_frame_arena(int huge, int numa) {
+            if (memory_only)
+                return false;
+            arena_huge = huge;
+            arena_numa = numa;
+            return pages.set_frame_arena(huge, numa);
+        }
 
-                if (left_bro && left_bro->size > internal_merge_size) {
-                    internal->insert_head(par->index[par_insert_cursor - 1], left_bro->child[left_bro->size - 1]);
-                    par->index[par_insert_cursor - 1] = left_bro->index[left_bro->size - 2];
-                    --left_bro->size;
-                }
-                else if (right_bro && right_bro->size > internal_merge_size) {
-                    internal->insert(par->index[par_insert_cursor], right_bro->child[0], internal->size);
-                    par->index[par_insert_cursor] = right_bro->index[0];
-                    right_bro->remove_head();
-                }
-                else if (left_bro) {
-                    memcpy(
-                            left_bro->index + left_bro->size,
-                            internal->index,
-                            sizeof(long long) * (internal->size - 1)
-                    );
-                    left_bro->index[left_bro->size - 1] = par->index[par_insert_cursor - 1];
-                    memcpy(
-                            left_bro->child + left_bro->size,
-                            internal->child,
-                            sizeof(FilePos) * internal->size
-                    );
-                    left_bro->size += internal->size;
-                    storage.free(file_pos);
-                    par->remove(par_insert_cursor);
-                }
-                else if (right_bro) {
-                    memcpy(
-                            internal->index + internal->size,
-                            right_bro->index,
-                            sizeof(long long) * (right_bro->size - 1)
-                    );
-                    internal->index[internal->size - 1] = par->index[par_insert_cursor];
-                    memcpy(
-                            internal->child + internal->size,
-                            right_bro->child,
-                            sizeof(FilePos) * right_bro->size
-                    );
-                    internal->size += right_bro->size;
-                    storage.free(par->child[par_insert_cursor + 1]);
-                    par->remove(par_insert_cursor + 1);
-                }
+        bool resize_pool(long long bytes) {
+            if (memory_only) {
+                memory.reserve((FilePos) (bytes / page_size));
+                return true;
             }
+            if (!pages.resize_frames((int) (bytes / pages.frame_bytes())))
+                return false;
+            pool_frames = pages.frame_capacity();
+            pages.release_pins(pin_limit());
+            return true;
+        }
 
-            else if (internal->size == 1 && !recursive_layer) {
-                root_pos = internal->child[0];
-                storage.free(file_pos);
-            }
+        void set_pool_budget(long long bytes, double miss_rate) {
+            if (memory_only)
+                return;
+            pool_budget = bytes;
+            pool_miss_rate = miss_rate;
+            pages.set_pool_budget(bytes, miss_rate);
+            pages.release_pins(pin_limit());
         }
 
-        return true;
-    }
+        void set_profiler(PhaseProfiler *profiler) {
+            pages.set_profiler(profiler, phase_io);
+        }
 
-public:
+        bool set_epochs(EpochManager *epochs) {
+            if (memory_only)
+                return false;
+            pages.set_epochs(epochs);
+            return true;
+        }
 
-    explicit BPlusTree(bool reset = false) : storage() {
+        void review_pool() {
 
-        if (reset) {
-            std::remove(data_path);
-            std::remove(info_path);
-            std::remove(root_path);
-            root_pos = storage.new_leaf();
+            // between operations only, a resize moves and evicts frames
+
+            if (!memory_only && pages.review_due() && pages.review_pool()) {
+                pool_frames = pages.frame_capacity();
+                pages.release_pins(pin_limit());
+            }
         }
-        else {
-            std::fstream root_file;
 
-            root_file.open(
-                    root_path,
-                    std::fstream::in | std::fstream::binary
-            );
+        void prefetch(FilePos index) {
+            if (!memory_only)
+                pages.prefetch(index);
+        }
 
-            if (root_file.is_open()) {
-                root_file.seekg(0);
-                root_file.read(reinterpret_cast<char *>(&root_pos), sizeof(int));
+        bool ready(FilePos index) {
+            return memory_only || pages.ready(index);
+        }
+
+        void touch(FilePos index) {
+
+            // starts bringing a page closer: a cache line prefetch when it is resident, a file read otherwise
+
+            if (const char *page = memory_only ? memory[index] : pages.resident(index)) {
+                __builtin_prefetch(page);
+                __builtin_prefetch(page + page_size / 4);
+                __builtin_prefetch(page + page_size / 2);
             }
             else
-                root_pos = storage.new_leaf();
+                pages.prefetch(index);
+        }
 
-            root_file.close();
+        int prefetch_depth() {
+            return memory_only ? 0 : pages.prefetch_depth();
         }
 
-        recursive_par.resize(64);
-        recursive_cursor.resize(64);
-    }
+        void set_read_ahead(int max_depth) {
+            pages.set_read_ahead(max_depth);
+        }
 
-    ~BPlusTree() {
+        void flush_stats(Stats &result) {
+            result.flushed_pages = pages.flushed_size();
+            result.write_calls = pages.write_count();
+            result.flush_stalls = pages.stall_count();
+            result.prefetch_issued = pages.prefetch_issue_count();
+            result.prefetch_used = pages.prefetch_use_count();
+            result.prefetch_wasted = pages.prefetch_waste_count();
+            result.disk_bytes = pages.disk_size();
+            result.written_bytes = pages.written_size();
+            result.compress_ns = pages.compress_time();
+            result.decompress_ns = pages.decompress_time();
+            result.decompressed_pages = pages.decompressed_count();
+            result.frame_huge_pages = pages.frame_huge_pages();
+            result.frame_numa_placed = pages.frame_numa_placed();
+            result.resident_bytes = pages.resident_bytes();
+            result.pool_bytes = pages.pool_bytes();
+            result.pool_resizes = pages.resize_count();
+            result.epoch_retired = pages.retired_count();
+            result.epoch_waits = pages.epoch_wait_count();
+            if (memory_only) {
+                result.resident_bytes = memory.resident_bytes();
+                result.pool_bytes = memory.pool_bytes();
+            }
+        }
+    };
 
-        std::fstream root_file;
+    class Catalog;
 
-        root_file.open(
-                root_path,
-                std::fstream::out | std::fstream::binary
-        );
+private:
 
-        root_file.write(reinterpret_cast<char *>(&root_pos), sizeof(int));
-        root_file.close();
-    }
+    StorageInterface *own_storage; // nullptr for a tree of a catalog, which uses the catalog's
+    StorageInterface &storage;
 
-    void insert(const char *key, int value) {
-        strcpy(data_in_operation.str, key);
-        data_in_operation.index = ((long long) hash(key) << 32) + value;
-        insert_recursive(root_pos);
+    Catalog *catalog;
+    int catalog_slot;
+
+    FilePos root_pos;
+
+    /*
+     * snapshots: publish() copies the data file under the next generation's name, then renames a superblock
+     * naming that generation and its root over snapshot_path; a replica rereads the superblock every
+     * snapshot_poll_ms and reopens when the generation changed
+     */
+
+    static constexpr int snapshot_poll_ms = 20;
+
+    bool read_only;
+    long long snapshot_generation; // 0 before the first one
+    std::chrono::steady_clock::time_point snapshot_checked;
+
+    static std::string snapshot_file(long long generation, const char *kind) {
+        return "snapshot-" + std::to_string(generation) + "-" + kind + ".bin";
     }
 
-    void remove(const char *key, int value) {
-        strcpy(data_in_operation.str, key);
-        data_in_operation.index = ((long long) hash(key) << 32) + value;
-        remove_recursive(root_pos);
+    static bool read_superblock(long long &generation, FilePos &root, bool &optimized, long long &seq) {
+        std::fstream superblock(snapshot_path, std::fstream::in | std::fstream::binary);
+        return superblock.read(reinterpret_cast<char *>(&generation), sizeof(long long)) &&
+               superblock.read(reinterpret_cast<char *>(&root), sizeof(int)) &&
+               superblock.read(reinterpret_cast<char *>(&optimized), sizeof(bool)) &&
+               superblock.read(reinterpret_cast<char *>(&seq), sizeof(long long));
     }
 
-    void print_value(const char *key) {
+    void follow_snapshot(bool force = false) {
 
-        long long index = (long long) hash(key) << 32;
-        FilePos cur_pos = root_pos;
-        Node *cur = storage[cur_pos];
+        // the writer removes old generations, one gone before it could be opened means the superblock moved on again
 
-        while (InternalNode *internal = dynamic_cast<InternalNode *>(cur)) {
-            cur_pos = internal->child[binary_search(internal->index, internal->size - 1, index)];
-            cur = storage[cur_pos];
+        if (!read_only)
+            return;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (!force && now - snapshot_checked < std::chrono::milliseconds(snapshot_poll_ms))
+            return;
+        snapshot_checked = now;
+
+        for (int attempt = 0; attempt < 3; ++attempt) {
+            long long generation, seq;
+            FilePos root;
+            bool optimized;
+            if (!read_superblock(generation, root, optimized, seq) || generation == snapshot_generation)
+                return;
+
+            hint_cache.clear();
+            if (storage.open_snapshot(snapshot_file(generation, "data"), snapshot_file(generation, "info"))) {
+                snapshot_generation = generation;
+                root_pos = root;
+                write_optimized = optimized;
+                message_seq = seq;
+                return;
+            }
+            snapshot_generation = 0; // an empty tree until a snapshot opens
+            write_optimized = false;
+            root_pos = storage.new_leaf();
         }
+    }
 
-        LeafNode *leaf = dynamic_cast<LeafNode *>(cur);
-        data_in_operation.index = index;
-        int find_cursor = binary_search(leaf->data, leaf->size, data_in_operation);
+    Vector<FilePos> recursive_par;
+    Vector<int> recursive_cursor;
 
-        bool found = false;
+    Vector<FilePos> scan_path;
+    Vector<int> scan_cursor;
 
-        while (true) {
-            if (find_cursor == leaf->size) {
-                if (leaf->next == -1)
-                    break;
-                leaf = dynamic_cast<LeafNode *>(storage[leaf->next]);
-                find_cursor = 0;
-            }
+    /*
+     * find_batch keeps batch_width lookups in flight, lookup i lives in slot i % batch_width
+     * each step handles one node and starts fetching the next, then moves on to another lookup
+     */
 
-            if (leaf->data[find_cursor].index - index >= (1ll << 32))
-                break;
+    static constexpr int batch_width = 16;
 
-            if (strcmp(key, leaf->data[find_cursor].str) == 0) {
-                found = true;
-                std::cout << (int) leaf->data[find_cursor].index << ' ';
-            }
-            ++find_cursor;
-        }
+    struct Lookup {
+        Key key;
+        Index index, last;
+        FilePos pos;
+        int cursor; // -1 until the leaf has been searched
+        bool done;
+        Vector<Value> values;
+    };
 
-        if (!found)
-            std::cout << "null\n";
-        else std::cout << '\n';
-    }
-};
+    Lookup lookups[batch_width];
+
+    Data data_in_operation;
+    Data selected; // last entry returned by select
+
+    // conditional writes: an insert that finds its entry in place stops there, a remove can move the entry in its leaf
+    bool insert_unique, replacing, moved_in_place;
+    Index replacement;
+    int write_status;
+
+    HintCache hint_cache;
+
+    /*
+     * lazy deletes: removals leave short leaves in place and queue them, once each while they stay queued,
+     * compact() merges a bounded number of them every compact_interval removals, one more for every
+     * sparse_backlog leaves waiting, and all of them before the tree is persisted or closed
+     * a queued leaf is found again through the separator right of it: a removal raises the one on its left, which
+     * would route past it, but never lowers that one
+     * short leaves an earlier run left behind are found by a sweep over the leaves once lazy deletes are turned on,
+     * sweep_leaves of them every compact_interval removals
+     */
+
+    struct SparseLeaf {
+        Index index; // the separator right of the leaf
+        bool rightmost; // there is none, the leaf is the last one
+        FilePos file_pos;
+        int version;
+    };
+
+    static constexpr int sparse_reserve = 1024; // queue room taken up front, a backlog beyond it grows the queue
+    static constexpr int sparse_backlog = 16, sweep_leaves = 16;
+
+    int lazy_merge_size, compact_interval, compact_budget, removes_since_compact;
+    Vector<SparseLeaf> sparse_leaves;
+    int sparse_head;
+    Vector<char> sparse_marked; // by page, set while the leaf is queued
+    long long compacted_leaves;
+    bool sweeping, sweep_started;
+    Index sweep_index; // the sweep has looked at the leaves below it
+
+    int fill_factor;
+    FilePos append_leaf; // right-most leaf, valid while its version matches
+    int append_version;
+    long long append_fast_path;
+
+    PhaseProfiler *profiler;
+    bool allocation_check; // armed checks abort an operation that allocates, see utils/alloc_check.h
+
+    bool append_to_last_leaf(bool unique = false) {
+
+        // bulk-style append: a key beyond the right-most leaf goes there without a descent; a unique one only past
+        // every index there, an equal one may be the entry itself
+
+        PhaseScope scope(profiler, phase_leaf);
+        if (append_leaf == -1 || storage.version(append_leaf) != append_version)
+            return false;
+
+        typename StorageInterface::Guard guard(storage, append_leaf);
+        LeafNode *leaf = dynamic_cast<LeafNode *>(guard.get());
+        if (!leaf || leaf->next != -1 || !leaf->size || leaf->size >= leaf_size - 1 ||
+            data_in_operation.index < leaf->data[leaf->size - 1].index ||
+            (unique && !(leaf->data[leaf->size - 1].index < data_in_operation.index)))
+            return false;
+
+        leaf->insert(data_in_operation, leaf->size);
+        if (counted) // the right-most leaf lies below the last child all the way down
+            for (InternalNode *internal = dynamic_cast<InternalNode *>(storage[root_pos]); internal;
+                 internal = dynamic_cast<InternalNode *>(storage[internal->child[internal->size - 1]]))
+                ++internal->count[internal->size - 1];
+        ++append_fast_path;
+        return true;
+    }
+
+    void scan_pages(FilePos file_pos, Stats &result, long long &leaf_used, long long &internal_used) {
+        const Node *node = storage.read(file_pos);
+        if (const LeafNode *leaf = dynamic_cast<const LeafNode *>(node)) {
+            ++result.leaf_pages;
+            leaf_used += leaf->size;
+            return;
+        }
+
+        typename StorageInterface::Guard guard(storage, file_pos, false);
+        InternalNode *internal = dynamic_cast<InternalNode *>(guard.get());
+        ++result.internal_pages;
+        internal_used += internal->size;
+        for (int i = 0; i < internal->size; ++i) {
+            int depth = storage.prefetch_depth();
+            for (int j = i + 1; j < internal->size && j <= i + depth; ++j)
+                storage.prefetch(internal->child[j]);
+            scan_pages(internal->child[i], result, leaf_used, internal_used);
+        }
+    }
+
+    void start_lookup(Lookup &lookup, Key key) {
+        lookup.key = key;
+        lookup.index = Codec::first(key);
+        lookup.last = Codec::last(lookup.index);
+        lookup.pos = root_pos;
+        lookup.cursor = -1;
+        lookup.done = false;
+        lookup.values.resize(0);
+        storage.touch(root_pos);
+    }
+
+    bool step_lookup(Lookup &lookup, bool force) {
+
+        // returns false without doing anything while the page is still on its way, unless forced
+
+        if (!force && !storage.ready(lookup.pos)) {
+            storage.prefetch(lookup.pos);
+            return false;
+        }
+
+        const Node *node = storage.read(lookup.pos);
+        if (const InternalNode *internal = dynamic_cast<const InternalNode *>(node)) {
+            lookup.pos = internal->child[binary_search<const Index>(internal->index, internal->size - 1, lookup.index)];
+            storage.touch(lookup.pos);
+            return true;
+        }
+
+        const LeafNode *leaf = dynamic_cast<const LeafNode *>(node);
+        if (lookup.cursor == -1) {
+            data_in_operation.index = lookup.index;
+            lookup.cursor = binary_search<const Data>(leaf->data, leaf->size, data_in_operation);
+        }
+
+        for (; lookup.cursor < leaf->size; ++lookup.cursor) {
+            if (lookup.last < leaf->data[lookup.cursor].index) {
+                lookup.done = true;
+                return true;
+            }
+            if (Codec::match(lookup.key, leaf->data[lookup.cursor]))
+                lookup.values.push_back(Codec::value(leaf->data[lookup.cursor].index));
+        }
+
+        if (leaf->next == -1)
+            lookup.done = true;
+        else {
+            lookup.pos = leaf->next;
+            lookup.cursor = 0;
+            storage.touch(lookup.pos);
+        }
+        return true;
+    }
+
+    void read_ahead(FilePos next_pos) {
+
+        // scan_path holds the internal nodes above the current leaf and the child taken in each,
+        // advancing it to next_pos shows which leaves follow, and up to prefetch_depth of them are read in the background
+
+        int level = scan_path.size() - 1;
+        if (level < 0)
+            return;
+
+        const InternalNode *parent = dynamic_cast<const InternalNode *>(storage.read(scan_path[level]));
+        if (scan_cursor[level] + 1 < parent->size)
+            ++scan_cursor[level];
+        else {
+            int up = level - 1;
+            while (up >= 0 && scan_cursor[up] + 1 >= dynamic_cast<const InternalNode *>(storage.read(scan_path[up]))->size)
+                --up;
+            if (up < 0) {
+                scan_path.resize(0);
+                return;
+            }
+            ++scan_cursor[up];
+            for (int i = up + 1; i <= level; ++i) {
+                scan_path[i] = dynamic_cast<const InternalNode *>(storage.read(scan_path[i - 1]))->child[scan_cursor[i - 1]];
+                scan_cursor[i] = 0;
+            }
+            parent = dynamic_cast<const InternalNode *>(storage.read(scan_path[level]));
+        }
+
+        if (parent->child[scan_cursor[level]] != next_pos) {
+            scan_path.resize(0);
+            return;
+        }
+
+        int depth = storage.prefetch_depth();
+        for (int i = scan_cursor[level] + 1; i < parent->size && i <= scan_cursor[level] + depth; ++i)
+            storage.prefetch(parent->child[i]);
+    }
+
+    bool write_optimized;
+    int fan_out, fan_out_merge; // an internal node splits at fan_out children and is merged below fan_out_merge
+    bool messages_pending; // some buffer may hold messages, cleared once they are all drained
+    long long message_seq;
+    Vector<int> flush_count, flush_route; // children per buffered message, routed once per flush step
+    Vector<Message> deferred; // removes that may continue past the flushed subtree, and what follows them
+    Vector<Message> found_messages;
+    Vector<int> message_effect; // what each of found_messages does to the entries, see pending_messages()
+    Vector<int> group_start; // select_pending() state
+    Vector<long long> group_before;
+    Vector<Data> group_entries;
+    Vector<Value> found_values;
+
+    /*
+     * memtable front: writes land in active_table, a full table is frozen and merged
+     * into the tree by drain_thread as one sorted batch, a few entries per tree_lock hold
+     * entries of frozen_table up to drained_until are already in the tree
+     * the two tables take turns, a drained one is cleared into spare_table; each carves its nodes out of its own
+     * arena, which keeps its blocks, so once both have held a full table writing to them allocates nothing
+     */
+
+    typedef SkipList<Message> MemTable;
+
+    static constexpr int drain_batch = 256;
+
+    int mem_table_limit;
+    long long table_seq;
+    MemTable *active_table, *frozen_table, *spare_table;
+    Arena table_arena[2];
+    Message drained_until;
+    bool drain_stop;
+    int drain_waiters; // callers of wait_for_drain, while any waits a table is frozen however short
+    std::mutex tree_lock, table_lock;
+    std::condition_variable drain_signal, drained_signal;
+    std::thread drain_thread;
+
+    LeafNode *hinted_leaf(int key_hint, const Index &index, typename StorageInterface::Guard &guard) {
+
+        // a hint is usable while the page was neither freed nor reallocated, and no smaller key can hide before it
+
+        FilePos hint_pos;
+        int hint_version;
+        if (!hint_cache.find(key_hint, hint_pos, hint_version))
+            return nullptr;
+
+        if (storage.version(hint_pos) == hint_version) {
+            LeafNode *leaf = dynamic_cast<LeafNode *>(guard.reset(storage, hint_pos, false));
+            if (leaf && leaf->size && leaf->data[0].index < index) {
+                ++hint_cache.hits;
+                return leaf;
+            }
+        }
+
+        ++hint_cache.stale;
+        hint_cache.erase(key_hint);
+        return nullptr;
+    }
+
+    void adjust_counts(int recursive_layer, int delta) {
+
+        // an entry entered or left the leaf below the current path, every ancestor's count for that child follows
+
+        if (!counted)
+            return;
+        for (int i = 0; i < recursive_layer; ++i)
+            dynamic_cast<InternalNode *>(storage[recursive_par[i]])->count[recursive_cursor[i]] += delta;
+    }
+
+    void maintain_index_recursive(const Index &new_index, int recursive_layer) {
+
+        // called when leaf->data[0] or internal->child[0] modified
+
+        --recursive_layer;
+        while (recursive_layer >= 0) {
+            if (recursive_cursor[recursive_layer]) {
+                InternalNode *internal = dynamic_cast<InternalNode *>(storage[recursive_par[recursive_layer]]);
+                internal->index[recursive_cursor[recursive_layer] - 1] = new_index;
+                return;
+            }
+            --recursive_layer;
+        }
+    }
+
+    int split_point(int size, bool append) {
+
+        // an append at the right end leaves the left page at the fill factor instead of half empty
+
+        if (!append)
+            return size / 2;
+        int left = size * fill_factor / 100;
+        if (left < size / 2)
+            return size / 2;
+        return left > size - 2 ? size - 2 : left;
+    }
+
+    static bool run_end(LeafNode *leaf, int cursor) {
+
+        // an increasing value appended behind its key's run: later values of that key will follow it
+
+        const Index &key = leaf->data[cursor].index;
+        return cursor && cursor < leaf->size - 1 &&
+               Codec::same_key(leaf->data[cursor - 1].index, key) && !Codec::same_key(leaf->data[cursor + 1].index, key);
+    }
+
+    void split_internal(FilePos file_pos, InternalNode *internal, int recursive_layer, bool append = false) {
+
+        PhaseScope scope(profiler, phase_restructure);
+
+        FilePos next_pos = storage.new_internal();
+        typename StorageInterface::Guard next_guard(storage, next_pos);
+        InternalNode *next = dynamic_cast<InternalNode *>(next_guard.get());
+
+        int size = internal->size;
+        int left_size = split_point(size, append);
+        Index up_move_index = internal->index[left_size - 1];
+        internal->size = left_size;
+        next->size = size - left_size;
+        memcpy(
+                next->index,
+                internal->index + left_size,
+                sizeof(Index) * (next->size - 1)
+        );
+        memcpy(
+                next->child,
+                internal->child + left_size,
+                sizeof(int) * next->size
+        );
+        if (counted)
+            memcpy(next->count, internal->count + left_size, sizeof(int) * next->size);
+        next->take_messages(internal, up_move_index, Codec::max_index());
+        int moved_count = counted ? next->total(0, next->size) : 0;
+
+        if (!recursive_layer) { // root
+            root_pos = storage.new_internal();
+            InternalNode *root = dynamic_cast<InternalNode *>(storage[root_pos]);
+
+            root->index[0] = up_move_index;
+            root->child[0] = file_pos;
+            root->child[1] = next_pos;
+            if (counted) {
+                root->count[0] = internal->total(0, internal->size);
+                root->count[1] = moved_count;
+            }
+            root->size = 2;
+        }
+        else {
+            InternalNode *par = dynamic_cast<InternalNode *>(storage[recursive_par[recursive_layer - 1]]);
+            if (counted)
+                par->count[recursive_cursor[recursive_layer - 1]] -= moved_count;
+            par->insert(up_move_index, next_pos, recursive_cursor[recursive_layer - 1] + 1, moved_count);
+        }
+    }
+
+    void rebalance_internal(FilePos file_pos, InternalNode *internal, int recursive_layer) {
+
+        // pending messages follow the children they route to; a move that overflows a buffer is skipped
+
+        PhaseScope scope(profiler, phase_restructure);
+
+        InternalNode *par = dynamic_cast<InternalNode *>(storage[recursive_par[recursive_layer - 1]]);
+        int par_insert_cursor = recursive_cursor[recursive_layer - 1];
+        InternalNode *left_bro = nullptr, *right_bro = nullptr;
+        typename StorageInterface::Guard left_guard, right_guard;
+
+        if (par_insert_cursor > 0)
+            left_bro = dynamic_cast<InternalNode *>(left_guard.reset(storage, par->child[par_insert_cursor - 1]));
+        if (par_insert_cursor < par->size - 1)
+            right_bro = dynamic_cast<InternalNode *>(right_guard.reset(storage, par->child[par_insert_cursor + 1]));
+
+        if (left_bro && left_bro->size > fan_out_merge &&
+            internal->buffered + left_bro->count_messages(left_bro->index[left_bro->size - 2], Codec::max_index()) <= buffer_size) {
+            int moved_count = counted ? left_bro->count[left_bro->size - 1] : 0;
+            internal->insert_head(par->index[par_insert_cursor - 1], left_bro->child[left_bro->size - 1], moved_count);
+            par->index[par_insert_cursor - 1] = left_bro->index[left_bro->size - 2];
+            --left_bro->size;
+            if (counted) {
+                par->count[par_insert_cursor - 1] -= moved_count;
+                par->count[par_insert_cursor] += moved_count;
+            }
+            internal->take_messages(left_bro, par->index[par_insert_cursor - 1], Codec::max_index());
+        }
+        else if (right_bro && right_bro->size > fan_out_merge &&
+                 internal->buffered + right_bro->count_messages(Codec::min_index(), right_bro->index[0]) <= buffer_size) {
+            int moved_count = counted ? right_bro->count[0] : 0;
+            internal->take_messages(right_bro, Codec::min_index(), right_bro->index[0]);
+            internal->insert(par->index[par_insert_cursor], right_bro->child[0], internal->size, moved_count);
+            par->index[par_insert_cursor] = right_bro->index[0];
+            right_bro->remove_head();
+            if (counted) {
+                par->count[par_insert_cursor + 1] -= moved_count;
+                par->count[par_insert_cursor] += moved_count;
+            }
+        }
+        else if (left_bro && left_bro->size <= fan_out_merge &&
+                 left_bro->buffered + internal->buffered <= buffer_size) {
+            memcpy(
+                    left_bro->index + left_bro->size,
+                    internal->index,
+                    sizeof(Index) * (internal->size - 1)
+            );
+            left_bro->index[left_bro->size - 1] = par->index[par_insert_cursor - 1];
+            memcpy(
+                    left_bro->child + left_bro->size,
+                    internal->child,
+                    sizeof(FilePos) * internal->size
+            );
+            if (counted) {
+                memcpy(left_bro->count + left_bro->size, internal->count, sizeof(int) * internal->size);
+                par->count[par_insert_cursor - 1] += par->count[par_insert_cursor];
+            }
+            left_bro->size += internal->size;
+            left_bro->take_messages(internal, Codec::min_index(), Codec::max_index());
+            storage.free(file_pos);
+            par->remove(par_insert_cursor);
+        }
+        else if (right_bro && right_bro->size <= fan_out_merge &&
+                 right_bro->buffered + internal->buffered <= buffer_size) {
+            memcpy(
+                    internal->index + internal->size,
+                    right_bro->index,
+                    sizeof(Index) * (right_bro->size - 1)
+            );
+            internal->index[internal->size - 1] = par->index[par_insert_cursor];
+            memcpy(
+                    internal->child + internal->size,
+                    right_bro->child,
+                    sizeof(FilePos) * right_bro->size
+            );
+            if (counted) {
+                memcpy(internal->count + internal->size, right_bro->count, sizeof(int) * right_bro->size);
+                par->count[par_insert_cursor] += par->count[par_insert_cursor + 1];
+            }
+            internal->size += right_bro->size;
+            internal->take_messages(right_bro, Codec::min_index(), Codec::max_index());
+            storage.free(par->child[par_insert_cursor + 1]);
+            par->remove(par_insert_cursor + 1);
+        }
+
+        // held back by the buffers alone: this node's messages go down until the first move above fits,
+        // and the flush, which ends by rebalancing the node, makes it; without this busy buffers never let a tree shrink
+
+        else {
+            int keep = -1;
+            if (left_bro && left_bro->size > fan_out_merge)
+                keep = buffer_size - left_bro->count_messages(left_bro->index[left_bro->size - 2], Codec::max_index());
+            else if (right_bro && right_bro->size > fan_out_merge)
+                keep = buffer_size - right_bro->count_messages(Codec::min_index(), right_bro->index[0]);
+            else if (left_bro)
+                keep = buffer_size - left_bro->buffered;
+            else if (right_bro)
+                keep = buffer_size - right_bro->buffered;
+            if (keep >= 0 && internal->buffered > keep)
+                flush_recursive(file_pos, recursive_layer, keep);
+        }
+    }
+
+    bool run_holds(LeafNode *leaf, int cursor) {
+
+        // whether data_in_operation is among the entries of its index from cursor on, which may go on in later leaves
+
+        typename StorageInterface::Guard guard;
+        while (true) {
+            while (cursor == leaf->size && leaf->next != -1) {
+                leaf = dynamic_cast<LeafNode *>(guard.reset(storage, leaf->next, false));
+                cursor = 0;
+            }
+            if (cursor == leaf->size || data_in_operation.index < leaf->data[cursor].index)
+                return false;
+            if (Codec::match(data_in_operation, leaf->data[cursor]))
+                return true;
+            ++cursor;
+        }
+    }
+
+    void insert_recursive(FilePos file_pos, int recursive_layer = 0) {
+
+        // the guard keeps this frame resident while deeper layers fetch pages
+
+        typename StorageInterface::Guard guard(storage, file_pos);
+        Node *node = guard.get();
+
+        if (LeafNode *leaf = dynamic_cast<LeafNode *>(node)) {
+
+            PhaseScope scope(profiler, phase_leaf);
+            int insert_cursor = binary_search(leaf->data, leaf->size, data_in_operation);
+            if (insert_unique && run_holds(leaf, insert_cursor)) {
+                write_status = write_present;
+                return;
+            }
+            leaf->insert(data_in_operation, insert_cursor);
+            adjust_counts(recursive_layer, 1);
+
+            // insert_cursor == 0 && recursive_layer: iff left-most leaf
+
+            if (leaf->next == -1 && insert_cursor == leaf->size - 1 && leaf->size < leaf_size) {
+                append_leaf = file_pos;
+                append_version = storage.version(file_pos);
+            }
+
+            if (leaf->size == leaf_size) { // split
+
+                PhaseScope split_scope(profiler, phase_restructure);
+                FilePos next_pos = storage.new_leaf();
+                typename StorageInterface::Guard next_guard(storage, next_pos);
+                LeafNode *next = dynamic_cast<LeafNode *>(next_guard.get());
+
+                int left_size = split_point(leaf_size, insert_cursor == leaf_size - 1);
+                if (fill_factor > 50 && insert_cursor + 1 > left_size && run_end(leaf, insert_cursor))
+                    left_size = insert_cursor + 1;
+                leaf->size = left_size;
+                next->size = leaf_size - left_size;
+                next->next = leaf->next;
+                leaf->next = next_pos;
+                memcpy(
+                        next->data,
+                        leaf->data + left_size,
+                        sizeof(Data) * next->size
+                );
+
+                if (next->next == -1) {
+                    append_leaf = next_pos;
+                    append_version = storage.version(next_pos);
+                }
+
+                if (!recursive_layer) { // root
+                    root_pos = storage.new_internal();
+                    InternalNode *root = dynamic_cast<InternalNode *>(storage[root_pos]);
+
+                    root->index[0] = next->data[0].index;
+                    root->child[0] = file_pos;
+                    root->child[1] = next_pos;
+                    if (counted) {
+                        root->count[0] = leaf->size;
+                        root->count[1] = next->size;
+                    }
+                    root->size = 2;
+                }
+                else {
+                    InternalNode *par = dynamic_cast<InternalNode *>(storage[recursive_par[recursive_layer - 1]]);
+                    if (counted)
+                        par->count[recursive_cursor[recursive_layer - 1]] -= next->size;
+                    par->insert(next->data[0].index, next_pos, recursive_cursor[recursive_layer - 1] + 1, next->size);
+                }
+            }
+        }
+
+        else if (InternalNode *internal = dynamic_cast<InternalNode *>(node)) {
+
+            recursive_cursor[recursive_layer] = internal->route(data_in_operation.index);
+            recursive_par[recursive_layer] = file_pos;
+
+            insert_recursive(internal->child[recursive_cursor[recursive_layer]], recursive_layer + 1);
+
+            if (internal->size >= fan_out)
+                split_internal(file_pos, internal, recursive_layer,
+                               recursive_cursor[recursive_layer] == internal->size - 2);
+        }
+    }
+
+
+    bool rebalance_leaf(FilePos file_pos, LeafNode *leaf, int recursive_layer) {
+
+        // returns true when an entry was borrowed and the leaf is still short
+
+        PhaseScope scope(profiler, phase_restructure);
+
+        InternalNode *par = dynamic_cast<InternalNode *>(storage[recursive_par[recursive_layer - 1]]);
+        int par_insert_cursor = recursive_cursor[recursive_layer - 1];
+        LeafNode *left_bro = nullptr, *right_bro = nullptr;
+        typename StorageInterface::Guard left_guard, right_guard;
+
+        if (par_insert_cursor > 0)
+            left_bro = dynamic_cast<LeafNode *>(left_guard.reset(storage, par->child[par_insert_cursor - 1]));
+        if (par_insert_cursor < par->size - 1)
+            right_bro = dynamic_cast<LeafNode *>(right_guard.reset(storage, par->child[par_insert_cursor + 1]));
+
+        if (left_bro && left_bro->size > leaf_merge_size) {
+            leaf->insert(left_bro->data[left_bro->size - 1], 0);
+            --left_bro->size;
+            par->index[par_insert_cursor - 1] = leaf->data[0].index;
+            if (counted) {
+                --par->count[par_insert_cursor - 1];
+                ++par->count[par_insert_cursor];
+            }
+            return true;
+        }
+        else if (right_bro && right_bro->size > leaf_merge_size) {
+            leaf->insert(right_bro->data[0], leaf->size);
+            right_bro->remove(0);
+            par->index[par_insert_cursor] = right_bro->data[0].index;
+            if (counted) {
+                --par->count[par_insert_cursor + 1];
+                ++par->count[par_insert_cursor];
+            }
+            return true;
+        }
+        else if (left_bro) {
+            memcpy(
+                    left_bro->data + left_bro->size,
+                    leaf->data,
+                    sizeof(Data) * leaf->size
+            );
+            left_bro->size += leaf->size;
+            left_bro->next = leaf->next;
+            if (counted)
+                par->count[par_insert_cursor - 1] += leaf->size;
+            storage.free(file_pos);
+            par->remove(par_insert_cursor);
+        }
+        else if (right_bro) {
+            memcpy(
+                    leaf->data + leaf->size,
+                    right_bro->data,
+                    sizeof(Data) * right_bro->size
+            );
+            leaf->size += right_bro->size;
+            leaf->next = right_bro->next;
+            if (counted)
+                par->count[par_insert_cursor] += right_bro->size;
+            storage.free(par->child[par_insert_cursor + 1]);
+            par->remove(par_insert_cursor + 1);
+        }
+        return false;
+    }
+
+    bool right_separator(int recursive_layer, Index &separator) {
+
+        // the separator right of the node reached at recursive_layer, false for the last node of its level
+
+        for (int layer = recursive_layer - 1; layer >= 0; --layer) {
+            const InternalNode *internal = dynamic_cast<const InternalNode *>(storage.read(recursive_par[layer]));
+            if (recursive_cursor[layer] < internal->size - 1) {
+                separator = internal->index[recursive_cursor[layer]];
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void queue_sparse(FilePos file_pos, int recursive_layer) {
+        while (sparse_marked.size() <= file_pos)
+            sparse_marked.push_back(0);
+        if (sparse_marked[file_pos])
+            return;
+        sparse_marked[file_pos] = 1;
+
+        SparseLeaf sparse{};
+        sparse.rightmost = !right_separator(recursive_layer, sparse.index);
+        sparse.file_pos = file_pos;
+        sparse.version = storage.version(file_pos);
+        sparse_leaves.push_back(sparse);
+    }
+
+    void sweep_recursive(FilePos file_pos, int leaves, int recursive_layer = 0) {
+
+        // from the leaf holding the first index above sweep_index, looks at up to leaves of them under one parent
+
+        typename StorageInterface::Guard guard(storage, file_pos, false);
+        InternalNode *internal = dynamic_cast<InternalNode *>(guard.get());
+        if (!internal) { // a root leaf is never short
+            sweeping = false;
+            return;
+        }
+
+        int cursor = sweep_started ? upper_search(internal->index, internal->size - 1, sweep_index) : 0;
+        recursive_par[recursive_layer] = file_pos;
+        recursive_cursor[recursive_layer] = cursor;
+        typename StorageInterface::Guard child(storage, internal->child[cursor], false);
+        if (!dynamic_cast<LeafNode *>(child.get())) {
+            sweep_recursive(internal->child[cursor], leaves, recursive_layer + 1);
+            return;
+        }
+
+        for (; leaves > 0 && cursor < internal->size; ++cursor, --leaves) {
+            recursive_cursor[recursive_layer] = cursor;
+            LeafNode *leaf = static_cast<LeafNode *>(child.reset(storage, internal->child[cursor], false));
+            if (leaf->size < lazy_merge_size && internal->size > 1)
+                queue_sparse(internal->child[cursor], recursive_layer + 1);
+        }
+        sweep_started = true;
+        if (cursor < internal->size)
+            sweep_index = internal->index[cursor - 1];
+        else if (!right_separator(recursive_layer + 1, sweep_index))
+            sweeping = false;
+    }
+
+    bool compact_recursive(FilePos file_pos, const SparseLeaf &target, int recursive_layer = 0) {
+
+        // walks down to a queued leaf like remove_recursive does, then rebalances it and its ancestors
+
+        typename StorageInterface::Guard guard(storage, file_pos);
+        Node *node = guard.get();
+
+        if (LeafNode *leaf = dynamic_cast<LeafNode *>(node)) {
+            if (file_pos != target.file_pos || !recursive_layer)
+                return false;
+            while (leaf->size < lazy_merge_size && rebalance_leaf(file_pos, leaf, recursive_layer));
+            return true;
+        }
+
+        InternalNode *internal = dynamic_cast<InternalNode *>(node);
+        recursive_cursor[recursive_layer] = target.rightmost ? internal->size - 1 : internal->route(target.index);
+        recursive_par[recursive_layer] = file_pos;
+
+        while (!compact_recursive(internal->child[recursive_cursor[recursive_layer]], target, recursive_layer + 1)) {
+            if (recursive_cursor[recursive_layer] == internal->size - 1 ||
+                target.index < internal->index[recursive_cursor[recursive_layer]])
+                return false;
+            ++recursive_cursor[recursive_layer];
+        }
+
+        if (internal->size < fan_out_merge && recursive_layer)
+            rebalance_internal(file_pos, internal, recursive_layer);
+        else if (internal->size == 1 && !recursive_layer && !internal->buffered) {
+            root_pos = internal->child[0];
+            storage.free(file_pos);
+        }
+        return true;
+    }
+
+    void after_remove() {
+        if (lazy_merge_size && compact_interval && ++removes_since_compact >= compact_interval) {
+            removes_since_compact = 0;
+            compact(compact_budget + (sparse_leaves.size() - sparse_head) / sparse_backlog);
+            if (sweeping)
+                sweep_recursive(root_pos, sweep_leaves);
+        }
+    }
+
+    bool remove_recursive(FilePos file_pos, int recursive_layer = 0) {
+
+        typename StorageInterface::Guard guard(storage, file_pos);
+        Node *node = guard.get();
+
+        if (LeafNode *leaf = dynamic_cast<LeafNode *>(node)) {
+
+            PhaseScope scope(profiler, phase_leaf);
+            int remove_cursor = binary_search(leaf->data, leaf->size, data_in_operation);
+
+            while (true) {
+                if (remove_cursor == leaf->size)
+                    return false;
+                if (data_in_operation.index < leaf->data[remove_cursor].index)
+                    return false;
+
+                if (Codec::match(data_in_operation, leaf->data[remove_cursor])) {
+                    if (replacing && !(replacement < leaf->data[0].index) &&
+                        !(leaf->data[leaf->size - 1].index < replacement)) {
+                        // the new index falls inside the leaf: the entry moves over, no count or separator changes
+                        Data moved = leaf->data[remove_cursor];
+                        moved.index = replacement;
+                        leaf->remove(remove_cursor);
+                        leaf->insert(moved, binary_search(leaf->data, leaf->size, moved));
+                        moved_in_place = true;
+                        return true;
+                    }
+                    leaf->remove(remove_cursor);
+                    adjust_counts(recursive_layer, -1);
+
+                    // raising a separator would strand messages buffered below it, a stale one is still a valid bound
+                    if (remove_cursor == 0 && recursive_layer && !write_optimized)
+                        maintain_index_recursive(leaf->data[0].index, recursive_layer);
+                    break;
+                }
+                ++remove_cursor;
+            }
+
+            if (lazy_merge_size) {
+                // lazy mode: a sparse leaf is only queued, the merge happens in compact()
+                if (leaf->size < lazy_merge_size && recursive_layer)
+                    queue_sparse(file_pos, recursive_layer);
+            }
+            else if (leaf->size < leaf_merge_size && recursive_layer)
+                rebalance_leaf(file_pos, leaf, recursive_layer);
+        }
+
+        else if (InternalNode *internal = dynamic_cast<InternalNode *>(node)) {
+
+            recursive_cursor[recursive_layer] = internal->route(data_in_operation.index);
+            recursive_par[recursive_layer] = file_pos;
+
+            while (true) {
+                if (remove_recursive(internal->child[recursive_cursor[recursive_layer]], recursive_layer + 1))
+                    break;
+
+                if (recursive_cursor[recursive_layer] == internal->size - 1)
+                    return false;
+                if (data_in_operation.index < internal->index[recursive_cursor[recursive_layer]])
+                    return false;
+
+                ++recursive_cursor[recursive_layer];
+            }
+
+            if (internal->size < fan_out_merge && recursive_layer)
+                rebalance_internal(file_pos, internal, recursive_layer);
+
+            else if (internal->size == 1 && !recursive_layer && !internal->buffered) {
+                root_pos = internal->child[0];
+                storage.free(file_pos);
+            }
+        }
+
+        return true;
+    }
+
+    long long remove_run_recursive(FilePos file_pos, Key key, const Index &low, const Index &high,
+                                   int recursive_layer = 0) {
+
+        /*
+         * drops the key's entries in [low, high] below file_pos: each leaf is compacted in one pass, then the children
+         * that got short are rebalanced against their siblings, once per child rather than once per entry
+         * returns the entries dropped
+         */
+
+        typename StorageInterface::Guard guard(storage, file_pos);
+        Node *node = guard.get();
+
+        if (LeafNode *leaf = dynamic_cast<LeafNode *>(node)) {
+            PhaseScope scope(profiler, phase_leaf);
+            Data probe;
+            probe.index = low;
+            int kept = binary_search(leaf->data, leaf->size, probe);
+            for (int i = kept; i < leaf->size; ++i)
+                if (high < leaf->data[i].index || !Codec::match(key, leaf->data[i]))
+                    leaf->data[kept++] = leaf->data[i];
+            long long removed = leaf->size - kept;
+            leaf->size = kept;
+            return removed;
+        }
+
+        InternalNode *internal = dynamic_cast<InternalNode *>(node);
+        recursive_par[recursive_layer] = file_pos;
+        int first = internal->route(low), last = first;
+        long long removed = 0;
+        while (true) {
+            long long child_removed = remove_run_recursive(internal->child[last], key, low, high, recursive_layer + 1);
+            if (counted)
+                internal->count[last] -= child_removed;
+            removed += child_removed;
+            if (last == internal->size - 1 || high < internal->index[last])
+                break;
+            ++last;
+        }
+        if (!removed)
+            return 0;
+
+        // a merge takes a child out of the range, the one now at cursor is looked at again
+
+        PhaseScope scope(profiler, phase_restructure);
+        for (int cursor = first; cursor <= last && cursor < internal->size;) {
+            recursive_cursor[recursive_layer] = cursor;
+            FilePos child_pos = internal->child[cursor];
+            int size_before = internal->size;
+            typename StorageInterface::Guard child_guard(storage, child_pos);
+            if (LeafNode *leaf = dynamic_cast<LeafNode *>(child_guard.get()))
+                while (leaf->size < leaf_merge_size && rebalance_leaf(child_pos, leaf, recursive_layer + 1));
+            else {
+                InternalNode *child = dynamic_cast<InternalNode *>(child_guard.get());
+                if (child->size < fan_out_merge)
+                    rebalance_internal(child_pos, child, recursive_layer + 1);
+            }
+            if (internal->size < size_before)
+                --last;
+            else
+                ++cursor;
+        }
+        return removed;
+    }
+
+    void flush_recursive(FilePos file_pos, int recursive_layer = 0, int keep = buffer_size - 1) {
+
+        /*
+         * Bε-tree style flush, while more than keep messages are buffered: the child holding most of them receives
+         * them as one batch
+         * an internal child just takes them into its own buffer (flushing it first when full),
+         * a leaf child gets them applied one by one, which may split or merge leaves under this node
+         */
+
+        PhaseScope scope(profiler, phase_restructure);
+
+        typename StorageInterface::Guard guard(storage, file_pos);
+        InternalNode *internal = dynamic_cast<InternalNode *>(guard.get());
+        recursive_par[recursive_layer] = file_pos;
+
+        while (internal->buffered > keep && internal->size < fan_out) {
+
+            for (int i = 0; i < internal->size; ++i)
+                flush_count[i] = 0;
+            int target = 0;
+            for (int i = 0; i < internal->buffered; ++i) {
+                int cursor = flush_route[i] = internal->route(internal->buffer[i].data.index);
+                if (++flush_count[cursor] > flush_count[target])
+                    target = cursor;
+            }
+
+            recursive_cursor[recursive_layer] = target;
+            FilePos child_pos = internal->child[target];
+            typename StorageInterface::Guard child_guard(storage, child_pos);
+
+            if (InternalNode *child = dynamic_cast<InternalNode *>(child_guard.get())) {
+                if (child->buffered == buffer_size) {
+                    flush_recursive(child_pos, recursive_layer + 1);
+                    recursive_par[recursive_layer] = file_pos;
+                    continue;
+                }
+
+                int kept_size = 0;
+                for (int i = 0; i < internal->buffered; ++i) {
+                    Message &message = internal->buffer[i];
+                    if (child->buffered < buffer_size && flush_route[i] == target)
+                        child->buffer[child->buffered++] = message;
+                    else
+                        internal->buffer[kept_size++] = message;
+                }
+                internal->buffered = kept_size;
+            }
+
+            else {
+                Message batch[buffer_size];
+                int batch_size = 0, kept_size = 0;
+                for (int i = 0; i < internal->buffered; ++i) {
+                    if (flush_route[i] == target)
+                        batch[batch_size++] = internal->buffer[i];
+                    else
+                        internal->buffer[kept_size++] = internal->buffer[i];
+                }
+                internal->buffered = kept_size;
+
+                for (int i = 0; i < batch_size; ++i) {
+                    if (internal->size >= fan_out) { // split pending, keep the rest for later
+                        for (int j = i; j < batch_size; ++j)
+                            internal->buffer[internal->buffered++] = batch[j];
+                        break;
+                    }
+                    apply_to_leaf(internal, batch[i], recursive_layer);
+                }
+            }
+        }
+
+        if (internal->size >= fan_out)
+            split_internal(file_pos, internal, recursive_layer);
+        else if (internal->size < fan_out_merge && recursive_layer)
+            rebalance_internal(file_pos, internal, recursive_layer);
+        else if (internal->size == 1 && !recursive_layer && !internal->buffered) {
+            root_pos = internal->child[0];
+            storage.free(file_pos);
+        }
+    }
+
+    void apply_to_leaf(InternalNode *internal, const Message &message, int recursive_layer) {
+
+        // messages older than the batch never sit below a leaf, so applying in seq order is exact
+
+        // a later message on the index of a deferred remove waits behind it, or the remove could undo it
+
+        for (int i = 0; i < deferred.size(); ++i)
+            if (deferred[i].data.index == message.data.index) {
+                deferred.push_back(message);
+                return;
+            }
+
+        data_in_operation = message.data;
+        recursive_cursor[recursive_layer] = internal->route(data_in_operation.index);
+
+        if (message.type == 0) {
+            insert_recursive(internal->child[recursive_cursor[recursive_layer]], recursive_layer + 1);
+            return;
+        }
+
+        while (!remove_recursive(internal->child[recursive_cursor[recursive_layer]], recursive_layer + 1)) {
+            if (recursive_cursor[recursive_layer] == internal->size - 1 ||
+                data_in_operation.index < internal->index[recursive_cursor[recursive_layer]]) {
+                deferred.push_back(message); // equal keys may continue outside this subtree
+                return;
+            }
+            ++recursive_cursor[recursive_layer];
+        }
+    }
+
+    void buffer_message(int type) {
+
+        typename StorageInterface::Guard guard(storage, root_pos);
+        InternalNode *root = dynamic_cast<InternalNode *>(guard.get());
+
+        if (!root) {
+            if (type == 0)
+                insert_recursive(root_pos);
+            else
+                remove_recursive(root_pos);
+            return;
+        }
+
+        Message &message = root->buffer[root->buffered++];
+        message.data = data_in_operation;
+        message.seq = ++message_seq;
+        message.type = type;
+        messages_pending = true;
+
+        while (true) {
+            InternalNode *cur = dynamic_cast<InternalNode *>(storage[root_pos]);
+            if (!cur || cur->buffered < buffer_size)
+                break;
+            flush_recursive(root_pos);
+        }
+        replay_deferred();
+    }
+
+    void replay_deferred() {
+
+        // from the root, once no descent is under way; the loop takes in what the replay itself defers
+
+        for (int i = 0; i < deferred.size(); ++i) {
+            data_in_operation = deferred[i].data;
+            if (deferred[i].type == 0)
+                insert_recursive(root_pos);
+            else
+                remove_recursive(root_pos);
+        }
+        deferred.resize(0);
+    }
+
+    void collect_messages(FilePos file_pos, const Key *key, const Index &low, const Index &high,
+                          Vector<Message> &result) {
+
+        // gathers the key's messages buffered anywhere in [low, high], every key's for a null key
+
+        typename StorageInterface::Guard guard(storage, file_pos);
+        InternalNode *internal = dynamic_cast<InternalNode *>(guard.get());
+        if (!internal)
+            return;
+
+        for (int i = 0; i < internal->buffered; ++i) {
+            Message &message = internal->buffer[i];
+            if (!(message.data.index < low) && !(high < message.data.index) && (!key || Codec::match(*key, message.data)))
+                result.push_back(message);
+        }
+
+        int first = internal->route(low), last = internal->route(high);
+        if (last < internal->size - 1 && internal->index[last] == high)
+            ++last;
+        for (int i = first; i <= last; ++i)
+            collect_messages(internal->child[i], key, low, high, result);
+    }
+
+    static bool comp_seq(const Message &a, const Message &b) {
+        return a.seq < b.seq;
+    }
+
+    void merge_messages(Key key, const Index &index) {
+
+        // replays the key's pending messages over the values found in the leaves
+
+        found_messages.resize(0);
+        collect_messages(root_pos, &key, index, Codec::last(index), found_messages);
+        if (!found_messages.size())
+            return;
+        qsort(&found_messages[0], &found_messages[0] + found_messages.size(), comp_seq);
+
+        for (int i = 0; i < found_messages.size(); ++i)
+            replay_message(found_messages[i]);
+    }
+
+    void replay_message(const Message &message) {
+
+        Value value = Codec::value(message.data.index);
+        int cursor = binary_search(&found_values[0], found_values.size(), value);
+
+        if (message.type == 0) {
+            found_values.push_back(value);
+            for (int j = found_values.size() - 1; j > cursor; --j)
+                found_values[j] = found_values[j - 1];
+            found_values[cursor] = value;
+        }
+        else if (cursor < found_values.size() && found_values[cursor] == value) {
+            for (int j = cursor; j < found_values.size() - 1; ++j)
+                found_values[j] = found_values[j + 1];
+            found_values.pop_back();
+        }
+    }
+
+    void merge_table(MemTable *table, Key key, const Index &index, const Message *after) {
+        Message low;
+        low.data.index = index;
+        low.seq = LLONG_MIN;
+        if (after && low < *after)
+            low = *after;
+
+        Index last = Codec::last(index);
+        for (typename MemTable::Node *cur = table->lower_bound(low); cur; cur = MemTable::next(cur)) {
+            if (last < cur->value.data.index)
+                break;
+            if (after && !(*after < cur->value))
+                continue;
+            if (Codec::match(key, cur->value.data))
+                replay_message(cur->value);
+        }
+    }
+
+    void collect_values(Key key) {
+
+        // found_values gets the key's values as a find sees them: the leaves, then pending messages and memtables
+
+        bool hinted = hint_cache.enabled() && !write_optimized;
+        int key_hint = hinted ? Codec::hint(key) : 0;
+        Index index = Codec::first(key), last = Codec::last(index);
+        typename StorageInterface::Guard leaf_guard;
+        LeafNode *leaf = hinted ? hinted_leaf(key_hint, index, leaf_guard) : nullptr;
+
+        scan_path.resize(0);
+        scan_cursor.resize(0);
+
+        if (!leaf) {
+            FilePos cur_pos = root_pos;
+            Node *cur = leaf_guard.reset(storage, cur_pos, false);
+
+            while (InternalNode *internal = dynamic_cast<InternalNode *>(cur)) {
+                int cursor = binary_search(internal->index, internal->size - 1, index);
+                scan_path.push_back(cur_pos);
+                scan_cursor.push_back(cursor);
+                cur_pos = internal->child[cursor];
+                cur = leaf_guard.reset(storage, cur_pos, false);
+            }
+
+            leaf = dynamic_cast<LeafNode *>(cur);
+            if (hint_cache.enabled() && leaf->size && leaf->data[0].index < index)
+                hint_cache.update(key_hint, cur_pos, storage.version(cur_pos));
+        }
+        PhaseScope leaf_scope(profiler, phase_leaf);
+        data_in_operation.index = index;
+        int find_cursor = binary_search(leaf->data, leaf->size, data_in_operation);
+
+        found_values.resize(0);
+
+        while (true) {
+            while (find_cursor == leaf->size && leaf->next != -1) { // lazy deletes may leave empty leaves
+                read_ahead(leaf->next);
+                leaf = dynamic_cast<LeafNode *>(leaf_guard.reset(storage, leaf->next, false));
+                find_cursor = binary_search(leaf->data, leaf->size, data_in_operation); // a hinted leaf can end before the key starts
+            }
+            if (find_cursor == leaf->size)
+                break;
+
+            if (last < leaf->data[find_cursor].index)
+                break;
+
+            if (Codec::match(key, leaf->data[find_cursor]))
+                found_values.push_back(Codec::value(leaf->data[find_cursor].index));
+            ++find_cursor;
+        }
+
+        if (write_optimized)
+            merge_messages(key, index);
+
+        if (mem_table_limit) {
+            std::lock_guard<std::mutex> table_guard(table_lock);
+            if (frozen_table)
+                merge_table(frozen_table, key, index, &drained_until);
+            merge_table(active_table, key, index, nullptr);
+        }
+    }
+
+    bool holds(Key key, Value value) {
+
+        // whether a find would list value for key
+
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+        storage.review_pool();
+        PhaseScope scope(profiler, phase_descent);
+        collect_values(key);
+        for (int i = 0; i < found_values.size(); ++i)
+            if (found_values[i] == value)
+                return true;
+        return false;
+    }
+
+    void apply_operation(const Data &data, int type) {
+        data_in_operation = data;
+        if (write_optimized)
+            buffer_message(type);
+        else if (type == 0) {
+            if (!append_to_last_leaf())
+                insert_recursive(root_pos);
+        }
+        else
+            remove_recursive(root_pos);
+        if (type == 1)
+            after_remove();
+    }
+
+    void drain_loop() {
+
+        std::unique_lock<std::mutex> table_guard(table_lock);
+
+        while (true) {
+            if (!frozen_table && active_table->size() &&
+                (drain_stop || drain_waiters || active_table->size() >= mem_table_limit)) {
+                frozen_table = active_table;
+                active_table = spare_table;
+                spare_table = nullptr;
+                drained_until.data.index = Codec::min_index();
+                drained_until.seq = LLONG_MIN;
+            }
+            if (!frozen_table) {
+                if (drain_stop)
+                    return;
+                drain_signal.wait(table_guard);
+                continue;
+            }
+
+            table_guard.unlock();
+            typename MemTable::Node *cur = frozen_table->begin();
+            while (cur) {
+                std::lock_guard<std::mutex> tree_guard(tree_lock);
+                Message last;
+                storage.review_pool();
+                for (int i = 0; i < drain_batch && cur; ++i, cur = MemTable::next(cur)) {
+                    apply_operation(cur->value.data, cur->value.type);
+                    last = cur->value;
+                }
+                std::lock_guard<std::mutex> progress_guard(table_lock);
+                drained_until = last;
+            }
+            table_guard.lock();
+            MemTable *drained = frozen_table;
+            frozen_table = nullptr;
+            table_guard.unlock();
+
+            drained->clear(); // no find reads it any more
+            table_guard.lock();
+            spare_table = drained;
+            drained_signal.notify_all();
+        }
+    }
+
+    void wait_for_drain() {
+
+        // until both tables are in the tree, with the drain thread kept running
+
+        if (!mem_table_limit)
+            return;
+        std::unique_lock<std::mutex> table_guard(table_lock);
+        ++drain_waiters;
+        drain_signal.notify_one();
+        drained_signal.wait(table_guard, [this] { return !frozen_table && !active_table->size() && spare_table; });
+        --drain_waiters;
+    }
+
+    void set_fan_out() {
+
+        // a full buffer flushes about buffered / fan_out messages to a child, with all 180 children that is one,
+        // so in write-optimized mode nodes keep about sqrt(internal_size) children (epsilon 1/2) and every flush
+        // moves a real batch; wider nodes left from before split as they are passed, the page layout stays the same
+
+        fan_out = internal_size;
+        if (write_optimized) {
+            fan_out = 4;
+            while ((fan_out + 1) * (fan_out + 1) <= internal_size)
+                ++fan_out;
+        }
+        fan_out_merge = fan_out == internal_size ? internal_merge_size : fan_out / 3;
+    }
+
+    void drain_messages() {
+
+        // collects every pending message and replays them directly in seq order
+
+        Vector<Message> pending;
+        Vector<FilePos> stack;
+        stack.push_back(root_pos);
+        while (stack.size()) {
+            FilePos cur = stack.back();
+            stack.pop_back();
+            InternalNode *internal = dynamic_cast<InternalNode *>(storage[cur]);
+            if (!internal)
+                continue;
+            for (int i = 0; i < internal->buffered; ++i)
+                pending.push_back(internal->buffer[i]);
+            internal->buffered = 0;
+            for (int i = 0; i < internal->size; ++i)
+                stack.push_back(internal->child[i]);
+        }
+
+        qsort(&pending[0], &pending[0] + pending.size(), comp_seq);
+        for (int i = 0; i < pending.size(); ++i) {
+            data_in_operation = pending[i].data;
+            if (pending[i].type == 0)
+                insert_recursive(root_pos);
+            else
+                remove_recursive(root_pos);
+        }
+        messages_pending = false;
+    }
+
+    void settle() {
+
+        // memtable entries and buffered messages go to the leaves, for the callers that write the whole tree out
+
+        wait_for_drain();
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+        if (write_optimized && messages_pending)
+            drain_messages();
+    }
+
+    long long count_before(const Index &bound, bool inclusive) {
+
+        // entries ordered before bound, or not after it when inclusive: one descent adding up the children passed over
+
+        long long result = 0;
+        typename StorageInterface::Guard guard(storage, root_pos, false);
+        Node *cur = guard.get();
+
+        while (InternalNode *internal = dynamic_cast<InternalNode *>(cur)) {
+            int cursor = inclusive ? upper_search(internal->index, internal->size - 1, bound) : internal->route(bound);
+            result += internal->total(0, cursor);
+            cur = guard.reset(storage, internal->child[cursor], false);
+        }
+
+        LeafNode *leaf = dynamic_cast<LeafNode *>(cur);
+        Data probe;
+        probe.index = bound;
+        return result + (inclusive ? upper_search(leaf->data, leaf->size, probe) : binary_search(leaf->data, leaf->size, probe));
+    }
+
+    int leaf_copies(const Data &data) {
+
+        // entries equal to data in the leaves, the ones a remove of it would find
+
+        typename StorageInterface::Guard guard(storage, root_pos, false);
+        Node *cur = guard.get();
+        while (InternalNode *internal = dynamic_cast<InternalNode *>(cur))
+            cur = guard.reset(storage, internal->child[internal->route(data.index)], false);
+
+        LeafNode *leaf = dynamic_cast<LeafNode *>(cur);
+        int cursor = binary_search(leaf->data, leaf->size, data), copies = 0;
+        while (true) {
+            while (cursor == leaf->size && leaf->next != -1) {
+                leaf = dynamic_cast<LeafNode *>(guard.reset(storage, leaf->next, false));
+                cursor = binary_search(leaf->data, leaf->size, data);
+            }
+            if (cursor == leaf->size || data.index < leaf->data[cursor].index)
+                return copies;
+            if (Codec::match(data, leaf->data[cursor]))
+                ++copies;
+            ++cursor;
+        }
+    }
+
+    long long pending_messages(const Index &low, const Index &high, const Key *key) {
+
+        /*
+         * counts read the leaves, this is what the buffered messages over [low, high] add to them, the way
+         * merge_messages adds them to a find instead of the tree draining every buffer first:
+         * found_messages gets them in index order, message_effect what each does, an insert adds an entry,
+         * a remove takes one only while the leaves and the messages before it on its index left a copy
+         */
+
+        found_messages.resize(0);
+        message_effect.resize(0);
+        if (!write_optimized || !messages_pending)
+            return 0;
+        collect_messages(root_pos, key, low, high, found_messages);
+        int count = found_messages.size();
+        if (!count)
+            return 0;
+        qsort(&found_messages[0], &found_messages[0] + count); // by index, then seq
+
+        message_effect.resize(count);
+        long long total = 0;
+        for (int i = 0, group = 0; i < count; ++i) {
+            const Message &message = found_messages[i];
+            if (found_messages[group].data.index < message.data.index)
+                group = i;
+            if (message.type == 0)
+                message_effect[i] = 1;
+            else {
+                int copies = leaf_copies(message.data);
+                for (int j = group; j < i; ++j)
+                    if (Codec::match(message.data, found_messages[j].data))
+                        copies += message_effect[j];
+                message_effect[i] = copies > 0 ? -1 : 0;
+            }
+            total += message_effect[i];
+        }
+        return total;
+    }
+
+    bool select_leaf(long long position) {
+
+        // the entry of the leaves with position entries before it into selected, false past the end
+
+        if (position < 0)
+            return false;
+        typename StorageInterface::Guard guard(storage, root_pos, false);
+        Node *cur = guard.get();
+        while (InternalNode *internal = dynamic_cast<InternalNode *>(cur)) {
+            int cursor = 0;
+            while (cursor < internal->size - 1 && position >= internal->count[cursor])
+                position -= internal->count[cursor++];
+            cur = guard.reset(storage, internal->child[cursor], false);
+        }
+
+        LeafNode *leaf = dynamic_cast<LeafNode *>(cur);
+        if (position >= leaf->size)
+            return false;
+        selected = leaf->data[position];
+        return true;
+    }
+
+    bool select_pending(long long position) {
+
+        /*
+         * select over the leaves and the messages from pending_messages: before the first index of a group of
+         * messages sit the leaf entries before it and the effects of the groups before, which only grows from group
+         * to group, so a binary search finds the group at or before position, then position is either in the group,
+         * whose leaf entries the messages are replayed over, or a leaf entry between it and the next
+         */
+
+        int count = found_messages.size(), groups = 0;
+        Vector<int> &start = group_start;
+        Vector<long long> &before = group_before;
+        long long effects = 0;
+        start.resize(0);
+        before.resize(0);
+        for (int i = 0; i < count; ++i) {
+            if (!i || found_messages[start[groups - 1]].data.index < found_messages[i].data.index) {
+                start.push_back(i);
+                before.push_back(effects);
+                ++groups;
+            }
+            effects += message_effect[i];
+        }
+
+        int low = 0, high = groups; // the last group whose first index has at most position entries before it
+        while (low < high) {
+            int mid = (low + high) / 2;
+            if (count_before(found_messages[start[mid]].data.index, false) + before[mid] <= position)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        if (!low)
+            return select_leaf(position);
+
+        int group = low - 1, end = group + 1 < groups ? start[group + 1] : count;
+        const Index &index = found_messages[start[group]].data.index;
+        long long first = count_before(index, false), last = count_before(index, true);
+        long long offset = position - first - before[group], group_effect = 0;
+        for (int i = start[group]; i < end; ++i)
+            group_effect += message_effect[i];
+        if (offset >= last - first + group_effect)
+            return select_leaf(last + offset - (last - first + group_effect));
+
+        group_entries.resize(0);
+        for (long long i = first; i < last; ++i) {
+            select_leaf(i);
+            group_entries.push_back(selected);
+        }
+        for (int i = start[group]; i < end; ++i) {
+            const Message &message = found_messages[i];
+            if (message.type == 0) {
+                group_entries.push_back(message.data);
+                continue;
+            }
+            for (int j = 0; j < group_entries.size(); ++j)
+                if (Codec::match(message.data, group_entries[j])) {
+                    for (int k = j; k < group_entries.size() - 1; ++k)
+                        group_entries[k] = group_entries[k + 1];
+                    group_entries.pop_back();
+                    break;
+                }
+        }
+        selected = group_entries[offset];
+        return true;
+    }
+
+    long long count_matches(Key key) {
+
+        // a codec whose index ranges can hold other keys needs every entry in the range compared
+
+        Index index = Codec::first(key), last = Codec::last(index);
+        typename StorageInterface::Guard guard(storage, root_pos, false);
+        Node *cur = guard.get();
+        while (InternalNode *internal = dynamic_cast<InternalNode *>(cur))
+            cur = guard.reset(storage, internal->child[internal->route(index)], false);
+
+        LeafNode *leaf = dynamic_cast<LeafNode *>(cur);
+        Data probe;
+        probe.index = index;
+        int cursor = binary_search(leaf->data, leaf->size, probe);
+        long long result = 0;
+
+        while (true) {
+            while (cursor == leaf->size && leaf->next != -1) {
+                leaf = dynamic_cast<LeafNode *>(guard.reset(storage, leaf->next, false));
+                cursor = binary_search(leaf->data, leaf->size, probe);
+            }
+            if (cursor == leaf->size || last < leaf->data[cursor].index)
+                return result;
+            if (Codec::match(key, leaf->data[cursor]))
+                ++result;
+            ++cursor;
+        }
+    }
+
+    /*
+     * verify: once the cache is checkpointed the file is walked level by level beside it, every level's pages
+     * shared out in blocks between threads that read and check them on buffers of their own; children are gathered
+     * in order between levels, which is where a page referenced twice shows, and the leaves in order give the next chain
+     */
+
+    static constexpr int verify_block = 64, verify_messages = 32;
+
+    struct VerifyTask {
+        FilePos pos;
+        bool has_lower, has_upper;
+        Index lower, upper; // every index below the page lies in [lower, upper]
+        long long expected; // entries the parent counts below the page, -1 when not counted
+    };
+
+    struct LeafSummary {
+        FilePos next;
+        int size;
+        Data first, last;
+    };
+
+    struct VerifyContext {
+        Report report;
+        std::mutex lock;
+        std::atomic<long long> leaf_pages, internal_pages, entries;
+
+        void error(const char *format, long long a, long long b = 0, long long c = 0) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (report.errors++ >= verify_messages)
+                return;
+            char line[160];
+            snprintf(line, sizeof(line), format, a, b, c);
+            report.messages += line;
+            report.messages += '\n';
+        }
+    };
+
+    static bool in_bounds(const VerifyTask &task, const Index &index) {
+        return (!task.has_lower || !(index < task.lower)) && (!task.has_upper || !(task.upper < index));
+    }
+
+    void verify_page(VerifyContext &context, const VerifyTask &task, bool root, char *image, char *page,
+                     Vector<VerifyTask> &children, LeafSummary &summary, char &kind) {
+
+        kind = 0; // 0: unreadable, 1: leaf, 2: internal
+        if (!storage.read_copy(task.pos, image, page)) {
+            context.error("page %lld: not a node", task.pos);
+            return;
+        }
+
+        if (LeafNode *leaf = dynamic_cast<LeafNode *>(reinterpret_cast<Node *>(page))) {
+            kind = 1;
+            summary.next = leaf->next;
+            summary.size = 0;
+            if (leaf->size < 0 || leaf->size >= leaf_size) {
+                context.error("leaf %lld: size %lld out of range", task.pos, leaf->size);
+                return;
+            }
+            summary.size = leaf->size;
+            ++context.leaf_pages;
+            context.entries += leaf->size;
+
+            bool ordered = true, bounded = true;
+            for (int i = 0; i < leaf->size; ++i) {
+                if (i && leaf->data[i] < leaf->data[i - 1])
+                    ordered = false;
+                if (!in_bounds(task, leaf->data[i].index))
+                    bounded = false;
+            }
+            if (!ordered)
+                context.error("leaf %lld: entries out of order", task.pos);
+            if (!bounded)
+                context.error("leaf %lld: entries outside the parent's separators", task.pos);
+            if (task.expected != -1 && leaf->size != task.expected)
+                context.error("leaf %lld: holds %lld entries, parent counts %lld", task.pos, leaf->size, task.expected);
+            if (leaf->size) {
+                summary.first = leaf->data[0];
+                summary.last = leaf->data[leaf->size - 1];
+            }
+            return;
+        }
+
+        // a root keeps a single child while its buffer still holds messages; a size that fits the arrays is walked
+        // even when wrong, so the pages below are still checked instead of all reported unreachable
+
+        InternalNode *internal = dynamic_cast<InternalNode *>(reinterpret_cast<Node *>(page));
+        kind = 2;
+        if (internal->size < (root && !internal->buffered ? 2 : 1) || internal->size >= internal_size) {
+            context.error("internal %lld: size %lld out of range", task.pos, internal->size);
+            if (internal->size < 1 || internal->size > internal_size)
+                return;
+        }
+        ++context.internal_pages;
+
+        bool ordered = true, bounded = true;
+        for (int i = 0; i < internal->size - 1; ++i) {
+            if (i && internal->index[i] < internal->index[i - 1])
+                ordered = false;
+            if (!in_bounds(task, internal->index[i]))
+                bounded = false;
+        }
+        for (int i = 0; i < internal->buffered; ++i)
+            if (!in_bounds(task, internal->buffer[i].data.index))
+                bounded = false;
+        if (!ordered)
+            context.error("internal %lld: separators out of order", task.pos);
+        if (!bounded)
+            context.error("internal %lld: separators or messages outside the parent's separators", task.pos);
+        if (counted && task.expected != -1 && internal->total(0, internal->size) != task.expected)
+            context.error("internal %lld: children count %lld entries, parent counts %lld",
+                          task.pos, internal->total(0, internal->size), task.expected);
+
+        for (int i = 0; i < internal->size; ++i) {
+            VerifyTask child;
+            child.pos = internal->child[i];
+            child.has_lower = i ? true : task.has_lower;
+            child.lower = i ? internal->index[i - 1] : task.lower;
+            child.has_upper = i < internal->size - 1 ? true : task.has_upper;
+            child.upper = i < internal->size - 1 ? internal->index[i] : task.upper;
+            child.expected = counted ? internal->count[i] : -1;
+            children.push_back(child);
+        }
+    }
+
+    /*
+     * bulk build: sorted entries fill leaves to the fill factor from left to right, and a node goes to its parent
+     * level once complete, so only the right-most node of every level is open and pinned; at the end an internal
+     * node left with a single child hands it to its left sibling, which the targets leave room for
+     */
+
+    static constexpr int build_levels = 16;
+
+    class BulkBuilder {
+
+        BasicBPlusTree &tree;
+        FilePos open[build_levels], prev[build_levels];
+        Index first[build_levels];
+        long long total[build_levels];
+        int nodes[build_levels], height, leaf_target, internal_target;
+        typename StorageInterface::Guard guard[build_levels];
+
+        void start(int level, FilePos pos) {
+            open[level] = pos;
+            guard[level].reset(tree.storage, pos);
+            total[level] = 0;
+            ++nodes[level];
+            if (level >= height)
+                height = level + 1;
+        }
+
+        void close(int level) {
+            add_child(level + 1, first[level], open[level], total[level]);
+            prev[level] = open[level];
+            open[level] = -1;
+        }
+
+        void add_child(int level, const Index &child_first, FilePos child, long long child_total) {
+            InternalNode *node = open[level] == -1 ? nullptr : dynamic_cast<InternalNode *>(guard[level].get());
+            if (node && node->size == internal_target) {
+                close(level);
+                node = nullptr;
+            }
+            if (!node) {
+                start(level, tree.storage.new_internal());
+                node = dynamic_cast<InternalNode *>(guard[level].get());
+                first[level] = child_first;
+            }
+            if (node->size)
+                node->index[node->size - 1] = child_first;
+            node->child[node->size] = child;
+            if (counted)
+                node->count[node->size] = child_total;
+            ++node->size;
+            total[level] += child_total;
+        }
+
+    public:
+
+        FilePos last_leaf;
+
+        explicit BulkBuilder(BasicBPlusTree &tree) : tree(tree), height(0), last_leaf(-1) {
+            for (int i = 0; i < build_levels; ++i) {
+                open[i] = prev[i] = -1;
+                nodes[i] = 0;
+                total[i] = 0;
+            }
+            leaf_target = leaf_size * tree.fill_factor / 100;
+            leaf_target = leaf_target < 1 ? 1 : leaf_target > leaf_size - 1 ? leaf_size - 1 : leaf_target;
+            internal_target = tree.fan_out * tree.fill_factor / 100;
+            internal_target = internal_target < 2 ? 2 : internal_target > tree.fan_out - 2 ? tree.fan_out - 2 : internal_target;
+        }
+
+        void add(const Data &entry) {
+            LeafNode *leaf = open[0] == -1 ? nullptr : dynamic_cast<LeafNode *>(guard[0].get());
+            if (!leaf || leaf->size == leaf_target) {
+                FilePos pos = tree.storage.new_leaf();
+                if (leaf) {
+                    leaf->next = pos;
+                    close(0);
+                }
+                start(0, pos);
+                leaf = dynamic_cast<LeafNode *>(guard[0].get());
+                first[0] = entry.index;
+                last_leaf = pos;
+            }
+            leaf->data[leaf->size++] = entry;
+            ++total[0];
+        }
+
+        FilePos finish() {
+
+            // closes the open nodes bottom up, the only node of the top level is the root
+
+            if (open[0] == -1) {
+                last_leaf = tree.storage.new_leaf();
+                return last_leaf;
+            }
+
+            for (int level = 0;; ++level) {
+                InternalNode *node = level ? dynamic_cast<InternalNode *>(guard[level].get()) : nullptr;
+                if (open[level] != -1 && nodes[level] == 1 && level + 1 >= height) {
+                    if (!node || node->size > 1)
+                        return open[level];
+                    FilePos root = node->child[0];
+                    tree.storage.free(open[level]);
+                    return root;
+                }
+                if (open[level] == -1) // handed to its sibling one level down
+                    continue;
+
+                if (node && node->size == 1 && prev[level] != -1) {
+
+                    // the left sibling is the last child of the open parent
+
+                    typename StorageInterface::Guard sibling_guard(tree.storage, prev[level]);
+                    InternalNode *sibling = dynamic_cast<InternalNode *>(sibling_guard.get());
+                    sibling->index[sibling->size - 1] = first[level];
+                    sibling->child[sibling->size] = node->child[0];
+                    if (counted)
+                        sibling->count[sibling->size] = node->count[0];
+                    ++sibling->size;
+
+                    InternalNode *parent = dynamic_cast<InternalNode *>(guard[level + 1].get());
+                    if (counted)
+                        parent->count[parent->size - 1] += total[level];
+                    total[level + 1] += total[level];
+                    tree.storage.free(open[level]);
+                    open[level] = -1;
+                    continue;
+                }
+                close(level);
+            }
+        }
+    };
+
+    static constexpr char dump_magic[8] = "BPTDUMP";
+    static constexpr int dump_block = 4096;
+
+    static unsigned long long dump_checksum(unsigned long long hash, const char *bytes, long long size) {
+
+        // FNV-1a over 8 byte words, then over the bytes left
+
+        long long i = 0;
+        for (; i + 8 <= size; i += 8) {
+            unsigned long long word;
+            memcpy(&word, bytes + i, sizeof(word));
+            hash = (hash ^ word) * 1099511628211ull;
+        }
+        for (; i < size; ++i)
+            hash = (hash ^ (unsigned char) bytes[i]) * 1099511628211ull;
+        return hash;
+    }
+
+    static bool write_all(int fd, const void *buffer, long long size) {
+        const char *cur = static_cast<const char *>(buffer);
+        while (size > 0) {
+            ssize_t written = ::write(fd, cur, size);
+            if (written <= 0)
+                return false;
+            cur += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    static bool read_all(int fd, void *buffer, long long size) {
+        char *cur = static_cast<char *>(buffer);
+        while (size > 0) {
+            ssize_t got = ::read(fd, cur, size);
+            if (got <= 0)
+                return false;
+            cur += got;
+            size -= got;
+        }
+        return true;
+    }
+
+    BasicBPlusTree(bool reset, bool replica, bool memory = false, Catalog *owner = nullptr, int slot = -1) :
+            own_storage(owner ? nullptr : new StorageInterface(replica, memory)),
+            storage(owner ? owner->storage : *own_storage), catalog(owner), catalog_slot(slot), root_pos(-1), read_only(replica), snapshot_generation(0),
+            insert_unique(false), replacing(false), moved_in_place(false), write_status(write_done),
+            lazy_merge_size(0), compact_interval(0), compact_budget(0), removes_since_compact(0),
+            sparse_head(0), compacted_leaves(0), sweeping(false), sweep_started(false), sweep_index(),
+            fill_factor(90), append_leaf(-1), append_version(0), append_fast_path(0), profiler(nullptr),
+            allocation_check(false), write_optimized(false), fan_out(internal_size), fan_out_merge(internal_merge_size),
+            messages_pending(false), message_seq(0),
+            mem_table_limit(0), table_seq(0), active_table(nullptr), frozen_table(nullptr), spare_table(nullptr),
+            drain_stop(false), drain_waiters(0) {
+
+        if (owner) {
+            const typename CatalogNode::Entry &entry = owner->page()->entry[slot];
+            root_pos = entry.root;
+            write_optimized = entry.write_optimized;
+            message_seq = entry.message_seq;
+        }
+        else if (replica) {
+            root_pos = storage.new_leaf(); // never written, serves as the empty tree until a snapshot is published
+            follow_snapshot(true);
+        }
+        else if (memory && (reset || !storage.load(data_path, info_path)))
+            root_pos = storage.new_leaf(); // the files stay untouched, a memory-only tree only reads them
+        else if (reset) {
+            storage.reset();
+            std::remove(root_path);
+            root_pos = storage.new_leaf();
+        }
+        else {
+            std::fstream root_file;
+
+            root_file.open(
+                    root_path,
+                    std::fstream::in | std::fstream::binary
+            );
+
+            if (root_file.is_open()) {
+                root_file.seekg(0);
+                root_file.read(reinterpret_cast<char *>(&root_pos), sizeof(int));
+                if (root_file.read(reinterpret_cast<char *>(&write_optimized), sizeof(bool)))
+                    root_file.read(reinterpret_cast<char *>(&message_seq), sizeof(long long));
+                else
+                    write_optimized = false;
+            }
+            else
+                root_pos = storage.new_leaf();
+
+            root_file.close();
+        }
+
+        if (!replica && !owner) { // a writer numbers its snapshots on from the last one published here
+            long long generation, seq;
+            FilePos root;
+            bool optimized;
+            if (read_superblock(generation, root, optimized, seq))
+                snapshot_generation = generation;
+        }
+
+        messages_pending = write_optimized && !replica; // published snapshots carry no buffered messages
+        set_fan_out();
+        recursive_par.resize(64);
+        recursive_cursor.resize(64);
+        scan_path.reserve(64); // a find only allocates for a key with more values than any before
+        scan_cursor.reserve(64);
+        found_values.reserve(leaf_size);
+        flush_count.resize(internal_size);
+        flush_route.resize(buffer_size);
+    }
+
+    bool write_root() {
+        std::fstream root_file;
+
+        root_file.open(
+                root_path,
+                std::fstream::out | std::fstream::binary
+        );
+
+        root_file.write(reinterpret_cast<char *>(&root_pos), sizeof(int));
+        root_file.write(reinterpret_cast<char *>(&write_optimized), sizeof(bool));
+        root_file.write(reinterpret_cast<char *>(&message_seq), sizeof(long long));
+        bool good = root_file.good();
+        root_file.close();
+        return good;
+    }
+
+public:
+
+    struct ReplicaMode {};
+
+    static constexpr ReplicaMode replica{};
+
+    struct MemoryMode {};
+
+    static constexpr MemoryMode memory_only{};
+
+    explicit BasicBPlusTree(bool reset = false) : BasicBPlusTree(reset, false) {}
+
+    // a replica serves queries from the newest published snapshot and follows later ones, writes are ignored
+
+    explicit BasicBPlusTree(ReplicaMode) : BasicBPlusTree(false, true) {}
+
+    /*
+     * a memory-only tree keeps every node in memory and reaches it by page number without a buffer pool, nothing
+     * goes to disk unless persist() is called; with load it starts from the tree stored in the working directory
+     */
+
+    explicit BasicBPlusTree(MemoryMode, bool load = false) : BasicBPlusTree(!load, false, true) {}
+
+    ~BasicBPlusTree() {
+
+        // the memtable has no log of its own: like the rest of the tree it becomes durable at shutdown
+
+        disable_mem_table();
+        if (lazy_merge_size && !read_only)
+            compact(INT_MAX);
+        if (catalog)
+            catalog->close(catalog_slot, root_pos, write_optimized, message_seq);
+        else if (!read_only && !storage.in_memory())
+            write_root();
+        delete own_storage;
+    }
+
+    bool persist() {
+
+        /*
+         * makes the tree as it is now durable in data_path, info_path and root_path: a memory-only tree writes its
+         * pages in the format a tree on disk opens, one on disk writes back its dirty pages; a tree of a catalog
+         * records its root in the catalog page instead of root_path
+         */
+
+        if (read_only)
+            return false;
+        settle();
+        if (lazy_merge_size)
+            compact(INT_MAX); // a short leaf would stay short in the files
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+
+        if (catalog) {
+            catalog->store(catalog_slot, root_pos, write_optimized, message_seq);
+            storage.checkpoint();
+            return true;
+        }
+        if (storage.in_memory()) {
+            if (!storage.snapshot(data_path, info_path))
+                return false;
+        }
+        else
+            storage.checkpoint();
+        return write_root();
+    }
+
+    class Catalog {
+
+        /*
+         * named trees of one Key, Value and Codec in a single data file: they share one buffer pool, so memory goes
+         * to the pages of whichever tree is hot, and one free list; page 0 holds the catalog, each name with the root
+         * and mode of its tree, updated when the tree closes or persists; root_path is not used
+         * the trees of a catalog are used from one thread at a time, take no mem-table and are deleted before it;
+         * pool settings made through one of them apply to all
+         */
+
+        friend class BasicBPlusTree;
+
+        static constexpr FilePos catalog_pos = 0;
+
+        StorageInterface storage;
+        bool valid;
+        bool in_use[CatalogNode::capacity];
+
+        // never kept across another storage call, which may evict the page
+
+        CatalogNode *page(bool modify = false) {
+            return static_cast<CatalogNode *>(modify ? storage[catalog_pos] : const_cast<Node *>(storage.read(catalog_pos)));
+        }
+
+        void store(int slot, FilePos root, bool optimized, long long seq) {
+            typename CatalogNode::Entry &entry = page(true)->entry[slot];
+            entry.root = root;
+            entry.write_optimized = optimized;
+            entry.message_seq = seq;
+        }
+
+        void close(int slot, FilePos root, bool optimized, long long seq) {
+            store(slot, root, optimized, seq);
+            in_use[slot] = false;
+        }
+
+    public:
+
+        // opens the catalog in data_path, or starts one there when the file is empty or reset
+
+        explicit Catalog(bool reset = false, bool compress = false) : valid(false) {
+            memset(in_use, 0, sizeof(in_use));
+            if (reset)
+                storage.reset();
+            if (!storage.page_count()) {
+                storage.set_compression(compress);
+                valid = storage.new_catalog() == catalog_pos;
+            }
+            else
+                valid = dynamic_cast<const CatalogNode *>(storage.read(catalog_pos)) != nullptr;
+        }
+
+        Catalog(const Catalog &) = delete;
+
+        Catalog &operator=(const Catalog &) = delete;
+
+        // false when the data file holds a single tree instead
+
+        bool opened() const {
+            return valid;
+        }
+
+        // names by slot, a dropped tree leaves an empty one
+
+        int size() {
+            return valid ? page()->size : 0;
+        }
+
+        std::string name(int index) {
+            return page()->entry[index].name;
+        }
+
+        bool contains(const char *name) {
+            return valid && page()->find(name) != -1;
+        }
+
+        BasicBPlusTree *open(const char *name) {
+
+            // the tree of that name, created empty the first time; nullptr when it is already open, the name is
+            // empty or longer than catalog_name_size - 1, or the catalog is full
+
+            if (!valid || !name[0] || strlen(name) >= catalog_name_size)
+                return nullptr;
+            int slot = page()->find(name);
+            if (slot == -1) {
+                slot = page()->find("");
+                if (slot == -1 && page()->size == CatalogNode::capacity)
+                    return nullptr;
+                FilePos root = storage.new_leaf();
+                CatalogNode *catalog = page(true);
+                if (slot == -1)
+                    slot = catalog->size++;
+                memset(&catalog->entry[slot], 0, sizeof(typename CatalogNode::Entry));
+                strcpy(catalog->entry[slot].name, name);
+                catalog->entry[slot].root = root;
+            }
+            if (in_use[slot])
+                return nullptr;
+            in_use[slot] = true;
+            return new BasicBPlusTree(false, false, false, this, slot);
+        }
+
+        bool drop(const char *name) {
+
+            // frees every page of a tree that is not open and removes its name
+
+            int slot = valid ? page()->find(name) : -1;
+            if (slot == -1 || in_use[slot])
+                return false;
+
+            Vector<FilePos> stack;
+            stack.push_back(page()->entry[slot].root);
+            while (stack.size()) {
+                FilePos cur = stack.back();
+                stack.pop_back();
+                if (const InternalNode *internal = dynamic_cast<const InternalNode *>(storage.read(cur)))
+                    for (int i = 0; i < internal->size; ++i)
+                        stack.push_back(internal->child[i]);
+                storage.free(cur);
+            }
+
+            CatalogNode *catalog = page(true);
+            catalog->entry[slot].name[0] = 0; // the slot stays, an open tree's does not move
+            while (catalog->size && !catalog->entry[catalog->size - 1].name[0])
+                --catalog->size;
+            return true;
+        }
+
+        bool set_pool_size(long long bytes) {
+            return storage.resize_pool(bytes);
+        }
+
+        void set_pool_budget(long long bytes, double miss_rate = 0.01) {
+            storage.set_pool_budget(bytes, miss_rate);
+        }
+    };
+
+    void set_write_optimized(bool enable) {
+
+        // the mode is persisted, leaving it pushes every pending message down to the leaves
+
+        if (read_only)
+            return;
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+        if (write_optimized && !enable)
+            drain_messages();
+        write_optimized = enable;
+        set_fan_out();
+    }
+
+    bool set_compression(bool enable) {
+
+        // pages are stored LZ compressed in variable sized slots, the choice is kept with the data file,
+        // so it only takes on a tree that has not written a page yet and returns false otherwise
+
+        return storage.set_compression(enable);
+    }
+
+    bool set_pool_size(long long bytes) {
+
+        /*
+         * resizes the buffer pool of the open tree to bytes, at least 64 pages; shrinking keeps the hottest pages,
+         * writes back the dirty ones it drops and returns their memory to the kernel
+         * false when the memory to grow could not be mapped
+         * a memory-only tree takes frames for bytes of pages up front instead, it never gives frames back
+         */
+
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+        return storage.resize_pool(bytes);
+    }
+
+    void set_pool_budget(long long bytes, double miss_rate = 0.01) {
+
+        // sizes the pool by itself within bytes: it grows while more than miss_rate of the page accesses miss
+        // and shrinks while far fewer do; 0 bytes turns this off
+
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+        storage.set_pool_budget(bytes, miss_rate);
+    }
+
+    void set_profiler(PhaseProfiler *attached) {
+
+        // charges the work of the tree's operations to the phase_ constants, nullptr detaches; the counters follow
+        // the calling thread, so this is meant for a tree without a mem-table, whose drain thread would charge here too
+
+        profiler = attached;
+        storage.set_profiler(attached);
+    }
+
+    void set_allocation_check(bool armed) {
+
+        // once the tree is warm: insert, remove and print_value abort if they allocate on the calling thread, which
+        // is only counted in a program built with BPT_ALLOC_CHECK; print_value counts its output stream too
+
+        allocation_check = armed;
+    }
+
+    bool set_epochs(EpochManager *epochs) {
+
+        /*
+         * defers the reuse of freed page numbers and of frames freed, evicted or moved until the readers that
+         * entered one of the manager's epochs on other threads before have left: a frame such a reader found stays
+         * the page it found for as long as it reads; nullptr returns to reusing at once; false for a memory-only
+         * tree, which frees no frames
+         */
+
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+        return storage.set_epochs(epochs);
+    }
+
+    bool set_frame_arena(int huge, int numa = FrameArena::numa_default) {
+
+        /*
+         * moves the buffer pool into frames backed by huge pages, FrameArena::transparent_huge_pages or
+         * explicit_huge_pages, and placed on a NUMA node or interleaved over all of them; a mode the kernel refuses
+         * falls back to the next smaller one, stats() tells what was granted
+         */
+
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+        return storage.set_frame_arena(huge, numa);
+    }
+
+    bool publish() {
+
+        /*
+         * makes the tree as it is now visible to replicas: pending writes reach the leaves, the data file is copied
+         * under the next generation, then the new superblock is renamed over the old one, so a replica sees
+         * either snapshot whole; the generation two back is removed, a replica still on it keeps its mapping
+         * false for a tree of a catalog, whose file replicas cannot open
+         */
+
+        if (read_only || catalog)
+            return false;
+        settle();
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+
+        long long generation = snapshot_generation + 1;
+        if (!storage.snapshot(snapshot_file(generation, "data"), snapshot_file(generation, "info")))
+            return false;
+
+        char superblock[2 * sizeof(long long) + sizeof(int) + sizeof(bool)], *out = superblock;
+        Node::write(out, &generation, sizeof(long long));
+        Node::write(out, &root_pos, sizeof(int));
+        Node::write(out, &write_optimized, sizeof(bool));
+        Node::write(out, &message_seq, sizeof(long long));
+
+        std::string temp_path = std::string(snapshot_path) + ".tmp";
+        int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+        bool written = ::write(fd, superblock, out - superblock) == out - superblock && fsync(fd) == 0;
+        close(fd);
+        if (!written || rename(temp_path.c_str(), snapshot_path) != 0)
+            return false;
+
+        snapshot_generation = generation;
+        std::remove(snapshot_file(generation - 2, "data").c_str());
+        std::remove(snapshot_file(generation - 2, "info").c_str());
+        return true;
+    }
+
+    /*
+     * online backups: backup_begin() writes back the dirty pages and notes the pages to copy, backup_step() streams
+     * some of them between operations, so writers keep going while a backup runs; a full backup holds every page,
+     * an incremental one the pages changed since the backup before it, and falls back to a full one when there is
+     * no such backup or the tree was not closed cleanly since; restore() rebuilds the tree files from a chain
+     * false for a replica, a memory-only tree and a tree of a catalog
+     */
+
+    bool backup_begin(const std::string &path, bool incremental = false) {
+        if (read_only || catalog || storage.in_memory())
+            return false;
+        settle();
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+
+        char meta[sizeof(int) + sizeof(bool) + sizeof(long long)], *out = meta; // laid out as in root_path
+        Node::write(out, &root_pos, sizeof(int));
+        Node::write(out, &write_optimized, sizeof(bool));
+        Node::write(out, &message_seq, sizeof(long long));
+        return storage.backup_begin(path, incremental, meta, out - meta);
+    }
+
+    long long backup_step(int pages = backup_step_pages) {
+
+        // the pages still to go, 0 once the backup is complete, -1 when none runs or it failed
+
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+        return storage.backup_step(pages);
+    }
+
+    bool backing_up() {
+        return storage.backing_up();
+    }
+
+    bool backup_full() {
+        return storage.backup_full();
+    }
+
+    bool backup(const std::string &path, bool incremental = false) {
+        if (!backup_begin(path, incremental))
+            return false;
+        long long left;
+        while ((left = backup_step(1 << 30)) > 0);
+        return left == 0;
+    }
+
+    static int restore(const char *const *chain, int count) {
+
+        // writes the tree files of the working directory; count, or the index of the first file that breaks the chain
+
+        Vector<char> meta;
+        int applied = StorageInterface::restore(chain, count, meta);
+        if (applied != count || !count)
+            return applied;
+        std::remove(changes_path); // a map left by another tree would make its next backup wrong
+        std::fstream root_file(root_path, std::fstream::out | std::fstream::trunc | std::fstream::binary);
+        if (meta.size())
+            root_file.write(&meta[0], meta.size());
+        return root_file.good() ? count : 0;
+    }
+
+    void enable_mem_table(int limit) {
+
+        // limit: entries per table before it is frozen and merged into the tree; a tree of a catalog takes none,
+        // its drain thread would share the pool with the other trees' callers
+
+        if (catalog)
+            return;
+        if (mem_table_limit) {
+            std::lock_guard<std::mutex> table_guard(table_lock);
+            mem_table_limit = limit;
+            return;
+        }
+        mem_table_limit = limit;
+        for (int i = 0; i < 2; ++i) // a table keeps filling while the one before drains, room for twice the limit
+            table_arena[i].reserve((long long) limit * 2 * (sizeof(typename MemTable::Node) + 2 * sizeof(void *)));
+        active_table = new MemTable(&table_arena[0]);
+        spare_table = new MemTable(&table_arena[1]);
+        drain_stop = false;
+        drain_thread = std::thread(&BasicBPlusTree::drain_loop, this);
+    }
+
+    void disable_mem_table() {
+        if (!mem_table_limit)
+            return;
+        {
+            std::lock_guard<std::mutex> table_guard(table_lock);
+            drain_stop = true;
+        }
+        drain_signal.notify_one();
+        drain_thread.join();
+        delete active_table;
+        delete spare_table;
+        active_table = spare_table = nullptr;
+        for (int i = 0; i < 2; ++i)
+            table_arena[i].release();
+        mem_table_limit = 0;
+    }
+
+    void enable_hint_cache(long long budget) {
+        hint_cache.resize(budget);
+    }
+
+    void set_lazy_delete(int merge_size, int interval = 64, int budget = 4) {
+
+        /*
+         * merge_size: leaves shorter than this are queued for compaction (at most leaf_merge_size), 0 turns lazy mode off
+         * every interval removals, compact() handles up to budget queued leaves; interval 0 leaves it to the caller
+         */
+
+        if (merge_size > leaf_merge_size)
+            merge_size = leaf_merge_size;
+        if (lazy_merge_size && !merge_size)
+            compact(INT_MAX);
+        if (!merge_size)
+            sweeping = false;
+        else if (!lazy_merge_size) { // turning lazy deletes on starts a sweep for short leaves left from before
+            sweeping = !read_only;
+            sweep_started = false;
+        }
+        lazy_merge_size = merge_size;
+        compact_interval = interval;
+        compact_budget = budget;
+        if (merge_size)
+            sparse_leaves.reserve(sparse_reserve);
+    }
+
+    int compact(int budget) {
+
+        // merges up to budget queued leaves, returns how many were still reachable and got rebalanced
+
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit && std::this_thread::get_id() != drain_thread.get_id())
+            tree_guard.lock();
+
+        int done = 0;
+        while (budget-- > 0 && sparse_head < sparse_leaves.size()) {
+            SparseLeaf target = sparse_leaves[sparse_head++];
+            sparse_marked[target.file_pos] = 0;
+            if (storage.version(target.file_pos) == target.version && compact_recursive(root_pos, target))
+                ++done;
+        }
+        replay_deferred(); // a merge may have flushed a buffer
+        if (sparse_head * 2 >= sparse_leaves.size()) { // the queue is reused from the front, so it stops growing
+            int left = sparse_leaves.size() - sparse_head;
+            for (int i = 0; i < left; ++i)
+                sparse_leaves[i] = sparse_leaves[sparse_head + i];
+            sparse_leaves.resize(left);
+            sparse_head = 0;
+        }
+        compacted_leaves += done;
+        return done;
+    }
+
+    void set_fill_factor(int percent) {
+
+        // share of a page kept on the left when a split is caused by an append, 50 disables uneven splits
+
+        fill_factor = percent;
+    }
+
+    void set_read_ahead(int max_depth) {
+
+        // upper bound on how many leaves a scan prefetches ahead of itself, 0 disables read-ahead
+
+        storage.set_read_ahead(max_depth);
+    }
+
+    void set_dirty_ratio(double ratio) {
+
+        // share of the cache allowed to be dirty before the writer thread starts flushing cold pages
+
+        storage.set_dirty_ratio(ratio);
+    }
+
+    Stats stats(bool scan = false) {
+        follow_snapshot();
+        Stats result;
+        result.hint_hits = hint_cache.hits;
+        result.hint_stale = hint_cache.stale;
+        result.hint_misses = hint_cache.misses;
+        result.hint_memory = hint_cache.memory();
+        result.append_fast_path = append_fast_path;
+        result.sparse_queued = sparse_leaves.size() - sparse_head;
+        result.compacted_leaves = compacted_leaves;
+        storage.flush_stats(result);
+        result.leaf_pages = result.internal_pages = 0;
+        result.leaf_fill = result.internal_fill = 0;
+
+        if (scan) {
+            std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+            if (mem_table_limit)
+                tree_guard.lock();
+
+            long long leaf_used = 0, internal_used = 0;
+            scan_pages(root_pos, result, leaf_used, internal_used);
+            if (result.leaf_pages)
+                result.leaf_fill = (double) leaf_used / (result.leaf_pages * leaf_size);
+            if (result.internal_pages)
+                result.internal_fill = (double) internal_used / (result.internal_pages * fan_out);
+        }
+        return result;
+    }
+
+    void insert(Key key, Value value) {
+        if (read_only)
+            return;
+        AllocationCheck check(allocation_check, "insert");
+        if (mem_table_limit) {
+            write_mem_table(key, value, 0);
+            return;
+        }
+        storage.review_pool();
+        PhaseScope scope(profiler, phase_descent);
+        Codec::store(data_in_operation, key);
+        data_in_operation.index = Codec::index(key, value);
+        if (write_optimized)
+            buffer_message(0);
+        else if (!append_to_last_leaf())
+            insert_recursive(root_pos);
+    }
+
+    void remove(Key key, Value value) {
+        if (read_only)
+            return;
+        AllocationCheck check(allocation_check, "remove");
+        if (mem_table_limit) {
+            write_mem_table(key, value, 1);
+            return;
+        }
+        storage.review_pool();
+        PhaseScope scope(profiler, phase_descent);
+        Codec::store(data_in_operation, key);
+        data_in_operation.index = Codec::index(key, value);
+        if (write_optimized)
+            buffer_message(1);
+        else
+            remove_recursive(root_pos);
+        after_remove();
+    }
+
+    /*
+     * conditional writes, one descent each on a tree that applies writes in place: insert_if_absent checks the
+     * entry's run where it would insert, replace moves the entry inside its leaf when the new value still falls
+     * there, remove_all compacts the key's leaves and merges what they leave short
+     * with a memtable or write-optimized buffers the check is a find, and the writes are queued as usual
+     */
+
+    int insert_if_absent(Key key, Value value) {
+
+        // write_done, write_present when the entry is already there, write_ignored on a replica
+
+        if (read_only)
+            return write_ignored;
+        if (mem_table_limit || write_optimized) {
+            if (holds(key, value))
+                return write_present;
+            insert(key, value);
+            return write_done;
+        }
+        storage.review_pool();
+        PhaseScope scope(profiler, phase_descent);
+        Codec::store(data_in_operation, key);
+        data_in_operation.index = Codec::index(key, value);
+        if (append_to_last_leaf(true))
+            return write_done;
+        insert_unique = true;
+        write_status = write_done;
+        insert_recursive(root_pos);
+        insert_unique = false;
+        return write_status;
+    }
+
+    int replace(Key key, Value old_value, Value new_value) {
+
+        // one entry of (key, old_value) becomes (key, new_value); write_done, write_missing without such an entry,
+        // write_ignored on a replica
+
+        if (read_only)
+            return write_ignored;
+        if (mem_table_limit || write_optimized) {
+            if (!holds(key, old_value))
+                return write_missing;
+            remove(key, old_value);
+            insert(key, new_value);
+            return write_done;
+        }
+        storage.review_pool();
+        PhaseScope scope(profiler, phase_descent);
+        Codec::store(data_in_operation, key);
+        data_in_operation.index = Codec::index(key, old_value);
+        replacement = Codec::index(key, new_value);
+        replacing = true;
+        moved_in_place = false;
+        bool found = remove_recursive(root_pos);
+        replacing = false;
+        if (!found)
+            return write_missing;
+        if (!moved_in_place) { // the value moves to another leaf
+            data_in_operation.index = replacement;
+            if (!append_to_last_leaf())
+                insert_recursive(root_pos);
+            after_remove();
+        }
+        return write_done;
+    }
+
+    long long remove_all(Key key) {
+
+        // the entries removed, 0 when the key had none or on a replica
+
+        if (read_only)
+            return 0;
+        if (mem_table_limit || write_optimized) {
+            {
+                std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+                if (mem_table_limit)
+                    tree_guard.lock();
+                collect_values(key);
+            }
+            long long removed = found_values.size(); // found_values is only touched by this thread
+            for (int i = 0; i < removed; ++i)
+                remove(key, found_values[i]);
+            return removed;
+        }
+        storage.review_pool();
+        PhaseScope scope(profiler, phase_descent);
+        Index low = Codec::first(key);
+        long long removed = remove_run_recursive(root_pos, key, low, Codec::last(low));
+        while (true) {
+            InternalNode *root = dynamic_cast<InternalNode *>(storage[root_pos]);
+            if (!root || root->size > 1 || root->buffered)
+                break;
+            FilePos old_root = root_pos;
+            root_pos = root->child[0];
+            storage.free(old_root);
+        }
+        if (removed)
+            after_remove();
+        return removed;
+    }
+
+    void write_mem_table(Key key, Value value, int type) {
+        Message message;
+        Codec::store(message.data, key);
+        message.data.index = Codec::index(key, value);
+        message.type = type;
+
+        std::lock_guard<std::mutex> table_guard(table_lock);
+        message.seq = ++table_seq;
+        active_table->insert(message);
+        if (active_table->size() >= mem_table_limit && !frozen_table)
+            drain_signal.notify_one();
+    }
+
+    void find_batch(const Key *keys, int count) {
+
+        // same output as print_value on each key in order, with the lookups interleaved so their page reads overlap
+
+        follow_snapshot();
+        if (mem_table_limit || write_optimized) {
+            for (int i = 0; i < count; ++i)
+                print_value(keys[i]);
+            return;
+        }
+        storage.review_pool();
+        PhaseScope scope(profiler, phase_descent); // the lookups interleave, their leaf searches are not told apart
+
+        int started = 0, finished = 0;
+        while (finished < count) {
+            bool progress = false;
+            for (int i = finished; i < started; ++i) {
+                Lookup &lookup = lookups[i % batch_width];
+                if (!lookup.done && step_lookup(lookup, false))
+                    progress = true;
+            }
+
+            while (finished < started && lookups[finished % batch_width].done) {
+                Vector<Value> &values = lookups[finished % batch_width].values;
+                if (!values.size())
+                    std::cout << "null\n";
+                else {
+                    for (int i = 0; i < values.size(); ++i)
+                        std::cout << values[i] << ' ';
+                    std::cout << '\n';
+                }
+                ++finished;
+                progress = true;
+            }
+
+            while (started < count && started - finished < batch_width) {
+                start_lookup(lookups[started % batch_width], keys[started]);
+                ++started;
+                progress = true;
+            }
+
+            if (!progress) // every lookup is waiting for a read, block on the oldest
+                step_lookup(lookups[finished % batch_width], true);
+        }
+    }
+
+    void print_value(Key key) {
+
+        AllocationCheck check(allocation_check, "find");
+        follow_snapshot();
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+        storage.review_pool();
+        PhaseScope scope(profiler, phase_descent);
+        collect_values(key);
+
+        PhaseScope output_scope(profiler, phase_other);
+        if (!found_values.size()) {
+            std::cout << "null\n";
+            return;
+        }
+        for (int i = 0; i < found_values.size(); ++i)
+            std::cout << found_values[i] << ' ';
+        std::cout << '\n';
+    }
+
+    /*
+     * counted trees only: positions follow the index order, which is hash order for string keys
+     * the drain thread merges the memtables into the tree first, and buffered messages over the range read are
+     * added to the counts where they sit, see pending_messages()
+     */
+
+    long long count(Key key) {
+        static_assert(counted, "count needs a counted tree");
+        follow_snapshot();
+        wait_for_drain();
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+
+        Index index = Codec::first(key), last = Codec::last(index);
+        long long pending = pending_messages(index, last, Codec::exact_index ? nullptr : &key);
+        if (!Codec::exact_index)
+            return count_matches(key) + pending;
+        return count_before(last, true) - count_before(index, false) + pending;
+    }
+
+    long long count_range(Key low, Key high) {
+
+        // entries whose key lies in [low, high]
+
+        static_assert(counted, "count_range needs a counted tree");
+        follow_snapshot();
+        wait_for_drain();
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+
+        Index first = Codec::first(low), last = Codec::last(Codec::first(high));
+        if (last < first)
+            return 0;
+        return count_before(last, true) - count_before(first, false) + pending_messages(first, last, nullptr);
+    }
+
+    long long rank(Key key) {
+
+        // entries ordered before the key's first one
+
+        static_assert(counted, "rank needs a counted tree");
+        follow_snapshot();
+        wait_for_drain();
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+
+        Index bound = Codec::first(key);
+        long long result = count_before(bound, false) + pending_messages(Codec::min_index(), bound, nullptr);
+        for (int i = found_messages.size() - 1; i >= 0 && !(found_messages[i].data.index < bound); --i)
+            result -= message_effect[i]; // messages on the bound itself are not before the key
+        return result;
+    }
+
+    bool select(long long position, Key &key, Value &value) {
+
+        // the entry with position entries before it, false past the end; a string key stays valid until the next select
+
+        static_assert(counted, "select needs a counted tree");
+        follow_snapshot();
+        wait_for_drain();
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+
+        if (position < 0)
+            return false;
+        pending_messages(Codec::min_index(), Codec::max_index(), nullptr);
+        if (!(found_messages.size() ? select_pending(position) : select_leaf(position)))
+            return false;
+        key = Codec::key(selected.index, selected);
+        value = Codec::value(selected.index);
+        return true;
+    }
+    Report verify(int threads = 0) {
+
+        /*
+         * checks the file after writing back the cache: entry and separator order, sizes, every page below its parent's
+         * separators, subtree counts of a counted tree, the next chain of the leaves, and every page reached once
+         * unless it is on the free list, which none reached may be; threads = 0 uses one per core
+         * for a tree of a catalog, pages it does not reach belong to the other trees and are not reported
+         */
+
+        follow_snapshot();
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+        storage.checkpoint();
+        if (threads <= 0)
+            threads = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 1;
+
+        VerifyContext context;
+        context.report = Report{0, 0, 0, 0, 0, 0, 0, std::string()};
+        context.leaf_pages = context.internal_pages = context.entries = 0;
+
+        // 0: not seen, 1: reached, 2: free
+
+        FilePos page_count = storage.page_count();
+        char *seen = new char[page_count > 0 ? page_count : 1]();
+        Vector<FilePos> free_pages;
+        storage.free_list(free_pages);
+        for (int i = 0; i < free_pages.size(); ++i) {
+            FilePos pos = free_pages[i];
+            if (pos < 0 || pos >= page_count)
+                context.error("free list holds page %lld past the end of the file", pos);
+            else if (seen[pos])
+                context.error("free list holds page %lld twice", pos);
+            else
+                seen[pos] = 2;
+        }
+        context.report.free_pages = free_pages.size();
+        if (catalog && page_count > Catalog::catalog_pos)
+            seen[Catalog::catalog_pos] = 1;
+
+        Vector<VerifyTask> levels[2];
+        Vector<VerifyTask> *found = new Vector<VerifyTask>[threads];
+        VerifyTask root_task;
+        root_task.pos = root_pos;
+        root_task.has_lower = root_task.has_upper = false;
+        root_task.expected = -1;
+        if (root_pos < 0 || root_pos >= page_count || seen[root_pos])
+            context.error("root %lld is past the end of the file or free", root_pos);
+        else {
+            seen[root_pos] = 1;
+            levels[0].push_back(root_task);
+        }
+
+        bool leaves_seen = false;
+        for (int cur = 0; levels[cur].size(); cur ^= 1) {
+            Vector<VerifyTask> &level = levels[cur], &next_level = levels[cur ^ 1];
+            int count = level.size(), blocks = (count + verify_block - 1) / verify_block;
+            int workers = threads < blocks ? threads : blocks;
+            bool root = context.report.depth++ == 0;
+
+            LeafSummary *summaries = new LeafSummary[count];
+            char *kinds = new char[count];
+            int *block_worker = new int[blocks], *block_begin = new int[blocks], *block_end = new int[blocks];
+            std::atomic<int> next_block(0);
+
+            auto work = [&](int worker) {
+                char *image = new char[page_size], *page = new char[page_size];
+                found[worker].resize(0);
+                for (int block = next_block++; block < blocks; block = next_block++) {
+                    block_worker[block] = worker;
+                    block_begin[block] = found[worker].size();
+                    int end = (block + 1) * verify_block < count ? (block + 1) * verify_block : count;
+                    for (int i = block * verify_block; i < end; ++i)
+                        verify_page(context, level[i], root, image, page, found[worker], summaries[i], kinds[i]);
+                    block_end[block] = found[worker].size();
+                }
+                delete[] image;
+                delete[] page;
+            };
+            std::thread *pool = new std::thread[workers];
+            for (int i = 1; i < workers; ++i)
+                pool[i] = std::thread(work, i);
+            work(0);
+            for (int i = 1; i < workers; ++i)
+                pool[i].join();
+            delete[] pool;
+
+            // children in left to right order, each page taken once
+
+            next_level.resize(0);
+            for (int block = 0; block < blocks; ++block)
+                for (int i = block_begin[block]; i < block_end[block]; ++i) {
+                    const VerifyTask &child = found[block_worker[block]][i];
+                    if (child.pos < 0 || child.pos >= page_count)
+                        context.error("child %lld is past the end of the file", child.pos);
+                    else if (seen[child.pos] == 1)
+                        context.error("page %lld is referenced twice", child.pos);
+                    else if (seen[child.pos] == 2)
+                        context.error("page %lld is referenced but on the free list", child.pos);
+                    else {
+                        seen[child.pos] = 1;
+                        next_level.push_back(child);
+                    }
+                }
+
+            // the leaves of one level, when every leaf is on it, are the whole next chain
+
+            bool has_leaf = false, has_internal = false;
+            for (int i = 0; i < count; ++i) {
+                has_leaf |= kinds[i] == 1;
+                has_internal |= kinds[i] == 2;
+            }
+            if (has_leaf && (leaves_seen || has_internal))
+                context.error("leaves found at more than one depth, the deepest at %lld", context.report.depth);
+            else if (has_leaf) {
+                const Data *last = nullptr;
+                for (int i = 0; i < count; ++i) {
+                    FilePos expected = i + 1 < count ? level[i + 1].pos : -1;
+                    if (summaries[i].next != expected)
+                        context.error("leaf %lld: next is %lld, the next leaf is %lld", level[i].pos, summaries[i].next, expected);
+                    if (!summaries[i].size)
+                        continue;
+                    if (last && summaries[i].first < *last)
+                        context.error("leaf %lld: starts before the previous leaf ends", level[i].pos);
+                    last = &summaries[i].last;
+                }
+            }
+            leaves_seen |= has_leaf;
+
+            delete[] summaries;
+            delete[] kinds;
+            delete[] block_worker;
+            delete[] block_begin;
+            delete[] block_end;
+        }
+
+        for (FilePos pos = 0; pos < page_count && !catalog; ++pos) // other trees of a catalog own the rest
+            if (!seen[pos]) {
+                ++context.report.unreachable_pages;
+                context.error("page %lld is neither reachable nor free", pos);
+            }
+
+        delete[] seen;
+        delete[] found;
+        context.report.leaf_pages = context.leaf_pages;
+        context.report.internal_pages = context.internal_pages;
+        context.report.entries = context.entries;
+        return context.report;
+    }
+
+    bool export_to(const char *path) {
+
+        /*
+         * streams every entry in index order to path, "-" for stdout: the magic, sizeof(Data) and sizeof(Index),
+         * then blocks of an entry count and the raw entries, closed by an empty block, the entry total and a checksum;
+         * raw entries load back only into a tree with the same Key, Value and Codec
+         */
+
+        follow_snapshot();
+        settle();
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+
+        int fd = strcmp(path, "-") == 0 ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+        int sizes[2] = {(int) sizeof(Data), (int) sizeof(Index)};
+        bool ok = write_all(fd, dump_magic, sizeof(dump_magic)) && write_all(fd, sizes, sizeof(sizes));
+
+        // the leaf chain from the left, with scan_path set up for read-ahead
+
+        scan_path.resize(0);
+        scan_cursor.resize(0);
+        typename StorageInterface::Guard guard;
+        FilePos cur_pos = root_pos;
+        Node *cur = guard.reset(storage, cur_pos, false);
+        while (InternalNode *internal = dynamic_cast<InternalNode *>(cur)) {
+            scan_path.push_back(cur_pos);
+            scan_cursor.push_back(0);
+            cur_pos = internal->child[0];
+            cur = guard.reset(storage, cur_pos, false);
+        }
+        LeafNode *leaf = dynamic_cast<LeafNode *>(cur);
+
+        Data *block = new Data[dump_block];
+        int filled = 0;
+        long long total = 0;
+        unsigned long long checksum = 14695981039346656037ull;
+        while (ok) {
+            for (int i = 0; i < leaf->size && ok; ++i) {
+                block[filled++] = leaf->data[i];
+                if (filled == dump_block || (i == leaf->size - 1 && leaf->next == -1)) {
+                    checksum = dump_checksum(checksum, reinterpret_cast<const char *>(block), sizeof(Data) * filled);
+                    ok = write_all(fd, &filled, sizeof(int)) && write_all(fd, block, sizeof(Data) * filled);
+                    total += filled;
+                    filled = 0;
+                }
+            }
+            if (leaf->next == -1)
+                break;
+            read_ahead(leaf->next);
+            leaf = dynamic_cast<LeafNode *>(guard.reset(storage, leaf->next, false));
+        }
+        if (ok && filled) { // the last leaves were empty
+            checksum = dump_checksum(checksum, reinterpret_cast<const char *>(block), sizeof(Data) * filled);
+            ok = write_all(fd, &filled, sizeof(int)) && write_all(fd, block, sizeof(Data) * filled);
+            total += filled;
+        }
+        filled = 0;
+        ok = ok && write_all(fd, &filled, sizeof(int)) && write_all(fd, &total, sizeof(total)) &&
+             write_all(fd, &checksum, sizeof(checksum));
+
+        delete[] block;
+        if (fd != STDOUT_FILENO && close(fd) != 0)
+            ok = false;
+        return ok;
+    }
+
+    bool import_from(const char *path) {
+
+        /*
+         * loads an export_to stream, "-" for stdin, into an empty tree through the bulk builder, pages filled to the
+         * fill factor; false for a tree that is not empty or a stream that is not a valid dump, whose entries before
+         * the fault stay in the tree
+         */
+
+        if (read_only)
+            return false;
+        settle();
+        std::unique_lock<std::mutex> tree_guard(tree_lock, std::defer_lock);
+        if (mem_table_limit)
+            tree_guard.lock();
+
+        const LeafNode *root = dynamic_cast<const LeafNode *>(storage.read(root_pos));
+        if (!root || root->size)
+            return false;
+
+        int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+        char magic[sizeof(dump_magic)];
+        int sizes[2];
+        if (!read_all(fd, magic, sizeof(magic)) || memcmp(magic, dump_magic, sizeof(magic)) != 0 ||
+            !read_all(fd, sizes, sizeof(sizes)) || sizes[0] != (int) sizeof(Data) || sizes[1] != (int) sizeof(Index)) {
+            if (fd != STDIN_FILENO)
+                close(fd);
+            return false;
+        }
+
+        storage.free(root_pos);
+        BulkBuilder builder(*this);
+        Data *block = new Data[dump_block];
+        Data previous{}; // read only once an entry was added, zeroed so -Wmaybe-uninitialized can tell
+        long long total = 0;
+        unsigned long long checksum = 14695981039346656037ull;
+        bool ok = true;
+        while (ok) {
+            int filled;
+            if (!read_all(fd, &filled, sizeof(int)) || filled < 0 || filled > dump_block) {
+                ok = false;
+                break;
+            }
+            if (!filled)
+                break;
+            if (!read_all(fd, block, sizeof(Data) * filled)) {
+                ok = false;
+                break;
+            }
+            checksum = dump_checksum(checksum, reinterpret_cast<const char *>(block), sizeof(Data) * filled);
+            for (int i = 0; i < filled && ok; ++i) {
+                if (total && block[i] < previous)
+                    ok = false;
+                else {
+                    builder.add(block[i]);
+                    previous = block[i];
+                    ++total;
+                }
+            }
+        }
+        long long expected_total;
+        unsigned long long expected_checksum;
+        ok = ok && read_all(fd, &expected_total, sizeof(expected_total)) &&
+             read_all(fd, &expected_checksum, sizeof(expected_checksum)) &&
+             expected_total == total && expected_checksum == checksum;
+
+        root_pos = builder.finish();
+        append_leaf = builder.last_leaf;
+        append_version = storage.version(append_leaf);
+        delete[] block;
+        if (fd != STDIN_FILENO)
+            close(fd);
+        return ok;
+    }
+
+    class BulkLoader {
+
+        /*
+         * loads entries in any order into an empty tree: add() hands them to an external sorter, which holds
+         * memory_entries of them and spills the rest as sorted runs in directory (TMPDIR or /tmp), sorting on threads;
+         * finish() feeds the merged order to the bulk builder, pages filled to the fill factor; an entry added twice is
+         * there twice, as after two inserts
+         * finish() is false for a tree that is not empty or a run that failed to write or read back, and in the
+         * second case the entries before the fault stay in the tree
+         */
+
+        BasicBPlusTree &tree;
+        ExternalSorter<Data> sorter;
+        Data entry;
+
+    public:
+
+        explicit BulkLoader(BasicBPlusTree &tree, long long memory_entries = 1 << 20, int threads = 1,
+                            const char *directory = nullptr) :
+                tree(tree), sorter(memory_entries, threads, nullptr, directory) {}
+
+        void add(Key key, Value value) {
+            Codec::store(entry, key);
+            entry.index = Codec::index(key, value);
+            sorter.push(entry);
+        }
+
+        long long size() const {
+            return sorter.size();
+        }
+
+        int spilled_runs() const {
+            return sorter.spilled_runs();
+        }
+
+        bool finish() {
+            if (tree.read_only)
+                return false;
+            tree.settle();
+            std::unique_lock<std::mutex> tree_guard(tree.tree_lock, std::defer_lock);
+            if (tree.mem_table_limit)
+                tree_guard.lock();
+
+            const LeafNode *root = dynamic_cast<const LeafNode *>(tree.storage.read(tree.root_pos));
+            if (!root || root->size || !sorter.finish())
+                return false;
+
+            tree.storage.free(tree.root_pos);
+            BulkBuilder builder(tree);
+            while (sorter.next(entry))
+                builder.add(entry);
+
+            tree.root_pos = builder.finish();
+            tree.append_leaf = builder.last_leaf;
+            tree.append_version = tree.storage.version(tree.append_leaf);
+            return sorter.good();
+        }
+    };
+};
+
+// the tree of main.cpp keeps the page layout of the files written before the geometry was derived: a leaf of 48
+// entries where 51 would fit, which the internal node, its buffer and the merge thresholds match as derived
+
+typedef BasicBPlusTree<const char *, int, KeyCodec<const char *, int>, 4096, false, 48> BPlusTree;
+
+static_assert(BPlusTree::leaf_size == 48 && BPlusTree::internal_size == 180 && BPlusTree::buffer_size == 20 &&
+              BPlusTree::leaf_merge_size == 16 && BPlusTree::internal_merge_size == 60,
+              "the default tree no longer opens existing files");
 
 #endif
@@ -0,0 +1,1199 @@
+/*
+ *  benchmarks for the B+ tree engine
+ *  usage: benchmark <case> [n], case is insert, scan, find, keys, count, compress, arena, pool, memory, catalog, epoch,
+ *  upsert, alloc, sort or verify
+ *  every case runs inside ./bench_data, whose tree files are wiped first
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#define BPT_ALLOC_CHECK // counts this program's heap allocations, for the alloc case
+#include "b_plus_tree.h"
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void wipe_tree() {
+    std::remove(BPlusTree::data_path);
+    std::remove(BPlusTree::info_path);
+    std::remove(BPlusTree::root_path);
+}
+
+void drop_os_cache() {
+
+    // evicts the data file from the kernel page cache, so page reads really go to the device
+
+    int fd = open(BPlusTree::data_path, O_RDONLY);
+    if (fd < 0)
+        return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+void random_key(std::mt19937 &rng, char *key) {
+    int length = 8 + rng() % 16;
+    for (int i = 0; i < length; ++i)
+        key[i] = 'a' + rng() % 26;
+    key[length] = 0;
+}
+
+void bench_insert(int n) {
+
+    // random keys and values, so once the tree outgrows the cache nearly every insert touches a cold leaf
+
+    const char *modes[3] = {"plain", "write-optimized", "mem-table"};
+    char key[65];
+
+    for (int mode = 0; mode < 3; ++mode) {
+        wipe_tree();
+        std::mt19937 rng(20240601);
+
+        Clock::time_point start = Clock::now();
+        double insert_time;
+        {
+            BPlusTree bpt(false);
+            bpt.set_write_optimized(mode == 1);
+            if (mode == 2)
+                bpt.enable_mem_table(65536);
+            for (int i = 0; i < n; ++i) {
+                random_key(rng, key);
+                bpt.insert(key, (int) (rng() % 1000000));
+            }
+            insert_time = seconds_since(start);
+        }
+        double total_time = seconds_since(start);
+
+        std::cout << "random insert (" << modes[mode] << "): " << n << " ops, "
+                  << (long long) (n / insert_time) << " ops/s, "
+                  << (long long) (n / total_time) << " ops/s including close\n";
+    }
+}
+
+void bench_scan(int n) {
+
+    // a few keys holding n values between them, so every find walks a long leaf chain that does not fit the cache
+
+    const int keys = 4;
+    char key[65];
+    wipe_tree();
+    {
+        BPlusTree bpt(false);
+        for (int i = 0; i < n; ++i) {
+            sprintf(key, "scan-key-%d", i % keys);
+            bpt.insert(key, i);
+        }
+    }
+
+    std::ofstream null_out("/dev/null");
+    std::streambuf *saved = std::cout.rdbuf(null_out.rdbuf());
+
+    double elapsed[2];
+    BPlusTree::Stats stats[2];
+    for (int mode = 0; mode < 2; ++mode) {
+        drop_os_cache();
+        BPlusTree bpt(false);
+        bpt.set_read_ahead(mode ? 16 : 0);
+
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < keys; ++i) {
+            sprintf(key, "scan-key-%d", i);
+            bpt.print_value(key);
+        }
+        elapsed[mode] = seconds_since(start);
+        stats[mode] = bpt.stats();
+    }
+
+    std::cout.rdbuf(saved);
+    for (int mode = 0; mode < 2; ++mode)
+        std::cout << "leaf chain scan (read-ahead " << (mode ? "on" : "off") << "): " << n << " values, "
+                  << (long long) (n / elapsed[mode]) << " values/s, "
+                  << stats[mode].prefetch_used << " prefetched pages used, "
+                  << stats[mode].prefetch_wasted << " dropped\n";
+}
+
+void bench_find(int n) {
+
+    // random point lookups, print_value one key at a time against find_batch,
+    // on a tree that fits the page cache and on one n entries large read from a cold file
+
+    const int lookups = 200000, batch = 64;
+    char (*keys)[65] = new char[lookups][65];
+    const char **key_ptrs = new const char *[lookups];
+    std::ofstream null_out("/dev/null");
+
+    for (int size_case = 0; size_case < 2; ++size_case) {
+        int size = size_case ? n : n / 10;
+        wipe_tree();
+        std::mt19937 rng(20240607);
+        {
+            BPlusTree bpt(false);
+            char key[65];
+            for (int i = 0; i < size; ++i) {
+                random_key(rng, key);
+                bpt.insert(key, i);
+            }
+        }
+
+        // the first inserted keys, replayed from the same seed and looked up in shuffled order
+
+        std::mt19937 replay(20240607);
+        for (int i = 0; i < lookups; ++i) {
+            if (i < size)
+                random_key(replay, keys[i]);
+            else
+                strcpy(keys[i], keys[i % size]);
+        }
+        for (int i = 0; i < lookups; ++i)
+            key_ptrs[i] = keys[i];
+        for (int i = lookups - 1; i > 0; --i) {
+            int j = (int) (rng() % (i + 1));
+            const char *tmp = key_ptrs[i];
+            key_ptrs[i] = key_ptrs[j];
+            key_ptrs[j] = tmp;
+        }
+
+        double elapsed[2];
+        for (int mode = 0; mode < 2; ++mode) {
+            if (size_case)
+                drop_os_cache();
+            BPlusTree bpt(false);
+            std::streambuf *saved = std::cout.rdbuf(null_out.rdbuf());
+
+            Clock::time_point start = Clock::now();
+            if (mode)
+                for (int i = 0; i < lookups; i += batch)
+                    bpt.find_batch(key_ptrs + i, lookups - i < batch ? lookups - i : batch);
+            else
+                for (int i = 0; i < lookups; ++i)
+                    bpt.print_value(key_ptrs[i]);
+            elapsed[mode] = seconds_since(start);
+
+            std::cout.rdbuf(saved);
+        }
+
+        for (int mode = 0; mode < 2; ++mode)
+            std::cout << "point lookups (" << (size_case ? "out of cache" : "in cache") << ", "
+                      << (mode ? "find_batch" : "print_value") << "): " << size << " entries, "
+                      << (long long) (lookups / elapsed[mode]) << " lookups/s\n";
+    }
+
+    delete[] keys;
+    delete[] key_ptrs;
+}
+
+template<typename Tree, typename KeyAt>
+void run_keys(const char *name, int n, KeyAt key_at) {
+
+    // inserts n keys in random order, then looks every one of them up, reports both rates and the file size
+
+    const int lookups = 200000;
+    std::ofstream null_out("/dev/null");
+    wipe_tree();
+
+    Clock::time_point start = Clock::now();
+    {
+        Tree bpt(false);
+        for (int i = 0; i < n; ++i)
+            bpt.insert(key_at(i), i);
+    }
+    double insert_time = seconds_since(start);
+
+    double find_time;
+    long long pages;
+    {
+        Tree bpt(false);
+        std::streambuf *saved = std::cout.rdbuf(null_out.rdbuf());
+        start = Clock::now();
+        for (int i = 0; i < lookups; ++i)
+            bpt.print_value(key_at((int) ((long long) i * 7919 % n)));
+        find_time = seconds_since(start);
+        std::cout.rdbuf(saved);
+        pages = bpt.stats(true).leaf_pages;
+    }
+
+    std::cout << name << " keys: " << n << " inserts, "
+              << (long long) (n / insert_time) << " ops/s including close, "
+              << (long long) (lookups / find_time) << " lookups/s, "
+              << pages << " leaf pages\n";
+}
+
+void bench_keys(int n) {
+
+    // the same workload on the default string tree and on an int64 keyed tree, which fits five times as many entries per leaf
+
+    char (*keys)[65] = new char[n][65];
+    long long *numbers = new long long[n];
+    std::mt19937 rng(20240615);
+    for (int i = 0; i < n; ++i) {
+        random_key(rng, keys[i]);
+        numbers[i] = ((long long) rng() << 32) ^ rng();
+    }
+
+    run_keys<BPlusTree>("string", n, [keys](int i) { return (const char *) keys[i]; });
+    run_keys<BasicBPlusTree<long long, int>>("int64", n, [numbers](int i) { return numbers[i]; });
+
+    delete[] keys;
+    delete[] numbers;
+}
+
+void bench_count(int n) {
+
+    // n int64 entries over n / 1000 keys: counting a key's values by printing them against the counted tree's count,
+    // then count_range and select, which read one path of pages each
+
+    typedef BasicBPlusTree<long long, int, KeyCodec<long long, int>, 4096, true> CountedTree;
+    const int keys = n / 1000 > 0 ? n / 1000 : 1, queries = 20000;
+    std::ofstream null_out("/dev/null");
+    wipe_tree();
+
+    Clock::time_point start = Clock::now();
+    {
+        CountedTree bpt(false);
+        std::mt19937 rng(20240621);
+        for (int i = 0; i < n; ++i)
+            bpt.insert((long long) (rng() % keys), i);
+    }
+    double insert_time = seconds_since(start);
+
+    CountedTree bpt(false);
+    std::mt19937 rng(20240622);
+    long long checksum = 0;
+
+    std::streambuf *saved = std::cout.rdbuf(null_out.rdbuf());
+    start = Clock::now();
+    for (int i = 0; i < queries / 100; ++i)
+        bpt.print_value((long long) (rng() % keys));
+    double print_time = seconds_since(start) * 100;
+    std::cout.rdbuf(saved);
+
+    start = Clock::now();
+    for (int i = 0; i < queries; ++i)
+        checksum += bpt.count((long long) (rng() % keys));
+    double count_time = seconds_since(start);
+
+    start = Clock::now();
+    for (int i = 0; i < queries; ++i) {
+        long long low = rng() % keys;
+        checksum += bpt.count_range(low, low + keys / 10);
+    }
+    double range_time = seconds_since(start);
+
+    start = Clock::now();
+    for (int i = 0; i < queries; ++i) {
+        long long key;
+        int value;
+        if (bpt.select(rng() % n, key, value))
+            checksum += value;
+    }
+    double select_time = seconds_since(start);
+
+    std::cout << "counted tree: " << n << " entries over " << keys << " keys, "
+              << (long long) (n / insert_time) << " inserts/s including close, checksum " << checksum << '\n'
+              << "values of a key (print_value): " << (long long) (queries / print_time) << " keys/s\n"
+              << "values of a key (count): " << (long long) (queries / count_time) << " keys/s\n"
+              << "count_range over a tenth of the keys: " << (long long) (queries / range_time) << " ranges/s\n"
+              << "select: " << (long long) (queries / select_time) << " lookups/s\n";
+}
+
+long long io_counter(const char *name) {
+
+    // bytes this process moved through read/write syscalls, from /proc/self/io
+
+    std::ifstream io("/proc/self/io");
+    std::string field;
+    long long value;
+    while (io >> field >> value)
+        if (field == name)
+            return value;
+    return 0;
+}
+
+void bench_compress(int n) {
+
+    // the same random string keys into a plain and a compressed file: file size and bytes written while loading,
+    // then cold lookups with the bytes read for them, and the CPU spent per page on either side
+
+    const int lookups = 100000;
+    std::ofstream null_out("/dev/null");
+
+    for (int mode = 0; mode < 2; ++mode) {
+        wipe_tree();
+        std::mt19937 rng(20240628);
+        char key[65];
+
+        long long written = io_counter("wchar:");
+        Clock::time_point start = Clock::now();
+        BPlusTree::Stats load_stats;
+        {
+            BPlusTree bpt(false);
+            bpt.set_compression(mode == 1);
+            for (int i = 0; i < n; ++i) {
+                random_key(rng, key);
+                bpt.insert(key, i);
+            }
+            load_stats = bpt.stats();
+        }
+        double insert_time = seconds_since(start);
+        written = io_counter("wchar:") - written;
+
+        struct stat file_stat;
+        long long file_bytes = stat(BPlusTree::data_path, &file_stat) == 0 ? (long long) file_stat.st_size : 0;
+
+        drop_os_cache();
+        std::mt19937 replay(20240628);
+        long long read_bytes;
+        double find_time;
+        BPlusTree::Stats find_stats;
+        {
+            BPlusTree bpt(false);
+            std::streambuf *saved = std::cout.rdbuf(null_out.rdbuf());
+            read_bytes = io_counter("rchar:");
+            start = Clock::now();
+            for (int i = 0; i < lookups && i < n; ++i) {
+                random_key(replay, key);
+                bpt.print_value(key);
+            }
+            find_time = seconds_since(start);
+            read_bytes = io_counter("rchar:") - read_bytes;
+            std::cout.rdbuf(saved);
+            find_stats = bpt.stats();
+        }
+
+        int found = lookups < n ? lookups : n;
+        std::cout << "compression " << (mode ? "on" : "off") << ": " << n << " inserts, "
+                  << (long long) (n / insert_time) << " ops/s including close, "
+                  << file_bytes << " bytes on disk, " << written << " bytes written\n"
+                  << "  cold lookups: " << (long long) (found / find_time) << " lookups/s, "
+                  << read_bytes << " bytes read";
+        if (mode)
+            std::cout << ", " << (load_stats.flushed_pages ? load_stats.compress_ns / load_stats.flushed_pages : 0)
+                      << " ns compressing a page, "
+                      << (find_stats.decompressed_pages ? find_stats.decompress_ns / find_stats.decompressed_pages : 0)
+                      << " ns decompressing one";
+        std::cout << '\n';
+    }
+}
+
+int open_dtlb_counter() {
+
+    // data TLB load misses of this thread in user space, -1 when perf events are not allowed here
+
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+long long memory_counter(const char *name) {
+
+    // a kB total over all mappings, from /proc/self/smaps_rollup
+
+    std::ifstream rollup("/proc/self/smaps_rollup");
+    std::string field;
+    while (rollup >> field) {
+        long long value;
+        if (field == name && rollup >> value)
+            return value;
+    }
+    return 0;
+}
+
+void bench_arena(int n) {
+
+    // in-cache point lookups with the buffer pool on small pages, transparent and explicit huge pages, and
+    // interleaved over the NUMA nodes: lookup latency, dTLB load misses per lookup and what the kernel granted
+
+    const int lookups = 1000000;
+    const int modes[4][2] = {{FrameArena::small_pages,            FrameArena::numa_default},
+                             {FrameArena::transparent_huge_pages, FrameArena::numa_default},
+                             {FrameArena::explicit_huge_pages,    FrameArena::numa_default},
+                             {FrameArena::transparent_huge_pages, FrameArena::numa_interleave}};
+    const char *names[4] = {"small pages", "transparent huge pages", "explicit huge pages", "interleaved THP"};
+    const char *granted[3] = {"small pages", "transparent huge pages", "explicit huge pages"};
+    int size = n / 10 ? n / 10 : 1;
+    std::ofstream null_out("/dev/null");
+
+    wipe_tree();
+    {
+        BPlusTree bpt(false);
+        std::mt19937 rng(20240705);
+        char key[65];
+        for (int i = 0; i < size; ++i) {
+            random_key(rng, key);
+            bpt.insert(key, i);
+        }
+    }
+
+    char (*keys)[65] = new char[size][65];
+    std::mt19937 replay(20240705);
+    for (int i = 0; i < size; ++i)
+        random_key(replay, keys[i]);
+
+    for (int mode = 0; mode < 4; ++mode) {
+        BPlusTree bpt(false);
+        bpt.set_frame_arena(modes[mode][0], modes[mode][1]);
+        std::streambuf *saved = std::cout.rdbuf(null_out.rdbuf());
+        for (int i = 0; i < size; ++i) // every page resident before the clock starts
+            bpt.print_value(keys[i]);
+
+        std::mt19937 rng(20240706);
+        int counter = open_dtlb_counter();
+        if (counter >= 0) {
+            ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < lookups; ++i)
+            bpt.print_value(keys[rng() % size]);
+        double elapsed = seconds_since(start);
+        long long misses = -1;
+        if (counter >= 0) {
+            ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(counter, &misses, sizeof(misses)) != sizeof(misses))
+                misses = -1;
+            close(counter);
+        }
+        std::cout.rdbuf(saved);
+
+        BPlusTree::Stats stats = bpt.stats();
+        std::cout << names[mode] << ": " << size << " entries, " << (long long) (lookups / elapsed) << " lookups/s, "
+                  << elapsed * 1e9 / lookups << " ns a lookup, ";
+        if (misses >= 0)
+            std::cout << (double) misses / lookups << " dTLB misses a lookup\n";
+        else
+            std::cout << "dTLB misses not available\n";
+        std::cout << "  granted " << granted[stats.frame_huge_pages]
+                  << (stats.frame_numa_placed ? ", NUMA placed, " : ", default NUMA policy, ")
+                  << memory_counter("AnonHugePages:") << " kB in transparent huge pages, "
+                  << memory_counter("Private_Hugetlb:") << " kB in explicit ones\n";
+    }
+
+    delete[] keys;
+}
+
+void bench_pool(int n) {
+
+    // auto-sizing from a 1 MB pool with a 64 MB budget: uniform lookups over the whole tree grow the pool,
+    // then lookups over a hundredth of the keys let it shrink back, one line per round
+
+    const int rounds = 12, lookups = 100000;
+    int size = n / 10 ? n / 10 : 1;
+    std::ofstream null_out("/dev/null");
+
+    wipe_tree();
+    {
+        BPlusTree bpt(false);
+        std::mt19937 rng(20240712);
+        char key[65];
+        for (int i = 0; i < size; ++i) {
+            random_key(rng, key);
+            bpt.insert(key, i);
+        }
+    }
+
+    char (*keys)[65] = new char[size][65];
+    std::mt19937 replay(20240712);
+    for (int i = 0; i < size; ++i)
+        random_key(replay, keys[i]);
+
+    BPlusTree bpt(false);
+    bpt.set_pool_size(1 << 20);
+    bpt.set_pool_budget(64 << 20);
+    std::mt19937 rng(20240713);
+    for (int round = 0; round < rounds; ++round) {
+        int range = round < rounds / 2 ? size : (size / 100 ? size / 100 : 1);
+        std::streambuf *saved = std::cout.rdbuf(null_out.rdbuf());
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < lookups; ++i)
+            bpt.print_value(keys[rng() % range]);
+        double elapsed = seconds_since(start);
+        std::cout.rdbuf(saved);
+
+        BPlusTree::Stats stats = bpt.stats();
+        std::cout << "round " << round << (range == size ? " (all keys): " : " (hot keys): ")
+                  << (long long) (lookups / elapsed) << " lookups/s, pool " << (stats.pool_bytes >> 10) << " kB, "
+                  << (stats.resident_bytes >> 10) << " kB resident, " << stats.pool_resizes << " resizes\n";
+    }
+
+    delete[] keys;
+}
+
+void bench_memory(int n) {
+
+    // the same random keys into a tree on disk whose pool holds all of it and into a memory-only tree:
+    // inserts including close or persist, then shuffled point lookups, the ceiling the disk path can approach
+
+    const char *modes[2] = {"disk", "memory"};
+    const int lookups = 200000;
+    char (*keys)[65] = new char[lookups][65];
+    std::ofstream null_out("/dev/null");
+
+    std::mt19937 replay(20240719);
+    for (int i = 0; i < lookups; ++i) {
+        if (i < n)
+            random_key(replay, keys[i]);
+        else
+            strcpy(keys[i], keys[i % n]);
+    }
+
+    for (int mode = 0; mode < 2; ++mode) {
+        wipe_tree();
+        double insert_time, persist_time, find_time;
+        {
+            BPlusTree *tree = mode ? new BPlusTree(BPlusTree::memory_only) : new BPlusTree(false);
+            BPlusTree &bpt = *tree;
+            if (!mode)
+                bpt.set_pool_size((long long) n * 256 + (64 << 20));
+
+            std::mt19937 rng(20240719);
+            char key[65];
+            Clock::time_point start = Clock::now();
+            for (int i = 0; i < n; ++i) {
+                random_key(rng, key);
+                bpt.insert(key, i);
+            }
+            insert_time = seconds_since(start);
+
+            std::mt19937 order(20240720);
+            std::streambuf *saved = std::cout.rdbuf(null_out.rdbuf());
+            start = Clock::now();
+            for (int i = 0; i < lookups; ++i)
+                bpt.print_value(keys[order() % (lookups < n ? lookups : n)]);
+            find_time = seconds_since(start);
+            std::cout.rdbuf(saved);
+
+            start = Clock::now();
+            if (mode)
+                bpt.persist();
+            delete tree;
+            persist_time = seconds_since(start);
+        }
+
+        std::cout << modes[mode] << ": " << n << " entries, "
+                  << (long long) (n / (insert_time + persist_time)) << " inserts/s including "
+                  << (mode ? "persist" : "close") << " (" << persist_time * 1000 << " ms), "
+                  << (long long) (lookups / find_time) << " lookups/s\n";
+    }
+
+    delete[] keys;
+}
+
+void bench_catalog(int n) {
+
+    // eight tables of n / 80 entries, nine in ten lookups on the first: as trees of one catalog sharing a 16 MB pool,
+    // then as eight trees on their own, each in its directory with a 2 MB pool, the memory split the same way as a
+    // process per table would; lookups/s and the bytes read from the data files for them
+
+    const int tables = 8, lookups = 400000;
+    const long long pool = 16 << 20;
+    int size = n / 80 ? n / 80 : 1;
+    std::ofstream null_out("/dev/null");
+
+    char (*keys)[65] = new char[(long long) tables * size][65];
+    std::mt19937 rng(20240726);
+    for (long long i = 0; i < (long long) tables * size; ++i)
+        random_key(rng, keys[i]);
+    int *plan = new int[lookups];
+    for (int i = 0; i < lookups; ++i) {
+        int table = rng() % 10 ? 0 : 1 + rng() % (tables - 1);
+        plan[i] = table * size + rng() % size;
+    }
+
+    for (int mode = 0; mode < 2; ++mode) {
+        long long read_before;
+        double elapsed;
+
+        if (!mode) {
+            wipe_tree();
+            {
+                BPlusTree::Catalog catalog(true);
+                for (int table = 0; table < tables; ++table) {
+                    BPlusTree *tree = catalog.open(std::to_string(table).c_str());
+                    for (int i = 0; i < size; ++i)
+                        tree->insert(keys[table * size + i], i);
+                    delete tree;
+                }
+            }
+
+            BPlusTree::Catalog catalog;
+            catalog.set_pool_size(pool);
+            BPlusTree *tree[tables];
+            for (int table = 0; table < tables; ++table)
+                tree[table] = catalog.open(std::to_string(table).c_str());
+            std::streambuf *saved = std::cout.rdbuf(null_out.rdbuf());
+            read_before = io_counter("rchar:");
+            Clock::time_point start = Clock::now();
+            for (int i = 0; i < lookups; ++i)
+                tree[plan[i] / size]->print_value(keys[plan[i]]);
+            elapsed = seconds_since(start);
+            std::cout.rdbuf(saved);
+            for (int table = 0; table < tables; ++table)
+                delete tree[table];
+        }
+        else {
+            for (int table = 0; table < tables; ++table) {
+                std::string dir = "table-" + std::to_string(table);
+                mkdir(dir.c_str(), 0755);
+                if (chdir(dir.c_str()) != 0)
+                    return;
+                wipe_tree();
+                {
+                    BPlusTree bpt(false);
+                    for (int i = 0; i < size; ++i)
+                        bpt.insert(keys[table * size + i], i);
+                }
+                if (chdir("..") != 0)
+                    return;
+            }
+
+            // the tables do not share anything, so each one's lookups run in turn with only its tree open
+
+            read_before = io_counter("rchar:");
+            elapsed = 0;
+            for (int table = 0; table < tables; ++table) {
+                if (chdir(("table-" + std::to_string(table)).c_str()) != 0)
+                    return;
+                {
+                    BPlusTree bpt(false);
+                    bpt.set_pool_size(pool / tables);
+                    std::streambuf *saved = std::cout.rdbuf(null_out.rdbuf());
+                    Clock::time_point start = Clock::now();
+                    for (int i = 0; i < lookups; ++i)
+                        if (plan[i] / size == table)
+                            bpt.print_value(keys[plan[i]]);
+                    elapsed += seconds_since(start);
+                    std::cout.rdbuf(saved);
+                }
+                if (chdir("..") != 0)
+                    return;
+            }
+        }
+
+        std::cout << (mode ? "a tree per table, 2 MB pools: " : "one catalog, shared 16 MB pool: ")
+                  << tables << " tables of " << size << " entries, " << (long long) (lookups / elapsed)
+                  << " lookups/s, " << ((io_counter("rchar:") - read_before) >> 20) << " MB read\n";
+    }
+
+    delete[] keys;
+    delete[] plan;
+}
+
+// a page of the epoch case, every word holding one stamp, so a reader can tell a whole page from a torn one
+
+struct StampedPage {
+    static constexpr int words = 4096 / sizeof(long long);
+
+    long long word[words];
+
+    static char *serialize(char *out, StampedPage *page) {
+        memcpy(out, page, sizeof(StampedPage));
+        return out + sizeof(StampedPage);
+    }
+
+    static void deserialize(const char *in, char *ptr) {
+        memcpy(ptr, in, sizeof(StampedPage));
+    }
+};
+
+void bench_epoch(int n) {
+
+    /*
+     * a stress test of the reclamation itself: reader threads look pages up in a PageManager with shared_frame()
+     * and check each against its number, while the owner reads other pages through a pool too small for them, so
+     * it evicts all the time, frees and reallocates pages it stamps with their own number, and resizes the pool;
+     * frames are reused at once, then only once the epochs allow it, so a torn read is a frame reused under its
+     * reader
+     * then a tree churning through a small pool with and without an EpochManager, the price on the writer's side
+     */
+
+    typedef PageManager<StampedPage, 4096, 8192> Manager;
+    const int stable_pages = 1024, churn_pages = 256, readers = 4, min_steps = 2048, resize_every = 256;
+    const double seconds = 1;
+
+    for (int mode = 0; mode < 2; ++mode) {
+        std::remove("epoch_data.bin");
+        std::remove("epoch_info.bin");
+        EpochManager epochs;
+        Manager *manager = new Manager("epoch_data.bin", "epoch_info.bin");
+        manager->reserve_pages(2 * (stable_pages + churn_pages));
+        int *churn = new int[churn_pages];
+
+        auto stamp = [&](int page, long long value) {
+            StampedPage *frame = reinterpret_cast<StampedPage *>((*manager)[page]);
+            for (int i = 0; i < StampedPage::words; ++i)
+                frame->word[i] = value;
+        };
+        for (int page = 0; page < stable_pages; ++page)
+            stamp(manager->alloc_page<StampedPage>(), page);
+        for (int i = 0; i < churn_pages; ++i) {
+            churn[i] = manager->alloc_page<StampedPage>();
+            stamp(churn[i], -1 - i);
+        }
+        manager->resize_frames(256);
+        if (mode)
+            manager->set_epochs(&epochs);
+
+        std::atomic<bool> stop(false);
+        std::atomic<long long> reads(0), torn(0);
+        std::thread *reader = new std::thread[readers];
+        for (int r = 0; r < readers; ++r)
+            reader[r] = std::thread([&, r]() {
+                int slot = epochs.join();
+                std::mt19937 rng(20240802 + r);
+                long long done = 0, bad = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    EpochManager::Guard guard(mode ? &epochs : nullptr, slot);
+                    int page = rng() % stable_pages;
+                    const StampedPage *frame = reinterpret_cast<const StampedPage *>(manager->shared_frame(page));
+                    if (!frame)
+                        continue;
+                    for (int i = 0; i < StampedPage::words; ++i)
+                        if (__atomic_load_n(&frame->word[i], __ATOMIC_RELAXED) != page) {
+                            ++bad;
+                            break;
+                        }
+                    ++done;
+                }
+                epochs.leave(slot);
+                reads += done;
+                torn += bad;
+            });
+
+        std::mt19937 rng(20240801);
+        long long steps = 0;
+        Clock::time_point start = Clock::now();
+        while (steps < min_steps || seconds_since(start) < seconds) {
+            manager->read(rng() % stable_pages);
+            int i = rng() % churn_pages;
+            manager->free_page(churn[i]);
+            churn[i] = manager->alloc_page<StampedPage>();
+            stamp(churn[i], -1 - i);
+            if (++steps % resize_every == 0)
+                manager->resize_frames(steps % (2 * resize_every) ? 128 : 256);
+        }
+        double elapsed = seconds_since(start);
+        stop = true;
+        for (int r = 0; r < readers; ++r)
+            reader[r].join();
+        delete[] reader;
+
+        std::cout << (mode ? "with epochs: " : "reused at once: ") << readers << " readers, "
+                  << (long long) (reads / elapsed) << " page reads/s, " << torn << " torn, "
+                  << (long long) (steps / elapsed) << " evicting reads and reallocations/s, " << epochs.wait_count()
+                  << " writer waits\n";
+        if (mode)
+            manager->set_epochs(nullptr);
+        delete manager;
+        delete[] churn;
+    }
+    std::remove("epoch_data.bin");
+    std::remove("epoch_info.bin");
+
+    int size = n / 10 ? n / 10 : 1;
+    for (int mode = 0; mode < 2; ++mode) {
+        wipe_tree();
+        EpochManager epochs;
+        BPlusTree bpt(false);
+        bpt.set_pool_size(1 << 20);
+        if (mode)
+            bpt.set_epochs(&epochs);
+        std::mt19937 rng(20240803);
+        char key[65];
+        Clock::time_point start = Clock::now();
+        for (int round = 0; round < 3; ++round) {
+            std::mt19937 replay(20240804 + round);
+            for (int i = 0; i < size; ++i) {
+                random_key(replay, key);
+                bpt.insert(key, i);
+            }
+            replay.seed(20240804 + round);
+            for (int i = 0; i < size; ++i) {
+                random_key(replay, key);
+                if (i % 4)
+                    bpt.remove(key, i);
+            }
+        }
+        double elapsed = seconds_since(start);
+        BPlusTree::Stats stats = bpt.stats();
+        std::cout << (mode ? "tree with epochs: " : "tree without: ") << (long long) (6 * size / elapsed)
+                  << " inserts and removes/s in a 1 MB pool, " << stats.epoch_retired << " waiting, "
+                  << stats.epoch_waits << " waits\n";
+        if (mode)
+            bpt.set_epochs(nullptr);
+    }
+}
+
+void bench_upsert(int n) {
+
+    /*
+     * n int64 entries, 16 values per key: the conditional writes against what a caller pieces together from two
+     * operations, a lookup then an insert, a remove then an insert, and a remove per value against remove_all
+     * about half the values asked for are in the tree; a lookup's output goes to /dev/null, its cost is the second
+     * descent
+     */
+
+    typedef BasicBPlusTree<long long, int, KeyCodec<long long, int>> Tree;
+    const int per_key = 16, keys = n / per_key > 0 ? n / per_key : 1, queries = 200000;
+    std::ofstream null_out("/dev/null");
+    wipe_tree();
+
+    Tree bpt(false);
+    for (int i = 0; i < keys * per_key; ++i)
+        bpt.insert((long long) (i % keys), i / keys * 2);
+
+    std::mt19937 rng(20240701);
+    long long present = 0, replaced = 0, removed = 0;
+
+    std::streambuf *saved = std::cout.rdbuf(null_out.rdbuf());
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < queries; ++i) {
+        long long key = rng() % keys;
+        bpt.print_value(key);
+        bpt.insert(key, (int) (rng() % (per_key * 2)));
+    }
+    double lookup_insert_time = seconds_since(start);
+    std::cout.rdbuf(saved);
+
+    start = Clock::now();
+    for (int i = 0; i < queries; ++i)
+        present += bpt.insert_if_absent((long long) (rng() % keys), (int) (rng() % (per_key * 2)))
+                   == Tree::write_present;
+    double if_absent_time = seconds_since(start);
+
+    start = Clock::now();
+    for (int i = 0; i < queries; ++i) {
+        long long key = rng() % keys;
+        int value = (int) (rng() % per_key) * 2;
+        bpt.remove(key, value);
+        bpt.insert(key, value + 1);
+    }
+    double remove_insert_time = seconds_since(start);
+
+    start = Clock::now();
+    for (int i = 0; i < queries; ++i) {
+        int value = (int) (rng() % per_key) * 2;
+        replaced += bpt.replace((long long) (rng() % keys), value, value + 1) == Tree::write_done;
+    }
+    double replace_time = seconds_since(start);
+
+    int drops = queries / per_key < keys / 2 ? queries / per_key : keys / 2;
+    start = Clock::now();
+    for (int i = 0; i < drops; ++i)
+        for (int j = 0; j < per_key * 2; ++j)
+            bpt.remove((long long) i, j);
+    double per_value_time = seconds_since(start);
+
+    start = Clock::now();
+    for (int i = 0; i < drops; ++i)
+        removed += bpt.remove_all((long long) (keys - 1 - i));
+    double remove_all_time = seconds_since(start);
+
+    std::cout << keys * per_key << " entries over " << keys << " keys\n"
+              << "lookup then insert: " << (long long) (queries / lookup_insert_time) << " ops/s\n"
+              << "insert_if_absent: " << (long long) (queries / if_absent_time) << " ops/s, " << present
+              << " already present\n"
+              << "remove then insert: " << (long long) (queries / remove_insert_time) << " ops/s\n"
+              << "replace: " << (long long) (queries / replace_time) << " ops/s, " << replaced << " replaced\n"
+              << "remove per value (" << per_key * 2 << " tries a key): " << (long long) (drops / per_value_time)
+              << " keys/s\n"
+              << "remove_all: " << (long long) (drops / remove_all_time) << " keys/s, " << removed << " entries\n";
+}
+
+void bench_alloc(int n) {
+
+    /*
+     * steady state allocates nothing: per mode, n random entries, a warm-up round of the mix, then the same mix
+     * with the tree's allocation check armed, which aborts on the first insert, remove or find that allocates
+     * the size stays at n, every insert is matched by the remove of the entry inserted n before it
+     */
+
+    const char *modes[7] = {"plain", "small pool", "lazy delete", "write-optimized", "mem-table", "compressed",
+                            "memory"};
+    std::ofstream null_out("/dev/null");
+
+    for (int mode = 0; mode < 7; ++mode) {
+        wipe_tree();
+        BPlusTree *tree = mode == 6 ? new BPlusTree(BPlusTree::memory_only) : new BPlusTree(true);
+        BPlusTree &bpt = *tree;
+        if (mode == 1)
+            bpt.set_pool_size(2 << 20);
+        else if (mode == 2)
+            bpt.set_lazy_delete(BPlusTree::leaf_merge_size);
+        else if (mode == 3)
+            bpt.set_write_optimized(true);
+        else if (mode == 4)
+            bpt.enable_mem_table(4096);
+        else if (mode == 5)
+            bpt.set_compression(true);
+        else if (mode == 6)
+            bpt.set_pool_size((long long) n * 256); // frames up front, churn lowers the fill and takes more leaves
+
+        std::mt19937 rng(20240801), lagging(20240801), lookup(20240802);
+        char key[65];
+        for (int i = 0; i < n; ++i) {
+            random_key(rng, key);
+            bpt.insert(key, i);
+        }
+
+        std::streambuf *saved = std::cout.rdbuf(null_out.rdbuf());
+        long long allocations = 0, worst_ns = 0;
+        double armed_time = 0;
+        for (int round = 1; round <= 2; ++round) {
+            bool armed = round == 2;
+            bpt.set_allocation_check(armed);
+            long long before = heap_allocations;
+            Clock::time_point start = Clock::now();
+            for (int i = 0; i < n; ++i) {
+                Clock::time_point op_start = Clock::now();
+                random_key(rng, key);
+                bpt.insert(key, round * n + i);
+                random_key(lagging, key);
+                bpt.remove(key, (round - 1) * n + i);
+                random_key(lookup, key);
+                bpt.print_value(key);
+                long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - op_start).count();
+                if (armed && ns > worst_ns)
+                    worst_ns = ns;
+            }
+            if (armed) {
+                armed_time = seconds_since(start);
+                allocations = heap_allocations - before;
+            }
+        }
+        bpt.set_allocation_check(false);
+        std::cout.rdbuf(saved);
+        delete tree;
+
+        std::cout << modes[mode] << ": " << n << " rounds of insert, remove and find, " << allocations
+                  << " allocations, " << (long long) (n / armed_time) << " rounds/s, slowest " << worst_ns / 1000
+                  << " us\n";
+    }
+}
+
+struct SortRecord {
+
+    // the shape of a string tree's entry order: a 64 bit index, with the rest of the entry along for the ride
+
+    long long index;
+    long long payload;
+
+    bool operator<(const SortRecord &other) const {
+        return index < other.index;
+    }
+};
+
+bool sorted_by_index(const SortRecord *records, long long n) {
+    for (long long i = 1; i < n; ++i)
+        if (records[i].index < records[i - 1].index)
+            return false;
+    return true;
+}
+
+void bench_sort(int n) {
+
+    /*
+     * n records per input order, each sorted by qsort, radix_sort and parallel_merge_sort on every core; then the
+     * random order through the external sorter with an eighth of it in memory, and n / 10 string entries bulk loaded
+     * against inserted one by one
+     */
+
+    const char *orders[4] = {"random", "sorted", "reversed", "16 distinct"};
+    int threads = std::thread::hardware_concurrency() ? (int) std::thread::hardware_concurrency() : 1;
+    SortRecord *input = new SortRecord[n], *work = new SortRecord[n], *buffer = new SortRecord[n];
+    std::mt19937_64 rng(20240901);
+
+    for (int order = 0; order < 4; ++order) {
+        for (int i = 0; i < n; ++i) {
+            long long index = order == 0 ? (long long) rng() : order == 1 ? i : order == 2 ? n - i : rng() % 16;
+            input[i] = SortRecord{index, i};
+        }
+        double time[3];
+        for (int method = 0; method < 3; ++method) {
+            memcpy(work, input, sizeof(SortRecord) * n);
+            Clock::time_point start = Clock::now();
+            if (method == 0)
+                qsort(work, work + n);
+            else if (method == 1)
+                radix_sort(work, work + n, buffer, [](const SortRecord &record) {
+                    return radix_order(record.index);
+                });
+            else
+                parallel_merge_sort(work, work + n, buffer, threads);
+            time[method] = seconds_since(start);
+            if (!sorted_by_index(work, n)) {
+                std::cerr << orders[order] << ": method " << method << " left the records out of order\n";
+                exit(1);
+            }
+        }
+        std::cout << orders[order] << ", " << n << " records: qsort " << time[0] << " s, radix " << time[1] << " s ("
+                  << time[0] / time[1] << "x), parallel merge " << time[2] << " s on " << threads << " threads ("
+                  << time[0] / time[2] << "x)\n";
+    }
+
+    for (int i = 0; i < n; ++i)
+        input[i] = SortRecord{(long long) rng(), i};
+    Clock::time_point start = Clock::now();
+    long long read = 0;
+    bool ordered = true;
+    int runs;
+    {
+        ExternalSorter<SortRecord> sorter(n / 8, threads, nullptr, ".");
+        for (int i = 0; i < n; ++i)
+            sorter.push(input[i]);
+        sorter.finish();
+        SortRecord record, previous{LLONG_MIN, 0};
+        while (sorter.next(record)) {
+            ordered = ordered && !(record < previous);
+            previous = record;
+            ++read;
+        }
+        runs = sorter.spilled_runs();
+    }
+    double external_time = seconds_since(start);
+    if (!ordered || read != n) {
+        std::cerr << "external sort read back " << read << " of " << n << " records" << (ordered ? "\n" : " out of order\n");
+        exit(1);
+    }
+    std::cout << "external, an eighth in memory: " << external_time << " s, " << runs << " runs, "
+              << (long long) (n / external_time) << " records/s\n";
+    delete[] input;
+    delete[] work;
+    delete[] buffer;
+
+    int entries = n / 10 > 0 ? n / 10 : 1;
+    char key[65];
+    double load_time[2];
+    for (int method = 0; method < 2; ++method) {
+        wipe_tree();
+        BPlusTree bpt(true);
+        std::mt19937 keys(20240902);
+        start = Clock::now();
+        if (method == 0)
+            for (int i = 0; i < entries; ++i) {
+                random_key(keys, key);
+                bpt.insert(key, i);
+            }
+        else {
+            BPlusTree::BulkLoader loader(bpt, entries / 4, threads, ".");
+            for (int i = 0; i < entries; ++i) {
+                random_key(keys, key);
+                loader.add(key, i);
+            }
+            loader.finish();
+        }
+        load_time[method] = seconds_since(start);
+    }
+    std::cout << entries << " string entries: inserted " << load_time[0] << " s, bulk loaded with a quarter in memory "
+              << load_time[1] << " s (" << load_time[0] / load_time[1] << "x)\n";
+}
+
+void bench_verify(int n) {
+
+    // n random inserts of which all but one in 40 are removed again, into a plain and a write-optimized tree, which
+    // shrinks with messages still in its buffers, then verify walks the file on every core
+
+    const char *modes[2] = {"plain", "write-optimized"};
+    char key[65];
+
+    for (int mode = 0; mode < 2; ++mode) {
+        wipe_tree();
+        BPlusTree bpt(false);
+        bpt.set_write_optimized(mode == 1);
+        std::mt19937 rng(20241019);
+        for (int i = 0; i < n; ++i) {
+            random_key(rng, key);
+            bpt.insert(key, i);
+        }
+        std::mt19937 replay(20241019);
+        for (int i = 0; i < n; ++i) {
+            random_key(replay, key);
+            if (i % 40)
+                bpt.remove(key, i);
+        }
+
+        Clock::time_point start = Clock::now();
+        BPlusTree::Report report = bpt.verify();
+        double elapsed = seconds_since(start);
+
+        std::cout << "verify (" << modes[mode] << "): " << report.entries << " entries, depth " << report.depth << ", "
+                  << report.leaf_pages + report.internal_pages << " pages in " << elapsed << " s, "
+                  << report.errors << " errors\n" << report.messages;
+    }
+}
+
+int main(int argc, char **argv) {
+
+    if (argc < 2) {
+        std::cerr << "usage: benchmark insert|scan|find|keys|count|compress|arena|pool|memory|catalog|epoch|upsert"
+                     "|alloc|sort|verify [n]\n";
+        return 1;
+    }
+
+    int n = argc > 2 ? atoi(argv[2]) : 2000000;
+
+    mkdir("bench_data", 0755);
+    if (chdir("bench_data") != 0) {
+        std::cerr << "cannot enter bench_data\n";
+        return 1;
+    }
+
+    if (strcmp(argv[1], "insert") == 0)
+        bench_insert(n);
+    else if (strcmp(argv[1], "scan") == 0)
+        bench_scan(n);
+    else if (strcmp(argv[1], "find") == 0)
+        bench_find(n);
+    else if (strcmp(argv[1], "keys") == 0)
+        bench_keys(n);
+    else if (strcmp(argv[1], "count") == 0)
+        bench_count(n);
+    else if (strcmp(argv[1], "compress") == 0)
+        bench_compress(n);
+    else if (strcmp(argv[1], "arena") == 0)
+        bench_arena(n);
+    else if (strcmp(argv[1], "pool") == 0)
+        bench_pool(n);
+    else if (strcmp(argv[1], "memory") == 0)
+        bench_memory(n);
+    else if (strcmp(argv[1], "catalog") == 0)
+        bench_catalog(n);
+    else if (strcmp(argv[1], "epoch") == 0)
+        bench_epoch(n);
+    else if (strcmp(argv[1], "upsert") == 0)
+        bench_upsert(n);
+    else if (strcmp(argv[1], "alloc") == 0)
+        bench_alloc(n);
+    else if (strcmp(argv[1], "sort") == 0)
+        bench_sort(n);
+    else if (strcmp(argv[1], "verify") == 0)
+        bench_verify(n);
+    else {
+        std::cerr << "unknown case " << argv[1] << '\n';
+        return 1;
+    }
+
+    return 0;
+}
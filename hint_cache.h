@@ -0,0 +1,100 @@
+#ifndef BPT_HINT_CACHE_H
+#define BPT_HINT_CACHE_H
+
+/*
+ * direct-mapped table from key hash to the leaf a descent ended at
+ * entries are never trusted blindly: the caller checks the page version and the key range
+ */
+
+class HintCache {
+
+    struct Entry {
+        int key;
+        int file_pos;
+        int version;
+    };
+
+    Entry *entries;
+    unsigned mask;
+
+    unsigned slot(int key) const {
+        return ((unsigned) key * 2654435761u) & mask;
+    }
+
+public:
+
+    long long hits, stale, misses;
+
+    HintCache() : entries(nullptr), mask(0), hits(0), stale(0), misses(0) {}
+
+    HintCache(const HintCache &) = delete;
+
+    HintCache &operator=(const HintCache &) = delete;
+
+    ~HintCache() {
+        delete[] entries;
+    }
+
+    void resize(long long budget) {
+
+        // budget in bytes, rounded down to a power of two number of entries
+
+        delete[] entries;
+        entries = nullptr;
+        mask = 0;
+
+        long long capacity = 1;
+        while (capacity * 2 * (long long) sizeof(Entry) <= budget)
+            capacity *= 2;
+        if (capacity * (long long) sizeof(Entry) > budget)
+            return;
+
+        entries = new Entry[capacity];
+        for (long long i = 0; i < capacity; ++i)
+            entries[i].key = -1;
+        mask = capacity - 1;
+    }
+
+    bool enabled() const {
+        return entries != nullptr;
+    }
+
+    long long memory() const {
+        return entries ? (long long) (mask + 1) * sizeof(Entry) : 0;
+    }
+
+    bool find(int key, int &file_pos, int &version) {
+        Entry &entry = entries[slot(key)];
+        if (entry.key != key) {
+            ++misses;
+            return false;
+        }
+        file_pos = entry.file_pos;
+        version = entry.version;
+        return true;
+    }
+
+    void update(int key, int file_pos, int version) {
+        Entry &entry = entries[slot(key)];
+        entry.key = key;
+        entry.file_pos = file_pos;
+        entry.version = version;
+    }
+
+    void clear() {
+
+        // forgets every hint, for when file positions stop naming the pages they did
+
+        if (entries)
+            for (unsigned i = 0; i <= mask; ++i)
+                entries[i].key = -1;
+    }
+
+    void erase(int key) {
+        Entry &entry = entries[slot(key)];
+        if (entry.key == key)
+            entry.key = -1;
+    }
+};
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef BPT_KEY_CODEC_H
+#define BPT_KEY_CODEC_H
+
+#include <cstring>
+#include <climits>
+#include <limits>
+#include "utils/hash.h"
+
+/*
+ * a codec maps a (key, value) pair onto the Index the tree orders its entries by
+ * all entries of one key lie in [first(key), last(first(key))], Stored is the part of the key kept next to the index
+ * when different keys can share an index range, match() tells them apart and exact_index is false
+ */
+
+template<typename Key, typename Value>
+class KeyCodec {
+
+    // integral keys: ordered by key then value, the index alone identifies an entry
+
+public:
+
+    struct Index {
+        Key key;
+        Value value;
+
+        bool operator<(const Index &other) const {
+            if (key != other.key)
+                return key < other.key;
+            return value < other.value;
+        }
+
+        bool operator==(const Index &other) const {
+            return key == other.key && value == other.value;
+        }
+    };
+
+    struct Stored {};
+
+    static constexpr bool exact_index = true;
+
+    static Index index(Key key, Value value) {
+        return Index{key, value};
+    }
+
+    static Key key(const Index &index, const Stored &) {
+        return index.key;
+    }
+
+    static Index first(Key key) {
+        return Index{key, std::numeric_limits<Value>::lowest()};
+    }
+
+    static Index last(const Index &first) {
+        return Index{first.key, std::numeric_limits<Value>::max()};
+    }
+
+    static bool same_key(const Index &a, const Index &b) {
+        return a.key == b.key;
+    }
+
+    static Value value(const Index &index) {
+        return index.value;
+    }
+
+    static Index min_index() {
+        return Index{std::numeric_limits<Key>::lowest(), std::numeric_limits<Value>::lowest()};
+    }
+
+    static Index max_index() {
+        return Index{std::numeric_limits<Key>::max(), std::numeric_limits<Value>::max()};
+    }
+
+    static void store(Stored &, Key) {}
+
+    static bool match(Key, const Stored &) {
+        return true;
+    }
+
+    static bool match(const Stored &, const Stored &) {
+        return true;
+    }
+
+    static int hint(Key key) {
+        unsigned long long mixed = (unsigned long long) key * 0x9e3779b97f4a7c15ull;
+        return (int) (mixed >> 32);
+    }
+};
+
+template<>
+class KeyCodec<const char *, int> {
+
+    // string keys: hash << 32 + value, so a key's entries are contiguous and hash collisions are settled by strcmp
+
+public:
+
+    typedef long long Index;
+
+    struct Stored {
+        char str[65];
+    };
+
+    static constexpr bool exact_index = false;
+
+    static Index index(const char *key, int value) {
+        return ((long long) hash(key) << 32) + value;
+    }
+
+    static const char *key(const Index &, const Stored &stored) {
+        return stored.str;
+    }
+
+    static Index first(const char *key) {
+        return (long long) hash(key) << 32;
+    }
+
+    static Index last(const Index &first) {
+        return first + UINT_MAX;
+    }
+
+    static bool same_key(const Index &a, const Index &b) {
+        return a >> 32 == b >> 32;
+    }
+
+    static int value(const Index &index) {
+        return (int) index;
+    }
+
+    static Index min_index() {
+        return LLONG_MIN;
+    }
+
+    static Index max_index() {
+        return LLONG_MAX;
+    }
+
+    static void store(Stored &stored, const char *key) {
+        strcpy(stored.str, key);
+    }
+
+    static bool match(const char *key, const Stored &stored) {
+        return strcmp(key, stored.str) == 0;
+    }
+
+    static bool match(const Stored &a, const Stored &b) {
+        return strcmp(a.str, b.str) == 0;
+    }
+
+    static int hint(const char *key) {
+        return hash(key);
+    }
+};
+
+#endif
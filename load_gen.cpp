@@ -0,0 +1,190 @@
+/*
+ *  load generator for server.cpp
+ *  usage: load_gen [--port=N | --unix=path] [--connections=C] [--depth=D] [--requests=R] [--keys=K] [--finds=P]
+ *  every connection sends batches of D pipelined requests, P percent finds and the rest split between
+ *  inserts and deletes, each batch ending with a find; it waits for the batch's replies before the next one
+ */
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "utils/vector.h"
+#include "utils/qsort.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+    int port = 7070;
+    const char *unix_path = nullptr;
+    int connections = 4, depth = 32, keys = 100000, finds = 50;
+    long long requests = 1000000;
+};
+
+struct Result {
+    long long requests = 0, replies = 0;
+    bool failed = false;
+    Vector<double> latency; // microseconds per batch
+};
+
+int connect_server(const Options &options) {
+    int fd;
+    if (options.unix_path) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, options.unix_path, sizeof(addr.sun_path) - 1);
+        if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+            return -1;
+    }
+    else {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(options.port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+            return -1;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+bool send_all(int fd, const char *buffer, size_t size) {
+    while (size) {
+        ssize_t written = write(fd, buffer, size);
+        if (written <= 0)
+            return false;
+        buffer += written;
+        size -= written;
+    }
+    return true;
+}
+
+void run_connection(const Options &options, int id, long long requests, Result &result) {
+    int fd = connect_server(options);
+    if (fd < 0) {
+        result.failed = true;
+        return;
+    }
+
+    std::mt19937 rng(20240701 + id);
+    std::string batch;
+    char line[96], reply[1 << 16];
+
+    while (result.requests < requests) {
+        int batch_size = requests - result.requests < options.depth ? (int) (requests - result.requests) : options.depth;
+        int expected = 0;
+        batch.clear();
+        for (int i = 0; i < batch_size; ++i) {
+            int key = rng() % options.keys;
+            int dice = rng() % 100;
+            if (dice < options.finds || i == batch_size - 1) {
+                sprintf(line, "find key-%d\n", key);
+                ++expected;
+            }
+            else if ((dice - options.finds) % 4 != 3)
+                sprintf(line, "insert key-%d %d\n", key, (int) (rng() % 1000000));
+            else
+                sprintf(line, "delete key-%d %d\n", key, (int) (rng() % 1000000));
+            batch += line;
+        }
+
+        Clock::time_point start = Clock::now();
+        if (!send_all(fd, batch.data(), batch.size())) {
+            result.failed = true;
+            break;
+        }
+        while (expected) {
+            ssize_t got = read(fd, reply, sizeof(reply));
+            if (got <= 0) {
+                result.failed = true;
+                break;
+            }
+            for (ssize_t i = 0; i < got; ++i)
+                if (reply[i] == '\n')
+                    --expected, ++result.replies;
+        }
+        if (result.failed)
+            break;
+        result.latency.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+        result.requests += batch_size;
+    }
+    close(fd);
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--port=", 7) == 0)
+            options.port = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--unix=", 7) == 0)
+            options.unix_path = argv[i] + 7;
+        else if (strncmp(argv[i], "--connections=", 14) == 0)
+            options.connections = atoi(argv[i] + 14);
+        else if (strncmp(argv[i], "--depth=", 8) == 0)
+            options.depth = atoi(argv[i] + 8);
+        else if (strncmp(argv[i], "--requests=", 11) == 0)
+            options.requests = atoll(argv[i] + 11);
+        else if (strncmp(argv[i], "--keys=", 7) == 0)
+            options.keys = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--finds=", 8) == 0)
+            options.finds = atoi(argv[i] + 8);
+    }
+    if (options.connections < 1)
+        options.connections = 1;
+    if (options.depth < 1)
+        options.depth = 1;
+    if (options.keys < 1)
+        options.keys = 1;
+
+    Result *results = new Result[options.connections];
+    std::thread *threads = new std::thread[options.connections];
+
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < options.connections; ++i) {
+        long long share = options.requests / options.connections + (i < options.requests % options.connections);
+        threads[i] = std::thread(run_connection, std::cref(options), i, share, std::ref(results[i]));
+    }
+    for (int i = 0; i < options.connections; ++i)
+        threads[i].join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    long long requests = 0, replies = 0;
+    Vector<double> latency;
+    bool failed = false;
+    for (int i = 0; i < options.connections; ++i) {
+        requests += results[i].requests;
+        replies += results[i].replies;
+        failed |= results[i].failed;
+        for (int j = 0; j < results[i].latency.size(); ++j)
+            latency.push_back(results[i].latency[j]);
+    }
+    if (latency.size())
+        qsort(&latency[0], &latency[0] + latency.size());
+
+    std::cout << requests << " requests (" << replies << " replies) over " << options.connections
+              << " connections, depth " << options.depth << ": " << (long long) (requests / elapsed) << " requests/s\n";
+    if (latency.size())
+        std::cout << "batch latency: p50 " << latency[latency.size() / 2] << " us, p99 "
+                  << latency[(int) (latency.size() * 0.99)] << " us, max " << latency[latency.size() - 1] << " us\n";
+    if (failed)
+        std::cerr << "some connections failed\n";
+
+    delete[] results;
+    delete[] threads;
+    return failed ? 1 : 0;
+}
@@ -6,36 +6,142 @@
 
 #include <iostream>
 #include <cstring>
-#include "b_plus_tree.h"
+#include <cstdlib>
+#include <chrono>
+#include "tree_flags.h"
 #include "utils/fast_read.h"
+#include "utils/trace.h"
 
-int main() {
+int main(int argc, char **argv) {
     std::ios::sync_with_stdio(false);
 
     int n;
     char key[65];
     int value;
+    bool print_stats = false, publish = false;
+    const char *record_path = nullptr;
+
+    // consecutive finds are collected and answered together by find_batch
+    int batch_limit = 0, batch_size = 0;
+    char (*batch_keys)[65] = nullptr;
+    const char **batch_ptrs = nullptr;
+
+    // a replica, a memory-only or a catalog tree is opened as one, so these flags are looked at before the tree exists
+    TreeFlags flags;
+    read_open_flags(argc, argv, flags);
+    BPlusTree::Catalog *catalog;
+    BPlusTree *tree = open_flagged_tree(flags, catalog);
+    if (!tree)
+        return 1;
+    BPlusTree &bpt = *tree;
+
+    for (int i = 1; i < argc; ++i) {
+        if (apply_tree_flag(bpt, argv[i], flags))
+            continue;
+        if (strncmp(argv[i], "--find-batch=", 13) == 0)
+            batch_limit = atoi(argv[i] + 13);
+        else if (strcmp(argv[i], "--publish") == 0)
+            publish = true;
+        else if (strncmp(argv[i], "--record=", 9) == 0)
+            record_path = argv[i] + 9;
+        else if (strcmp(argv[i], "--stats") == 0)
+            print_stats = true;
+    }
+    apply_pool_flags(bpt, flags);
+
+    if (batch_limit > 1) {
+        batch_keys = new char[batch_limit][65];
+        batch_ptrs = new const char *[batch_limit];
+        for (int i = 0; i < batch_limit; ++i)
+            batch_ptrs[i] = batch_keys[i];
+    }
+    else
+        batch_limit = 0;
+
+    // --record: every command goes to a binary trace as it arrives, with its time since the one before, for tool replay
+    TraceWriter *trace = record_path ? new TraceWriter(record_path) : nullptr;
+    if (trace && !trace->opened())
+        std::cerr << "cannot record to " << record_path << '\n';
+    std::chrono::steady_clock::time_point last_command = std::chrono::steady_clock::now();
+    auto record = [&](int op, const char *record_key, int record_value) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        trace->write(op, std::chrono::duration_cast<std::chrono::microseconds>(now - last_command).count(),
+                     record_key, record_value);
+        last_command = now;
+    };
 
-    BPlusTree bpt(false);
     n = read_int();
 
     for (int i = 0; i < n; ++i) {
         read_str(key);
+        if (batch_size && (strcmp(key, "find") != 0 || batch_size == batch_limit)) {
+            bpt.find_batch(batch_ptrs, batch_size);
+            batch_size = 0;
+        }
         if (strcmp(key, "insert") == 0) {
             read_str(key);
             value = read_int();
+            if (trace)
+                record(trace_insert, key, value);
             bpt.insert(key, value);
         }
         else if (strcmp(key, "delete") == 0) {
             read_str(key);
             value = read_int();
+            if (trace)
+                record(trace_delete, key, value);
             bpt.remove(key, value);
         }
+        else if (strcmp(key, "find") == 0 && batch_limit) {
+            read_str(batch_keys[batch_size]);
+            if (trace)
+                record(trace_find, batch_keys[batch_size], 0);
+            ++batch_size;
+        }
         else if (strcmp(key, "find") == 0) {
             read_str(key);
+            if (trace)
+                record(trace_find, key, 0);
             bpt.print_value(key);
         }
         else
             --i;
     }
+
+    if (batch_size)
+        bpt.find_batch(batch_ptrs, batch_size);
+    delete[] batch_keys;
+    delete[] batch_ptrs;
+    delete trace;
+
+    if (publish && !bpt.publish())
+        std::cerr << "publish failed\n";
+    if (flags.memory && !bpt.persist())
+        std::cerr << "cannot write the tree files\n";
+
+    if (print_stats) {
+        BPlusTree::Stats stats = bpt.stats(true);
+        std::cerr << "hint cache: " << stats.hint_hits << " hits, " << stats.hint_stale << " stale, "
+                  << stats.hint_misses << " misses, " << stats.hint_memory << " bytes\n";
+        std::cerr << "pages: " << stats.leaf_pages << " leaves at " << stats.leaf_fill * 100 << "% fill, "
+                  << stats.internal_pages << " internal at " << stats.internal_fill * 100 << "% fill, "
+                  << stats.append_fast_path << " fast appends\n";
+        std::cerr << "lazy deletes: " << stats.sparse_queued << " leaves queued, "
+                  << stats.compacted_leaves << " compacted\n";
+        std::cerr << "writer: " << stats.flushed_pages << " pages flushed in " << stats.write_calls << " writes, "
+                  << stats.flush_stalls << " stalls\n";
+        std::cerr << "read-ahead: " << stats.prefetch_issued << " pages prefetched, " << stats.prefetch_used << " used, "
+                  << stats.prefetch_wasted << " dropped\n";
+        std::cerr << "disk: " << stats.disk_bytes << " bytes on disk, " << stats.written_bytes << " bytes written, "
+                  << (stats.flushed_pages ? stats.compress_ns / stats.flushed_pages : 0) << " ns compressing a page, "
+                  << (stats.decompressed_pages ? stats.decompress_ns / stats.decompressed_pages : 0)
+                  << " ns decompressing one\n";
+        const char *frame_pages[3] = {"small pages", "transparent huge pages", "explicit huge pages"};
+        std::cerr << "frames: " << frame_pages[stats.frame_huge_pages]
+                  << (stats.frame_numa_placed ? ", NUMA placed\n" : ", default NUMA policy\n");
+        std::cerr << "pool: " << stats.pool_bytes << " bytes, " << stats.resident_bytes << " resident, "
+                  << stats.pool_resizes << " resizes\n";
+    }
+    delete tree;
+    delete catalog;
 }
@@ -0,0 +1,199 @@
+#ifndef BPT_NODE_POOL_H
+#define BPT_NODE_POOL_H
+
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include "utils/vector.h"
+
+/*
+ * the pages of a tree that lives in memory only: nodes sit in page sized frames carved out of slabs, and a page
+ * number maps straight to its frame, with no cache, eviction or (de)serialization on the way
+ * a freed number keeps its frame for the allocation that takes it again, so frames are never returned before the pool
+ * goes; snapshot() writes the pages in the page manager's uncompressed format, which a disk backed tree opens
+ */
+
+template<typename data_type, int page_size>
+class NodePool {
+
+    typedef int FilePos;
+
+    static constexpr int slab_frames = 256;
+    static constexpr int frame_stride = (page_size + 63) / 64 * 64; // frames start on cache lines
+    static constexpr int write_batch = 64; // pages per write of a snapshot
+
+    Vector<char *> slabs;
+    int frames_taken; // frame k is the k % slab_frames of slab k / slab_frames, reserve() may add slabs ahead
+
+    Vector<char *> page_frame; // FilePos -> frame
+    Vector<int> page_version; // bumped whenever a page is freed or reallocated
+    Vector<FilePos> recycle;
+
+    void add_slab() {
+        slabs.push_back(static_cast<char *>(::operator new[]((size_t) frame_stride * slab_frames,
+                                                             std::align_val_t(64))));
+    }
+
+    char *take_frame() {
+        if (frames_taken == slabs.size() * slab_frames)
+            add_slab();
+        char *frame = slabs[frames_taken / slab_frames] + (long long) frame_stride * (frames_taken % slab_frames);
+        ++frames_taken;
+        return frame;
+    }
+
+    static bool write_all(int fd, const char *buffer, long long size, long long offset) {
+        while (size > 0) {
+            ssize_t written = pwrite(fd, buffer, size, offset);
+            if (written <= 0)
+                return false;
+            buffer += written;
+            offset += written;
+            size -= written;
+        }
+        return true;
+    }
+
+public:
+
+    NodePool() : frames_taken(0) {}
+
+    NodePool(const NodePool &) = delete;
+
+    NodePool &operator=(const NodePool &) = delete;
+
+    ~NodePool() {
+        reset();
+    }
+
+    template<typename alloc_type>
+    FilePos alloc_page() {
+        FilePos alloc_pos;
+        if (recycle.size()) {
+            alloc_pos = recycle.back();
+            recycle.pop_back();
+        }
+        else {
+            alloc_pos = page_frame.size();
+            page_frame.push_back(take_frame());
+            page_version.push_back(0);
+        }
+        ++page_version[alloc_pos];
+        new(page_frame[alloc_pos]) alloc_type;
+        return alloc_pos;
+    }
+
+    void free_page(FilePos file_pos) {
+        ++page_version[file_pos];
+        recycle.push_back(file_pos);
+    }
+
+    char *operator[](FilePos file_pos) const {
+        return page_frame[file_pos];
+    }
+
+    int version(FilePos file_pos) const {
+        return file_pos < page_version.size() ? page_version[file_pos] : 0;
+    }
+
+    FilePos page_count() const {
+        return page_frame.size();
+    }
+
+    void free_list(Vector<FilePos> &result) const {
+        result.resize(recycle.size());
+        for (int i = 0; i < recycle.size(); ++i)
+            result[i] = recycle[i];
+    }
+
+    void reserve(FilePos pages) {
+
+        // frames and page tables for that many pages up front, so growing to them allocates nothing
+
+        while (slabs.size() * slab_frames < pages)
+            add_slab();
+        page_frame.reserve(pages);
+        page_version.reserve(pages);
+        recycle.reserve(pages);
+    }
+
+    long long pool_bytes() const {
+        return (long long) slabs.size() * slab_frames * frame_stride;
+    }
+
+    long long resident_bytes() const {
+        return (long long) (page_frame.size() - recycle.size()) * page_size;
+    }
+
+    void restore(FilePos count, const Vector<FilePos> &free_pages) {
+
+        // frames for pages 0 .. count - 1 of a stored tree, the caller deserializes into all but free_pages
+
+        reset();
+        page_frame.resize(count);
+        page_version.resize(count);
+        for (FilePos i = 0; i < count; ++i) {
+            page_frame[i] = take_frame();
+            page_version[i] = 0;
+        }
+        for (int i = 0; i < free_pages.size(); ++i)
+            recycle.push_back(free_pages[i]);
+    }
+
+    void reset() {
+        for (int i = 0; i < slabs.size(); ++i)
+            ::operator delete[](slabs[i], std::align_val_t(64));
+        slabs.resize(0);
+        frames_taken = 0;
+        page_frame.resize(0);
+        page_version.resize(0);
+        recycle.resize(0);
+    }
+
+    bool snapshot(const std::string &data_path, const std::string &info_path) {
+
+        // free pages are written as zeros, like a page the file never held
+
+        FilePos count = page_frame.size();
+        char *free_mark = new char[count ? count : 1]();
+        for (int i = 0; i < recycle.size(); ++i)
+            free_mark[recycle[i]] = 1;
+
+        int fd = open(data_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool good = fd >= 0;
+        char *staging = new char[(long long) page_size * write_batch];
+        for (FilePos first = 0; good && first < count; first += write_batch) {
+            int batch = count - first < write_batch ? count - first : write_batch;
+            memset(staging, 0, (long long) page_size * batch);
+            for (int i = 0; i < batch; ++i)
+                if (!free_mark[first + i])
+                    data_type::serialize(staging + (long long) page_size * i,
+                                         reinterpret_cast<data_type *>(page_frame[first + i]));
+            good = write_all(fd, staging, (long long) page_size * batch, (long long) page_size * first);
+        }
+        delete[] staging;
+        if (fd >= 0) {
+            good = fdatasync(fd) == 0 && good;
+            close(fd);
+        }
+
+        if (good) {
+            std::fstream info_file(info_path, std::fstream::out | std::fstream::trunc | std::fstream::binary);
+            int recycle_size = recycle.size(), compressed_flag = 0;
+            info_file.write(reinterpret_cast<char *>(&count), sizeof(int));
+            info_file.write(reinterpret_cast<char *>(&recycle_size), sizeof(int));
+            for (int i = 0; i < recycle_size; ++i)
+                info_file.write(reinterpret_cast<const char *>(&recycle[i]), sizeof(int));
+            info_file.write(reinterpret_cast<char *>(&compressed_flag), sizeof(int));
+            good = info_file.good();
+        }
+
+        delete[] free_mark;
+        return good;
+    }
+};
+
+#endif
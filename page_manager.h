@@ -3,11 +3,29 @@
 
 #include <fstream>
 #include <cstring>
+#include <climits>
+#include <new>
 #include <utility>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <random>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include "utils/vector.h"
 #include "utils/qsort.h"
+#include "utils/sort.h"
 #include "utils/pair.h"
 #include "utils/heap.h"
+#include "utils/lz.h"
+#include "utils/frame_arena.h"
+#include "utils/phase_profiler.h"
+#include "utils/epoch.h"
 
 template<typename data_type, int page_size, int cache_limit>
 class PageManager {
@@ -45,14 +63,20 @@ class PageManager {
 
         static constexpr int PRIORITY_LIMIT = 1073741824;
 
-        static bool comp_priority(const Pair<int, CacheElement> &a, const Pair<int, CacheElement> &b) {
-            return a.second.priority < b.second.priority;
-        }
-
         void discretize_priority() {
-            qsort(data, data + pos, comp_priority);
-            for (int i = 0; i < pos; ++i)
+
+            // priorities are distinct and non-negative, so a radix sort on them takes four passes at most; sorted
+            // is a valid heap, only key_map has to follow the entries
+
+            Pair<int, CacheElement> *buffer = new Pair<int, CacheElement>[pos];
+            radix_sort(data, data + pos, buffer, [](const Pair<int, CacheElement> &entry) {
+                return radix_order(entry.second.priority);
+            });
+            delete[] buffer;
+            for (int i = 0; i < pos; ++i) {
                 data[i].second.priority = i;
+                key_map[data[i].first] = i;
+            }
             max_priority = pos - 1;
         }
 
@@ -72,6 +96,12 @@ class PageManager {
             return data[index].second.mem_pos;
         }
 
+        void relocate(FilePos key, MemoryPos mem_pos) {
+            int index = key_map[key];
+            if (index != -1)
+                data[index].second.mem_pos = mem_pos;
+        }
+
         void reset_priority(FilePos key) {
             int index = key_map[key];
             if (index == -1)
@@ -92,170 +122,2061 @@ class PageManager {
 
     };
 
+    /*
+     * a resident frame is in exactly one of these states:
+     * cached frames are ordered by cache_heap, pinned frames bypass it,
+     * clean frames are cold and already on disk, so they can be reused without a write,
+     * writing frames belong to the batch the writer thread is flushing
+     */
+
+    static constexpr char frame_cached = 0, frame_pinned = 1, frame_clean = 2, frame_writing = 3;
+
+    // cache_limit is the pool a manager opens with, resize_frames() changes it at runtime
+    static constexpr int flush_batch = cache_limit / 32 ? cache_limit / 32 : 1; // the writer's largest batch
+    static constexpr int min_frames = 64;
+
+    // a read-only manager keeps few frames of its own, the pages themselves are shared through the kernel's cache
+    static constexpr int replica_frames = cache_limit >= 1024 ? cache_limit / 8 : cache_limit;
+
+    // frames start on 512 byte boundaries, which covers cache lines and O_DIRECT transfers
+    static constexpr long long frame_stride = (page_size + 511) / 512 * 512;
+
     CacheHeap cache_heap;
 
     Heap<FilePos> recycle_heap;
 
     FilePos file_size;
 
-    std::fstream data_file;
+    int data_fd;
 
     std::string data_path, info_path;
 
-    char *pages;
+    // read-only managers serve a published snapshot straight from a shared mapping and never write
+    bool read_only;
+    const char *mapped;
+    long long mapped_size;
 
-public:
+    // frame_limit frames are in the pool, frame_reserved are mapped and tracked, so growing up to them costs nothing
+    int frame_limit, frame_reserved;
 
-    PageManager(const std::string &data_path, const std::string &info_path) :
-            data_path(data_path), info_path(info_path) {
+    FrameArena arena;
+    int arena_huge, arena_numa;
+    char *pages, *read_buffer, *staging;
 
-        std::fstream info_file(
-                info_path,
-                std::fstream::in | std::fstream::binary
-        );
+    Vector<MemoryPos> page_frame; // FilePos -> frame, -1 when not resident
+    Vector<int> pin_count;
+    Vector<int> page_version; // bumped whenever a page is freed or reallocated
 
-        if (info_file.is_open()) {
+    Vector<FilePos> frame_page;
+    Vector<char> frame_state;
+    Vector<char> frame_dirty;
 
-            info_file.read(reinterpret_cast<char *>(&file_size), sizeof(int));
+    Vector<MemoryPos> free_frames;
+    int frame_count, pinned_frames;
 
-            int recycle_size;
-            info_file.read(reinterpret_cast<char *>(&recycle_size), sizeof(int));
-            int *recycle_arr = new int[recycle_size];
-            info_file.read(reinterpret_cast<char *>(recycle_arr), (long long) sizeof(int) * recycle_size);
-            for (int i = 0; i < recycle_size; ++i)
-                recycle_heap.push(recycle_arr[i]);
-            delete[] recycle_arr;
+    /*
+     * with an EpochManager attached, freed page numbers and frames let go of wait here under the epoch they were
+     * retired in, oldest first, until no reader on another thread can still be looking at them; an eviction keeps
+     * retire_slack frames waiting, so the one it takes was retired a while ago and seldom has to wait
+     */
 
-            info_file.close();
+    static constexpr int retire_slack = 8;
+
+    EpochManager *epochs;
+    Vector<Pair<long long, FilePos>> retired_pages;
+    Vector<Pair<long long, MemoryPos>> retired_frames;
+    int retired_page_head, retired_frame_head;
+
+    /*
+     * backups: a page written to the file is marked in changed_pages until a backup has taken it; the map is kept in
+     * changes_path while the manager is closed and removed while it is open, so after a crash the next backup is a
+     * full one
+     * a backup starts at a checkpoint with the free list and the marked pages (every page for a full one) as of then,
+     * and streams them backup_step() by backup_step(); a page it has yet to stream that is about to be written has
+     * its stored image copied aside first, so the stream holds the file as it was when the backup started
+     */
+
+    static constexpr char backup_magic[8] = {'B', 'P', 'T', 'B', 'K', 'U', 'P', '1'};
+    static constexpr int full_backup = 0, incremental_backup = 1;
+
+    std::string changes_path; // empty for a manager that keeps no map
+    Vector<unsigned long long> changed_pages; // a bit per FilePos
+    bool changes_known; // the map covers everything since the last backup of backup_lineage
+    long long backup_lineage, backup_seq; // the chain of the last backup that completed, and its place in it
+
+    int backup_fd; // -1 while no backup runs
+    std::string backup_path;
+    int backup_kind;
+    long long backup_next_lineage, backup_next_seq, backup_records;
+    Vector<char> backup_pending; // FilePos -> still to be streamed
+    Vector<unsigned long long> backup_pages; // the pages the running backup took, marked again if it fails
+    FilePos backup_cursor;
+    long long backup_left;
+    Vector<FilePos> saved_pos; // pages copied aside, their images in saved_images
+    Vector<char> saved_images;
+    Vector<char> backup_out;
+
+    // clean frames form a list, oldest first, so a miss takes the coldest one
+
+    Vector<MemoryPos> clean_prev, clean_next;
+    MemoryPos clean_head, clean_tail;
+    int clean_count;
+
+    /*
+     * dirty_count counts dirty frames in cache_heap only, pinned ones are written at shutdown
+     * the writer starts once it passes dirty_limit, and a miss waits for it past throttle_limit
+     */
+
+    int dirty_count, dirty_limit, throttle_limit;
+    double dirty_ratio;
+
+    // both follow the pool size: the clean frames kept ready for misses, and the writer's batch
+    int clean_target, batch_frames;
+
+    /*
+     * auto-sizing: over every review_window accesses that compete for frames, a miss rate above target_miss_rate
+     * grows the pool by a quarter, and calm_windows windows in a row under an eighth of it give an eighth back;
+     * never past pool_budget bytes, pinned frames skip the count as they never miss
+     */
+
+    static constexpr int review_window = 1 << 14, calm_windows = 4;
+
+    long long pool_budget;
+    double target_miss_rate;
+    long long window_accesses, window_misses, pool_resizes;
+    int calm_count;
+
+    // page reads and waits for the writer on the calling thread are charged to io_phase while a profiler is attached
+    PhaseProfiler *profiler;
+    int io_phase;
+
+    // the batch is owned by the writer between start_batch and harvest
+
+    Pair<FilePos, MemoryPos> *batch;
+    int batch_size;
+    bool batch_busy, batch_pending, writer_stop;
+    std::atomic<bool> batch_done;
+    std::mutex writer_lock;
+    std::condition_variable writer_signal;
+    std::thread writer_thread;
+
+    std::atomic<long long> flushed_pages, write_calls;
+    long long flush_stalls;
+
+    /*
+     * read-ahead: prefetch() hands a page to the reader threads, which read its image into a slot
+     * a later miss on the page deserializes from the slot instead of reading the file
+     * depth grows while staged pages get used and halves whenever one is dropped unused
+     */
+
+    static constexpr int prefetch_slots = 64, prefetch_threads = 4;
+
+    char *prefetch_pages;
+    Vector<int> page_slot; // FilePos -> slot, -1 when not staged
+    FilePos slot_page[prefetch_slots]; // -1 for a free or cancelled slot
+    FilePos slot_read[prefetch_slots]; // what the reader reads, fixed while the read is in flight
+    long long slot_stamp[prefetch_slots];
+    std::atomic<bool> slot_ready[prefetch_slots];
+    long long prefetch_clock;
+
+    int prefetch_queue[prefetch_slots];
+    int queue_head, queue_size;
+    bool prefetch_stop;
+    std::mutex prefetch_lock;
+    std::condition_variable prefetch_signal, prefetch_done;
+    std::thread prefetch_thread[prefetch_threads];
+
+    int depth_limit, depth, depth_credit;
+    long long prefetch_issued, prefetch_used, prefetch_wasted;
+
+    /*
+     * compression: a page is stored LZ compressed in a slot of whole slot_units, page_place says where,
+     * a rewrite that needs another slot size moves the page and hands the old slot to the free list of its size
+     * the writer assigns slots while readers look them up, both under place_lock
+     */
+
+    static constexpr int slot_unit = page_size / 16 ? page_size / 16 : 1, slot_classes = page_size / slot_unit;
+
+    struct Placement {
+        int offset; // in slot units, -1 for a page never written
+        int length; // compressed bytes, page_size for a page stored as is
+    };
+
+    bool compressed;
+    Vector<Placement> page_place;
+    Vector<int> free_places[slot_classes + 1]; // by slot size in units
+    int place_end;
+    std::mutex place_lock;
+    char *compress_buffer;
+    int *batch_length;
+    Pair<int, int> *batch_offset; // slot offset, batch index
+
+    std::atomic<long long> written_bytes, compress_ns, decompress_ns, decompressed_pages;
+
+    static bool comp_page(const Pair<FilePos, MemoryPos> &a, const Pair<FilePos, MemoryPos> &b) {
+        return a.first < b.first;
+    }
+
+    static bool comp_offset(const Pair<int, int> &a, const Pair<int, int> &b) {
+        return a.first < b.first;
+    }
+
+    static int place_units(int length) {
+        return (length + slot_unit - 1) / slot_unit;
+    }
+
+    static long long nanoseconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    int assign_place(FilePos file_pos, int length) {
+
+        // called with place_lock held, a page keeps its slot while the size in units does not change
+
+        while (page_place.size() <= file_pos)
+            page_place.push_back(Placement{-1, 0});
+        Placement &place = page_place[file_pos];
+        int units = place_units(length);
+        if (place.offset != -1 && place_units(place.length) == units) {
+            place.length = length;
+            return place.offset;
+        }
+
+        if (place.offset != -1)
+            free_places[place_units(place.length)].push_back(place.offset);
+        if (free_places[units].size()) {
+            place.offset = free_places[units].back();
+            free_places[units].pop_back();
         }
         else {
-            file_size = 0;
+            place.offset = place_end;
+            place_end += units;
         }
+        place.length = length;
+        return place.offset;
+    }
 
-        pages = new char[page_size * cache_limit];
-        data_file.open(
-                data_path,
-                std::fstream::in | std::fstream::out | std::fstream::binary
-        );
+    void track(FilePos file_pos) {
+        int table_size = page_frame.size();
+        if (file_pos < table_size)
+            return;
 
-        if (!data_file.is_open()) {
-            data_file.clear();
-            data_file.open(
-                    data_path,
-                    std::fstream::out | std::fstream::binary
-            );
-            data_file.close();
-            data_file.open(
-                    data_path,
-                    std::fstream::in | std::fstream::out | std::fstream::binary
-            );
+        page_frame.resize(file_pos + 1);
+        pin_count.resize(file_pos + 1);
+        page_version.resize(file_pos + 1);
+        page_slot.resize(file_pos + 1);
+        recycle_heap.reserve(page_frame.capacity()); // freeing a page then never grows it
+        for (int i = table_size; i <= file_pos; ++i) {
+            page_frame[i] = -1;
+            pin_count[i] = 0;
+            page_version[i] = 0;
+            page_slot[i] = -1;
         }
     }
 
-    ~PageManager() {
+    void mark_dirty(MemoryPos mem_pos) {
+        if (frame_dirty[mem_pos] || read_only)
+            return;
 
-        int recycle_size = recycle_heap.size();
-        int *recycle_arr = new int[recycle_size];
-        memcpy(recycle_arr, recycle_heap.raw(), sizeof(int) * recycle_size);
-        qsort(recycle_arr, recycle_arr + recycle_size);
-        while (recycle_size) {
-            if (recycle_arr[recycle_size - 1] == file_size - 1) {
-                --recycle_size;
-                --file_size;
+        frame_dirty[mem_pos] = 1;
+        if (frame_state[mem_pos] == frame_cached) {
+            ++dirty_count;
+            maintain();
+        }
+    }
+
+    void push_clean(MemoryPos mem_pos) {
+        frame_state[mem_pos] = frame_clean;
+        clean_prev[mem_pos] = clean_tail;
+        clean_next[mem_pos] = -1;
+        if (clean_tail != -1)
+            clean_next[clean_tail] = mem_pos;
+        else
+            clean_head = mem_pos;
+        clean_tail = mem_pos;
+        ++clean_count;
+    }
+
+    void unlink_clean(MemoryPos mem_pos) {
+        if (clean_prev[mem_pos] != -1)
+            clean_next[clean_prev[mem_pos]] = clean_next[mem_pos];
+        else
+            clean_head = clean_next[mem_pos];
+        if (clean_next[mem_pos] != -1)
+            clean_prev[clean_next[mem_pos]] = clean_prev[mem_pos];
+        else
+            clean_tail = clean_prev[mem_pos];
+        --clean_count;
+    }
+
+    int read_at(char *buffer, int size, long long offset) {
+
+        // a read-only manager copies out of its mapping, which costs no system call
+
+        if (mapped) {
+            long long got = mapped_size - offset < size ? mapped_size - offset : size;
+            if (got <= 0)
+                return 0;
+            memcpy(buffer, mapped + offset, got);
+            return got;
+        }
+        ssize_t got = pread(data_fd, buffer, size, offset);
+        return got < 0 ? 0 : got;
+    }
+
+    void read_page(char *buffer, FilePos file_pos) {
+        if (compressed) {
+            read_compressed(buffer, file_pos);
+            return;
+        }
+        int got = read_at(buffer, page_size, (long long) page_size * file_pos);
+        memset(buffer + got, 0, page_size - got);
+    }
+
+    void read_compressed(char *buffer, FilePos file_pos) {
+
+        // runs on the reader threads too, a slot that fails to decode reads as an empty page
+
+        Placement place{-1, 0};
+        {
+            std::lock_guard<std::mutex> lock(place_lock);
+            if (file_pos < page_place.size())
+                place = page_place[file_pos];
+        }
+
+        int size = 0;
+        if (place.offset != -1 && place.length == page_size)
+            size = read_at(buffer, page_size, (long long) slot_unit * place.offset);
+        else if (place.offset != -1) {
+            char packed[page_size];
+            if (read_at(packed, place.length, (long long) slot_unit * place.offset) == place.length) {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                size = lz_decompress(packed, place.length, buffer, page_size);
+                if (size < 0)
+                    size = 0;
+                decompress_ns += nanoseconds_since(start);
+                ++decompressed_pages;
             }
-            else
-                break;
         }
+        memset(buffer + size, 0, page_size - size);
+    }
 
-        std::fstream info_file(
-                info_path,
-                std::fstream::out | std::fstream::trunc | std::fstream::binary
-        );
+    void prefetch_loop() {
+        std::unique_lock<std::mutex> lock(prefetch_lock);
+        while (true) {
+            prefetch_signal.wait(lock, [this] { return queue_size || prefetch_stop; });
+            if (!queue_size)
+                return;
 
-        info_file.write(reinterpret_cast<char *>(&file_size), sizeof(int));
-        info_file.write(reinterpret_cast<char *>(&recycle_size), sizeof(int));
-        info_file.write(reinterpret_cast<char *>(recycle_arr), (long long) sizeof(int) * recycle_size);
+            int slot = prefetch_queue[queue_head];
+            queue_head = (queue_head + 1) % prefetch_slots;
+            --queue_size;
+            lock.unlock();
+            read_page(prefetch_pages + (long long) page_size * slot, slot_read[slot]);
+            lock.lock();
 
-        delete[] recycle_arr;
-        info_file.close();
+            slot_ready[slot].store(true, std::memory_order_release);
+            prefetch_done.notify_all();
+        }
+    }
 
-        Pair<FilePos, CacheElement> top;
-        while (cache_heap.size()) {
-            top = cache_heap.top();
-            cache_heap.pop();
-            data_file.seekp(page_size * top.first);
-            data_type::serialize(data_file, reinterpret_cast<data_type *>(pages + page_size * top.second.mem_pos));
+    int take_slot() {
+
+        // a free slot first, otherwise the oldest staged page nobody asked for is dropped
+
+        int victim = -1;
+        for (int i = 0; i < prefetch_slots; ++i) {
+            if (!slot_ready[i].load(std::memory_order_acquire))
+                continue;
+            if (slot_page[i] == -1)
+                return i;
+            if (victim == -1 || slot_stamp[i] < slot_stamp[victim])
+                victim = i;
         }
 
-        delete[] pages;
-        data_file.close();
+        if (victim != -1) {
+            page_slot[slot_page[victim]] = -1;
+            slot_page[victim] = -1;
+            ++prefetch_wasted;
+            depth = depth > 1 ? depth / 2 : 1;
+            depth_credit = 0;
+        }
+        return victim;
     }
 
-    char *operator[](FilePos file_pos) {
+    void drop_slot(FilePos file_pos) {
 
-        MemoryPos mem_pos = cache_heap[file_pos];
+        // the staged image is stale once the page is freed or reallocated, a read in flight just gets ignored
 
-        if (mem_pos != -1) {
-            cache_heap.reset_priority(file_pos);
+        int slot = page_slot[file_pos];
+        if (slot == -1)
+            return;
+        page_slot[file_pos] = -1;
+        slot_page[slot] = -1;
+    }
+
+    void write_pages(const char *buffer, FilePos file_pos, int count) {
+        long long offset = (long long) page_size * file_pos, remain = (long long) page_size * count;
+        written_bytes += remain;
+        while (remain > 0) {
+            ssize_t written = pwrite(data_fd, buffer, remain, offset);
+            if (written <= 0)
+                break;
+            buffer += written;
+            offset += written;
+            remain -= written;
         }
-        else {
-            if (cache_heap.size() < cache_limit) {
-                mem_pos = cache_heap.size();
+        ++write_calls;
+    }
+
+    void write_gathered(iovec *iov, int count, long long offset) {
+
+        // one pwritev per run of adjacent slots, a short write resumes where it stopped
+
+        for (int i = 0; i < count; ++i)
+            written_bytes += iov[i].iov_len;
+        while (count > 0) {
+            ssize_t written = pwritev(data_fd, iov, count, offset);
+            if (written <= 0)
+                break;
+            offset += written;
+            while (count > 0 && (size_t) written >= iov->iov_len) {
+                written -= iov->iov_len;
+                ++iov;
+                --count;
             }
-            else {
-                Pair<FilePos, CacheElement> top = cache_heap.top();
-                mem_pos = top.second.mem_pos;
-                cache_heap.pop();
-                data_file.seekp(page_size * top.first);
-                data_type::serialize(data_file, reinterpret_cast<data_type *>(pages + page_size * mem_pos));
+            if (count > 0) {
+                iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+                iov->iov_len -= written;
             }
+        }
+        ++write_calls;
+    }
 
-            data_file.seekg(page_size * file_pos);
-            data_type::deserialize(data_file, pages + page_size * mem_pos);
-            if (data_file.eof())
-                data_file.clear();
-            cache_heap.insert(file_pos, mem_pos);
+    void write_compressed_batch() {
+
+        // pages are compressed into staging, placed, then written in slot order so neighbouring slots share a write
+
+        for (int i = 0; i < batch_size; ++i) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            char *out = staging + (long long) page_size * i;
+            char *end = data_type::serialize(compress_buffer, reinterpret_cast<data_type *>(frame(batch[i].second)));
+            int length = lz_compress(compress_buffer, end - compress_buffer, out, page_size);
+            if (length < 0 || place_units(length) >= slot_classes) { // no slot size saved, stored as is
+                memcpy(out, compress_buffer, end - compress_buffer);
+                memset(out + (end - compress_buffer), 0, page_size - (end - compress_buffer));
+                length = page_size;
+            }
+            batch_length[i] = length;
+            compress_ns += nanoseconds_since(start);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(place_lock);
+            for (int i = 0; i < batch_size; ++i)
+                batch_offset[i] = Pair<int, int>(assign_place(batch[i].first, batch_length[i]), i);
         }
+        qsort(batch_offset, batch_offset + batch_size, comp_offset);
 
-        return pages + page_size * mem_pos;
+        iovec iov[flush_batch];
+        int run_start = 0;
+        for (int i = 0; i < batch_size; ++i) {
+            int index = batch_offset[i].second;
+            iov[i].iov_base = staging + (long long) page_size * index;
+            iov[i].iov_len = (long long) slot_unit * place_units(batch_length[index]);
+            if (i + 1 < batch_size && i + 1 - run_start < IOV_MAX &&
+                batch_offset[i + 1].first == batch_offset[i].first + place_units(batch_length[index]))
+                continue;
+            write_gathered(iov + run_start, i + 1 - run_start, (long long) slot_unit * batch_offset[run_start].first);
+            run_start = i + 1;
+        }
+        flushed_pages += batch_size;
     }
 
-    template<typename alloc_type>
-    FilePos alloc_page() {
+    void write_batch() {
 
-        FilePos alloc_pos;
-        MemoryPos mem_pos;
+        // batch is sorted by FilePos, so every run of adjacent pages becomes a single write
 
-        if (recycle_heap.size()) {
-            FilePos top = recycle_heap.top();
-            recycle_heap.pop();
-            alloc_pos = top;
+        if (compressed) {
+            write_compressed_batch();
+            return;
         }
-        else
-            alloc_pos = file_size++;
 
-        if (cache_heap.size() < cache_limit) {
-            mem_pos = cache_heap.size();
+        for (int i = 0; i < batch_size; ++i) {
+            char *out = staging + (long long) page_size * i;
+            char *end = data_type::serialize(out, reinterpret_cast<data_type *>(frame(batch[i].second)));
+            memset(end, 0, out + page_size - end);
         }
-        else {
+
+        int run_start = 0;
+        for (int i = 1; i <= batch_size; ++i) {
+            if (i < batch_size && batch[i].first == batch[i - 1].first + 1)
+                continue;
+            write_pages(staging + (long long) page_size * run_start, batch[run_start].first, i - run_start);
+            run_start = i;
+        }
+        flushed_pages += batch_size;
+    }
+
+    void writer_loop() {
+        std::unique_lock<std::mutex> lock(writer_lock);
+        while (true) {
+            writer_signal.wait(lock, [this] { return batch_pending || writer_stop; });
+            if (!batch_pending)
+                return;
+
+            lock.unlock();
+            write_batch();
+            lock.lock();
+
+            batch_pending = false;
+            batch_done.store(true, std::memory_order_release);
+            writer_signal.notify_all();
+        }
+    }
+
+    void start_batch() {
+
+        // takes the coldest frames, clean ones are ready right away and dirty ones go to the writer
+
+        batch_size = 0;
+        for (int scanned = 0; batch_size < batch_frames && scanned < batch_frames * 2 && cache_heap.size(); ++scanned) {
             Pair<FilePos, CacheElement> top = cache_heap.top();
-            mem_pos = top.second.mem_pos;
             cache_heap.pop();
-            data_file.seekp(page_size * top.first);
-            data_type::serialize(data_file, reinterpret_cast<data_type *>(pages + page_size * mem_pos));
+            MemoryPos mem_pos = top.second.mem_pos;
+            if (frame_dirty[mem_pos]) {
+                frame_dirty[mem_pos] = 0;
+                --dirty_count;
+                frame_state[mem_pos] = frame_writing;
+                batch[batch_size++] = Pair<FilePos, MemoryPos>(top.first, mem_pos);
+            }
+            else
+                push_clean(mem_pos);
         }
 
-        new(pages + page_size * mem_pos) alloc_type;
-        cache_heap.insert(alloc_pos, mem_pos);
-        return alloc_pos;
+        if (!batch_size)
+            return;
+
+        qsort(batch, batch + batch_size, comp_page);
+        note_batch();
+        batch_busy = true;
+        batch_done.store(false, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(writer_lock);
+            batch_pending = true;
+        }
+        writer_signal.notify_all();
     }
 
-    void free_page(FilePos file_pos) {
-        recycle_heap.push(file_pos);
+    void harvest() {
+        for (int i = 0; i < batch_size; ++i) {
+            MemoryPos mem_pos = batch[i].second;
+            if (frame_page[mem_pos] == -1) // freed while it was being written
+                release_frame(mem_pos);
+            else
+                push_clean(mem_pos);
+        }
+        batch_size = 0;
+        batch_busy = false;
     }
 
-    FilePos size() {
-        return file_size;
+    void wait_batch() {
+        if (!batch_busy)
+            return;
+
+        if (!batch_done.load(std::memory_order_acquire)) {
+            PhaseScope scope(profiler, io_phase);
+            std::unique_lock<std::mutex> lock(writer_lock);
+            writer_signal.wait(lock, [this] { return batch_done.load(std::memory_order_acquire); });
+        }
+        harvest();
+    }
+
+    void maintain() {
+
+        // nothing needs cleaning until every frame is in use
+
+        if (batch_busy && batch_done.load(std::memory_order_acquire))
+            harvest();
+        if (frame_count < frame_limit || free_frames.size())
+            return;
+
+        if (batch_busy) {
+            if (dirty_count <= throttle_limit)
+                return;
+            ++flush_stalls;
+            wait_batch();
+        }
+
+        if (clean_count < clean_target || dirty_count > dirty_limit)
+            start_batch();
+    }
+
+    char *frame(MemoryPos mem_pos) {
+        return pages + frame_stride * mem_pos;
+    }
+
+    void release_frame(MemoryPos mem_pos) {
+        if (epochs)
+            retired_frames.push_back(Pair<long long, MemoryPos>(epochs->retire(), mem_pos));
+        else
+            free_frames.push_back(mem_pos);
+    }
+
+    void release_page(FilePos file_pos) {
+        if (epochs)
+            retired_pages.push_back(Pair<long long, FilePos>(epochs->retire(), file_pos));
+        else
+            recycle_heap.push(file_pos);
+    }
+
+    template<typename T>
+    static void drop_head(Vector<Pair<long long, T>> &retired, int &head) {
+        if (head < retired.size() / 2)
+            return;
+        for (int i = head; i < retired.size(); ++i)
+            retired[i - head] = retired[i];
+        retired.resize(retired.size() - head);
+        head = 0;
+    }
+
+    void reclaim(bool all = false) {
+
+        // what no reader can hold any more goes back to the free lists; all, with no readers left, empties the waits
+
+        if (retired_page_head == retired_pages.size() && retired_frame_head == retired_frames.size())
+            return;
+        long long oldest = all ? EpochManager::idle : epochs->oldest();
+        while (retired_frame_head < retired_frames.size() && retired_frames[retired_frame_head].first < oldest)
+            free_frames.push_back(retired_frames[retired_frame_head++].second);
+        while (retired_page_head < retired_pages.size() && retired_pages[retired_page_head].first < oldest)
+            recycle_heap.push(retired_pages[retired_page_head++].second);
+        drop_head(retired_frames, retired_frame_head);
+        drop_head(retired_pages, retired_page_head);
+    }
+
+    void quiesce() {
+
+        // waits out the readers on other threads, then nothing retired is held; before frames move or go away
+
+        if (!epochs)
+            return;
+        epochs->wait(epochs->retire());
+        reclaim();
+    }
+
+    MemoryPos evict_retired(MemoryPos victim) {
+
+        // the evicted frame waits its turn and the oldest waiting one serves, once its readers are gone
+
+        retired_frames.push_back(Pair<long long, MemoryPos>(epochs->retire(), victim));
+        while (retired_frames.size() - retired_frame_head < retire_slack && clean_count) {
+            MemoryPos mem_pos = clean_head;
+            unlink_clean(mem_pos);
+            page_frame[frame_page[mem_pos]] = -1;
+            frame_page[mem_pos] = -1;
+            retired_frames.push_back(Pair<long long, MemoryPos>(epochs->retire(), mem_pos));
+        }
+        Pair<long long, MemoryPos> oldest = retired_frames[retired_frame_head++];
+        epochs->wait(oldest.first);
+        drop_head(retired_frames, retired_frame_head);
+        return oldest.second;
+    }
+
+    MemoryPos acquire_frame() {
+
+        // a miss only ever reuses a clean frame, it waits for the writer when there is none
+
+        if (epochs)
+            reclaim();
+        if (free_frames.size()) {
+            MemoryPos mem_pos = free_frames.back();
+            free_frames.pop_back();
+            return mem_pos;
+        }
+
+        if (frame_count < frame_limit)
+            return frame_count++;
+
+        if (batch_busy && batch_done.load(std::memory_order_acquire))
+            harvest();
+
+        while (!clean_count && !free_frames.size()) {
+            if (epochs && retired_frame_head < retired_frames.size()) {
+                quiesce();
+                continue;
+            }
+            ++flush_stalls;
+            if (!batch_busy)
+                start_batch();
+            wait_batch();
+        }
+
+        if (free_frames.size()) {
+            MemoryPos mem_pos = free_frames.back();
+            free_frames.pop_back();
+            return mem_pos;
+        }
+
+        MemoryPos mem_pos = clean_head;
+        unlink_clean(mem_pos);
+        page_frame[frame_page[mem_pos]] = -1;
+        if (!epochs)
+            return mem_pos;
+        frame_page[mem_pos] = -1;
+        return evict_retired(mem_pos);
+    }
+
+    void map_frame(FilePos file_pos, MemoryPos mem_pos, char state, bool dirty) {
+        page_frame[file_pos] = mem_pos;
+        frame_page[mem_pos] = file_pos;
+        frame_state[mem_pos] = state;
+        frame_dirty[mem_pos] = dirty && !read_only;
+    }
+
+    MemoryPos load(FilePos file_pos) {
+        ++window_misses;
+        MemoryPos mem_pos = acquire_frame();
+        int slot = page_slot[file_pos];
+
+        if (slot == -1) {
+            PhaseScope scope(profiler, io_phase);
+            read_page(read_buffer, file_pos);
+            data_type::deserialize(read_buffer, frame(mem_pos));
+            return mem_pos;
+        }
+
+        if (!slot_ready[slot].load(std::memory_order_acquire)) {
+            PhaseScope scope(profiler, io_phase);
+            std::unique_lock<std::mutex> lock(prefetch_lock);
+            prefetch_done.wait(lock, [this, slot] { return slot_ready[slot].load(std::memory_order_acquire); });
+        }
+        data_type::deserialize(prefetch_pages + (long long) page_size * slot, frame(mem_pos));
+        page_slot[file_pos] = -1;
+        slot_page[slot] = -1;
+
+        ++prefetch_used;
+        if (depth < depth_limit && ++depth_credit >= depth) {
+            ++depth;
+            depth_credit = 0;
+        }
+        return mem_pos;
+    }
+
+    void update_limits() {
+        dirty_limit = (int) (frame_limit * dirty_ratio);
+        throttle_limit = dirty_limit + (frame_limit - dirty_limit) / 2;
+        clean_target = frame_limit / 16 ? frame_limit / 16 : 1;
+        batch_frames = frame_limit / 32 ? (frame_limit / 32 < flush_batch ? frame_limit / 32 : flush_batch) : 1;
+    }
+
+    bool reserve_frames(int frames) {
+
+        // a larger mapping with the frames in use copied over, the writer must be idle
+
+        if (frames <= frame_reserved)
+            return true;
+        FrameArena next;
+        if (!next.allocate(frame_stride * frames, arena_huge, arena_numa))
+            return false;
+        memcpy(next.data(), pages, frame_stride * frame_count);
+        arena.swap(next);
+        pages = arena.data();
+        quiesce();
+
+        frame_page.resize(frames);
+        frame_state.resize(frames);
+        frame_dirty.resize(frames);
+        clean_prev.resize(frames);
+        clean_next.resize(frames);
+        for (MemoryPos i = frame_reserved; i < frames; ++i) {
+            frame_page[i] = -1;
+            frame_dirty[i] = 0;
+        }
+        free_frames.reserve(frames);
+        frame_reserved = frames;
+        return true;
+    }
+
+    void shrink_frames(int frames) {
+
+        /*
+         * empties every frame from frames on: the pages of pinned and cached ones move into free frames below,
+         * then into the coldest clean ones, whose pages are dropped; what does not fit is written back if dirty
+         * and dropped, and so are the clean frames past the end, which were the coldest anyway
+         */
+
+        quiesce();
+        Vector<MemoryPos> spare;
+        for (int i = 0; i < free_frames.size(); ++i)
+            if (free_frames[i] < frames)
+                spare.push_back(free_frames[i]);
+        int free_spare = spare.size(), used_spare = 0;
+        for (MemoryPos mem_pos = clean_head; mem_pos != -1; mem_pos = clean_next[mem_pos])
+            if (mem_pos < frames)
+                spare.push_back(mem_pos);
+
+        // the clean frames that will take a page let go of theirs first, and are written only once no reader is left
+        // on them
+
+        int movers = 0;
+        for (MemoryPos mem_pos = frames; mem_pos < frame_count; ++mem_pos)
+            if (frame_page[mem_pos] != -1 && frame_state[mem_pos] != frame_clean)
+                ++movers;
+        for (int i = free_spare; i < spare.size() && i < movers; ++i) {
+            unlink_clean(spare[i]);
+            page_frame[frame_page[spare[i]]] = -1;
+            frame_page[spare[i]] = -1;
+        }
+        quiesce();
+
+        batch_size = 0;
+        for (int pass = 0; pass < 2; ++pass)
+            for (MemoryPos mem_pos = frames; mem_pos < frame_count; ++mem_pos) {
+                FilePos file_pos = frame_page[mem_pos];
+                if (file_pos == -1 || (frame_state[mem_pos] == frame_clean) != (pass == 1))
+                    continue;
+
+                char state = frame_state[mem_pos];
+                if (state == frame_clean)
+                    unlink_clean(mem_pos);
+                else if (used_spare < spare.size()) {
+                    MemoryPos target = spare[used_spare++];
+                    memcpy(frame(target), frame(mem_pos), page_size);
+                    map_frame(file_pos, target, state, frame_dirty[mem_pos]);
+                    if (state == frame_cached)
+                        cache_heap.relocate(file_pos, target);
+                    frame_page[mem_pos] = -1;
+                    continue;
+                }
+                else if (state == frame_cached) {
+                    cache_heap.erase(file_pos);
+                    if (frame_dirty[mem_pos])
+                        --dirty_count;
+                }
+                else {
+                    pin_count[file_pos] = 0;
+                    --pinned_frames;
+                }
+
+                if (frame_dirty[mem_pos]) {
+                    frame_dirty[mem_pos] = 0;
+                    batch[batch_size++] = Pair<FilePos, MemoryPos>(file_pos, mem_pos);
+                    if (batch_size == flush_batch) {
+                        qsort(batch, batch + batch_size, comp_page);
+                        note_batch();
+                        write_batch();
+                        batch_size = 0;
+                    }
+                }
+                page_frame[file_pos] = -1;
+                frame_page[mem_pos] = -1;
+            }
+        qsort(batch, batch + batch_size, comp_page);
+        note_batch();
+        write_batch();
+        batch_size = 0;
+
+        free_frames.resize(0);
+        for (int i = used_spare; i < free_spare; ++i)
+            free_frames.push_back(spare[i]);
+        quiesce();
+        arena.discard(frame_stride * frames, frame_stride * (frame_count - frames));
+        frame_count = frames;
+    }
+
+    void close_file() {
+
+        backup_abort(); // an unfinished stream is of no use
+        flush_all(); // before the info file, which records where a compressed page was put
+        if (epochs)
+            reclaim(true); // the readers of a manager are gone before it
+
+        int recycle_size = recycle_heap.size();
+        recycle_heap.sort();
+        const int *recycle_arr = recycle_heap.raw();
+        while (recycle_size) {
+            if (recycle_arr[recycle_size - 1] == file_size - 1) {
+                --recycle_size;
+                --file_size;
+            }
+            else
+                break;
+        }
+
+        write_info(info_path, recycle_arr, recycle_size);
+        write_changes();
+    }
+
+    bool write_info(const std::string &path, const int *recycle_arr, int recycle_size) {
+        std::fstream info_file(
+                path,
+                std::fstream::out | std::fstream::trunc | std::fstream::binary
+        );
+
+        info_file.write(reinterpret_cast<char *>(&file_size), sizeof(int));
+        info_file.write(reinterpret_cast<char *>(&recycle_size), sizeof(int));
+        info_file.write(reinterpret_cast<const char *>(recycle_arr), (long long) sizeof(int) * recycle_size);
+        int compressed_flag = compressed;
+        info_file.write(reinterpret_cast<char *>(&compressed_flag), sizeof(int));
+        if (compressed)
+            write_places(info_file);
+
+        bool good = info_file.good();
+        info_file.close();
+        return good;
+    }
+
+    bool copy_data(int copy_fd) {
+
+        // copy_file_range lets the file system share or copy extents itself, plain reads and writes are the fallback
+
+        long long size = lseek(data_fd, 0, SEEK_END), copied = 0;
+        loff_t in_offset = 0, out_offset = 0;
+        while (copied < size) {
+            ssize_t moved = copy_file_range(data_fd, &in_offset, copy_fd, &out_offset, size - copied, 0);
+            if (moved <= 0)
+                break;
+            copied += moved;
+        }
+
+        long long chunk = (long long) page_size * flush_batch;
+        while (copied < size) {
+            ssize_t got = pread(data_fd, staging, size - copied < chunk ? size - copied : chunk, copied);
+            if (got <= 0 || pwrite(copy_fd, staging, got, copied) != got)
+                return false;
+            copied += got;
+        }
+        return fdatasync(copy_fd) == 0;
+    }
+
+    void read_places(std::fstream &info_file) {
+        compressed = true;
+        int place_size;
+        info_file.read(reinterpret_cast<char *>(&place_end), sizeof(int));
+        info_file.read(reinterpret_cast<char *>(&place_size), sizeof(int));
+        page_place.resize(place_size);
+        if (place_size)
+            info_file.read(reinterpret_cast<char *>(&page_place[0]), (long long) sizeof(Placement) * place_size);
+        for (int units = 1; units <= slot_classes; ++units) {
+            int free_size = 0;
+            info_file.read(reinterpret_cast<char *>(&free_size), sizeof(int));
+            free_places[units].resize(free_size);
+            if (free_size)
+                info_file.read(reinterpret_cast<char *>(&free_places[units][0]), (long long) sizeof(int) * free_size);
+        }
+    }
+
+    void write_places(std::fstream &info_file) {
+
+        // slots of pages cut off the end of the file are free again
+
+        for (FilePos i = file_size; i < page_place.size(); ++i)
+            if (page_place[i].offset != -1)
+                free_places[place_units(page_place[i].length)].push_back(page_place[i].offset);
+        int place_size = page_place.size() < file_size ? page_place.size() : file_size;
+
+        info_file.write(reinterpret_cast<char *>(&place_end), sizeof(int));
+        info_file.write(reinterpret_cast<char *>(&place_size), sizeof(int));
+        if (place_size)
+            info_file.write(reinterpret_cast<char *>(&page_place[0]), (long long) sizeof(Placement) * place_size);
+        for (int units = 1; units <= slot_classes; ++units) {
+            int free_size = free_places[units].size();
+            info_file.write(reinterpret_cast<char *>(&free_size), sizeof(int));
+            if (free_size)
+                info_file.write(reinterpret_cast<char *>(&free_places[units][0]), (long long) sizeof(int) * free_size);
+        }
+    }
+
+    void mark_changed(FilePos file_pos) {
+        while (changed_pages.size() <= file_pos / 64)
+            changed_pages.push_back(0ULL);
+        changed_pages[file_pos / 64] |= 1ULL << (file_pos % 64);
+    }
+
+    bool page_changed(FilePos file_pos) {
+        return file_pos / 64 < changed_pages.size() && (changed_pages[file_pos / 64] >> (file_pos % 64) & 1);
+    }
+
+    void keep_image(FilePos file_pos) {
+
+        // a page the running backup has yet to stream is copied aside before its stored image changes
+
+        if (backup_fd < 0 || file_pos >= backup_pending.size() || !backup_pending[file_pos])
+            return;
+        backup_pending[file_pos] = 0;
+        int at = saved_images.size();
+        saved_images.resize(at + page_size);
+        read_page(&saved_images[at], file_pos);
+        saved_pos.push_back(file_pos);
+    }
+
+    void note_batch() {
+
+        // on the calling thread, before the batch is written or handed to the writer
+
+        for (int i = 0; i < batch_size; ++i) {
+            mark_changed(batch[i].first);
+            keep_image(batch[i].first);
+        }
+    }
+
+    void read_changes() {
+
+        // a map that does not read whole is as good as none, either way it is gone until the manager closes
+
+        std::fstream changes_file(changes_path, std::fstream::in | std::fstream::binary);
+        load_changes(changes_file);
+        changes_file.close();
+        std::remove(changes_path.c_str());
+    }
+
+    void load_changes(std::fstream &changes_file) {
+        int words = 0;
+        if (!changes_file.read(reinterpret_cast<char *>(&backup_lineage), sizeof(long long)) ||
+            !changes_file.read(reinterpret_cast<char *>(&backup_seq), sizeof(long long)) ||
+            !changes_file.read(reinterpret_cast<char *>(&words), sizeof(int)) || words < 0) {
+            backup_lineage = backup_seq = 0;
+            return;
+        }
+        changed_pages.resize(words);
+        if (words && !changes_file.read(reinterpret_cast<char *>(&changed_pages[0]), sizeof(long long) * words)) {
+            changed_pages.resize(0);
+            backup_lineage = backup_seq = 0;
+            return;
+        }
+        changes_known = true;
+    }
+
+    void write_changes() {
+        if (changes_path.empty() || !changes_known)
+            return;
+        std::fstream changes_file(changes_path, std::fstream::out | std::fstream::trunc | std::fstream::binary);
+        int words = changed_pages.size();
+        changes_file.write(reinterpret_cast<char *>(&backup_lineage), sizeof(long long));
+        changes_file.write(reinterpret_cast<char *>(&backup_seq), sizeof(long long));
+        changes_file.write(reinterpret_cast<char *>(&words), sizeof(int));
+        if (words)
+            changes_file.write(reinterpret_cast<char *>(&changed_pages[0]), sizeof(long long) * words);
+    }
+
+    void put_backup(const void *data, int size) {
+        int at = backup_out.size();
+        backup_out.resize(at + size);
+        memcpy(&backup_out[at], data, size);
+    }
+
+    bool drain_backup() {
+        const char *out = backup_out.size() ? &backup_out[0] : nullptr;
+        long long remain = backup_out.size();
+        while (remain > 0) {
+            ssize_t written = ::write(backup_fd, out, remain);
+            if (written <= 0)
+                return false;
+            out += written;
+            remain -= written;
+        }
+        backup_out.resize(0);
+        return true;
+    }
+
+    void flush_all() {
+
+        // writes every dirty frame on the calling thread, at shutdown and for a snapshot, the writer must be idle
+
+        batch_size = 0;
+        for (MemoryPos i = 0; i < frame_count; ++i) {
+            if (frame_page[i] == -1 || !frame_dirty[i])
+                continue;
+            frame_dirty[i] = 0;
+            if (frame_state[i] == frame_cached)
+                --dirty_count;
+            batch[batch_size++] = Pair<FilePos, MemoryPos>(frame_page[i], i);
+            if (batch_size == flush_batch) {
+                qsort(batch, batch + batch_size, comp_page);
+                note_batch();
+                write_batch();
+                batch_size = 0;
+            }
+        }
+        qsort(batch, batch + batch_size, comp_page);
+        note_batch();
+        write_batch();
+        batch_size = 0;
+    }
+
+public:
+
+    class PinGuard {
+
+        PageManager *manager;
+        FilePos file_pos;
+        int version;
+        char *page;
+
+        void release() {
+            if (manager)
+                manager->unpin(file_pos, version);
+        }
+
+    public:
+
+        PinGuard() : manager(nullptr), file_pos(-1), version(0), page(nullptr) {}
+
+        PinGuard(PageManager &manager, FilePos file_pos, bool modify = true) : PinGuard() {
+            reset(manager, file_pos, modify);
+        }
+
+        PinGuard(const PinGuard &) = delete;
+
+        PinGuard &operator=(const PinGuard &) = delete;
+
+        ~PinGuard() {
+            release();
+        }
+
+        char *reset(PageManager &new_manager, FilePos new_pos, bool modify = true) {
+            release();
+            manager = &new_manager;
+            file_pos = new_pos;
+            page = manager->pin(file_pos, modify);
+            version = manager->version(file_pos);
+            return page;
+        }
+
+        char *get() const {
+            return page;
+        }
+    };
+
+    PageManager(const std::string &data_path, const std::string &info_path, bool read_only = false,
+                const std::string &changes_path = "") :
+            data_path(data_path), info_path(info_path),
+            read_only(read_only), mapped(nullptr), mapped_size(0),
+            frame_limit(read_only ? replica_frames : cache_limit), frame_reserved(cache_limit),
+            arena_huge(FrameArena::small_pages), arena_numa(FrameArena::numa_default),
+            frame_count(0), pinned_frames(0), epochs(nullptr), retired_page_head(0), retired_frame_head(0),
+            changes_path(read_only ? "" : changes_path), changes_known(false), backup_lineage(0), backup_seq(0),
+            backup_fd(-1), backup_kind(full_backup), backup_next_lineage(0),
+            backup_next_seq(0), backup_records(0), backup_cursor(0),
+            backup_left(0),
+            clean_head(-1), clean_tail(-1), clean_count(0), dirty_count(0), dirty_ratio(0.9),
+            pool_budget(0), target_miss_rate(0), window_accesses(0), window_misses(0), pool_resizes(0),
+            calm_count(0), profiler(nullptr), io_phase(0),
+            batch_size(0), batch_busy(false), batch_pending(false), writer_stop(false), batch_done(false),
+            flushed_pages(0), write_calls(0), flush_stalls(0),
+            prefetch_clock(0), queue_head(0), queue_size(0), prefetch_stop(false),
+            depth_limit(16), depth(4), depth_credit(0),
+            prefetch_issued(0), prefetch_used(0), prefetch_wasted(0),
+            compressed(false), place_end(0), written_bytes(0), compress_ns(0), decompress_ns(0), decompressed_pages(0) {
+
+        std::fstream info_file(
+                info_path,
+                std::fstream::in | std::fstream::binary
+        );
+
+        if (info_file.is_open()) {
+
+            info_file.read(reinterpret_cast<char *>(&file_size), sizeof(int));
+
+            int recycle_size;
+            info_file.read(reinterpret_cast<char *>(&recycle_size), sizeof(int));
+            recycle_heap.reserve(recycle_size);
+            for (int i = 0; i < recycle_size; ++i) {
+                FilePos recycled;
+                info_file.read(reinterpret_cast<char *>(&recycled), sizeof(int));
+                recycle_heap.push(recycled);
+            }
+
+            int compressed_flag = 0;
+            if (info_file.read(reinterpret_cast<char *>(&compressed_flag), sizeof(int)) && compressed_flag)
+                read_places(info_file);
+
+            info_file.close();
+        }
+        else {
+            file_size = 0;
+        }
+
+        if (!arena.allocate(frame_stride * frame_reserved))
+            throw std::bad_alloc();
+        pages = arena.data();
+        read_buffer = new char[page_size];
+        staging = new char[(long long) page_size * flush_batch];
+        batch = new Pair<FilePos, MemoryPos>[flush_batch];
+        compress_buffer = new char[page_size];
+        batch_length = new int[flush_batch];
+        batch_offset = new Pair<int, int>[flush_batch];
+        prefetch_pages = new char[(long long) page_size * prefetch_slots];
+        for (int i = 0; i < prefetch_slots; ++i) {
+            slot_page[i] = -1;
+            slot_ready[i].store(true);
+        }
+
+        frame_page.resize(frame_reserved);
+        frame_state.resize(frame_reserved);
+        frame_dirty.resize(frame_reserved);
+        clean_prev.resize(frame_reserved);
+        clean_next.resize(frame_reserved);
+        for (MemoryPos i = 0; i < frame_reserved; ++i) {
+            frame_page[i] = -1;
+            frame_dirty[i] = 0;
+        }
+        free_frames.reserve(frame_reserved);
+
+        // the page map covers the file and room to double it, so a growing file rarely resizes it
+        cache_heap.reserve(frame_reserved, file_size * 2 > min_frames ? file_size * 2 : min_frames);
+
+        update_limits();
+
+        if (read_only) {
+            data_fd = open(data_path.c_str(), O_RDONLY);
+            struct stat data_stat;
+            if (data_fd >= 0 && fstat(data_fd, &data_stat) == 0 && data_stat.st_size > 0) {
+                void *map = mmap(nullptr, data_stat.st_size, PROT_READ, MAP_SHARED, data_fd, 0);
+                if (map != MAP_FAILED) {
+                    mapped = static_cast<const char *>(map);
+                    mapped_size = data_stat.st_size;
+                }
+            }
+        }
+        else
+            data_fd = open(data_path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (!this->changes_path.empty())
+            read_changes();
+
+        writer_thread = std::thread(&PageManager::writer_loop, this);
+        for (int i = 0; i < prefetch_threads; ++i)
+            prefetch_thread[i] = std::thread(&PageManager::prefetch_loop, this);
+    }
+
+    ~PageManager() {
+
+        wait_batch();
+        {
+            std::lock_guard<std::mutex> lock(writer_lock);
+            writer_stop = true;
+        }
+        writer_signal.notify_all();
+        writer_thread.join();
+
+        {
+            std::lock_guard<std::mutex> lock(prefetch_lock);
+            prefetch_stop = true;
+        }
+        prefetch_signal.notify_all();
+        for (int i = 0; i < prefetch_threads; ++i)
+            prefetch_thread[i].join();
+
+        if (!read_only)
+            close_file();
+
+        delete[] read_buffer;
+        delete[] staging;
+        delete[] batch;
+        delete[] prefetch_pages;
+        delete[] compress_buffer;
+        delete[] batch_length;
+        delete[] batch_offset;
+        if (mapped)
+            munmap(const_cast<char *>(mapped), mapped_size);
+        if (data_fd >= 0)
+            close(data_fd);
+    }
+
+    bool snapshot(const std::string &copy_data_path, const std::string &copy_info_path) {
+
+        // writes every dirty frame back, then copies the data file and its info for a read-only manager to open
+
+        if (read_only)
+            return false;
+        checkpoint();
+        quiesce(); // page numbers still retired would be missing from the copy's free list
+
+        int copy_fd = open(copy_data_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (copy_fd < 0)
+            return false;
+        bool copied = copy_data(copy_fd);
+        close(copy_fd);
+        return copied && write_info(copy_info_path, recycle_heap.raw(), recycle_heap.size());
+    }
+
+    void checkpoint() {
+
+        // every dirty frame written back, so the file alone holds the current pages
+
+        if (read_only)
+            return;
+        wait_batch();
+        flush_all();
+    }
+
+    bool backup_begin(const std::string &path, bool incremental, const char *meta, int meta_size) {
+
+        /*
+         * starts streaming the file as it is now to path: every page for a full backup, the pages changed since the
+         * last one for an incremental, which becomes a full one when the map did not survive or no backup was made;
+         * meta is stored as is for restore() to give back, false when the backup cannot start or one is running
+         */
+
+        if (read_only || changes_path.empty() || backup_fd >= 0)
+            return false;
+        checkpoint();
+
+        backup_kind = incremental && changes_known ? incremental_backup : full_backup;
+        backup_next_lineage = backup_lineage;
+        backup_next_seq = backup_seq + 1;
+        if (backup_kind == full_backup) {
+            std::random_device seed;
+            backup_next_seq = 0;
+            do
+                backup_next_lineage = (long long) ((unsigned long long) seed() << 32 | seed()) & LLONG_MAX;
+            while (!backup_next_lineage);
+        }
+
+        backup_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (backup_fd < 0)
+            return false;
+        backup_path = path;
+
+        Vector<FilePos> free_pages;
+        free_list(free_pages);
+        backup_pending.resize(file_size);
+        for (FilePos i = 0; i < file_size; ++i)
+            backup_pending[i] = backup_kind == full_backup || page_changed(i);
+        for (int i = 0; i < free_pages.size(); ++i)
+            if (free_pages[i] < file_size)
+                backup_pending[free_pages[i]] = 0;
+        backup_left = 0;
+        for (FilePos i = 0; i < file_size; ++i)
+            backup_left += backup_pending[i];
+
+        backup_pages.resize(changed_pages.size());
+        for (int i = 0; i < changed_pages.size(); ++i) {
+            backup_pages[i] = changed_pages[i];
+            changed_pages[i] = 0;
+        }
+        backup_cursor = 0;
+        backup_records = 0;
+        saved_pos.resize(0);
+        saved_images.resize(0);
+
+        int size = page_size, free_size = free_pages.size();
+        backup_out.resize(0);
+        put_backup(backup_magic, sizeof(backup_magic));
+        put_backup(&size, sizeof(int));
+        put_backup(&backup_kind, sizeof(int));
+        put_backup(&backup_next_lineage, sizeof(long long));
+        put_backup(&backup_next_seq, sizeof(long long));
+        put_backup(&file_size, sizeof(int));
+        put_backup(&free_size, sizeof(int));
+        if (free_size)
+            put_backup(&free_pages[0], (int) sizeof(int) * free_size);
+        put_backup(&meta_size, sizeof(int));
+        if (meta_size)
+            put_backup(meta, meta_size);
+        if (!drain_backup()) {
+            backup_abort();
+            return false;
+        }
+        return true;
+    }
+
+    long long backup_step(int pages) {
+
+        // streams up to pages more pages, those copied aside first; the pages still to go, 0 once the backup is
+        // complete on disk, -1 when it failed and was abandoned
+
+        if (backup_fd < 0)
+            return -1;
+        char image[page_size];
+        FilePos end = -1;
+        for (; pages > 0 && (saved_pos.size() || backup_left); --pages) {
+            FilePos file_pos;
+            if (saved_pos.size()) {
+                file_pos = saved_pos.back();
+                put_backup(&file_pos, sizeof(int));
+                put_backup(&saved_images[(saved_pos.size() - 1) * page_size], page_size);
+                saved_pos.pop_back();
+                saved_images.resize(saved_pos.size() * page_size);
+            }
+            else {
+                while (!backup_pending[backup_cursor])
+                    ++backup_cursor;
+                file_pos = backup_cursor;
+                backup_pending[file_pos] = 0;
+                read_page(image, file_pos);
+                put_backup(&file_pos, sizeof(int));
+                put_backup(image, page_size);
+            }
+            --backup_left;
+            ++backup_records;
+        }
+
+        bool done = !saved_pos.size() && !backup_left;
+        if (done) {
+            put_backup(&end, sizeof(int));
+            put_backup(&backup_records, sizeof(long long));
+        }
+        if (!drain_backup() || (done && fdatasync(backup_fd) != 0)) {
+            backup_abort();
+            return -1;
+        }
+        if (!done)
+            return backup_left + saved_pos.size();
+
+        close(backup_fd);
+        backup_fd = -1;
+        changes_known = true;
+        backup_lineage = backup_next_lineage;
+        backup_seq = backup_next_seq;
+        backup_pending.resize(0);
+        backup_pages.resize(0);
+        return 0;
+    }
+
+    void backup_abort() {
+
+        // the pages the backup took count as changed again, and its partial file goes
+
+        if (backup_fd < 0)
+            return;
+        close(backup_fd);
+        backup_fd = -1;
+        std::remove(backup_path.c_str());
+        for (int i = 0; i < backup_pages.size(); ++i) {
+            if (i < changed_pages.size())
+                changed_pages[i] |= backup_pages[i];
+            else
+                changed_pages.push_back(backup_pages[i]);
+        }
+        backup_pending.resize(0);
+        backup_pages.resize(0);
+        saved_pos.resize(0);
+        saved_images.resize(0);
+        backup_out.resize(0);
+    }
+
+    bool backing_up() {
+        return backup_fd >= 0;
+    }
+
+    bool backup_full() {
+
+        // whether the running backup, or the last one started, streams every page
+
+        return backup_kind == full_backup;
+    }
+
+    static int restore(const std::string &restore_data_path, const std::string &restore_info_path,
+                       const char *const *chain, int count, Vector<char> &meta) {
+
+        /*
+         * rebuilds the file from a full backup and the incremental ones taken after it, in order: every file is
+         * checked whole before a page is written, so a chain with a gap, a foreign or a cut off file writes nothing
+         * returns count, or the index of the first file that does not continue the chain; meta is the last file's
+         */
+
+        long long lineage = 0, seq = 0;
+        FilePos page_count = 0;
+        Vector<FilePos> free_pages;
+        for (int pass = 0; pass < 2; ++pass) {
+            int data = -1;
+            if (pass == 1 && (data = open(restore_data_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+                return 0;
+            for (int i = 0; i < count; ++i) {
+                std::fstream file(chain[i], std::fstream::in | std::fstream::binary);
+                char magic[sizeof(backup_magic)];
+                int size = 0, kind = -1, free_size = 0, meta_size = 0;
+                long long file_lineage = 0, file_seq = -1, records = 0, listed = -1;
+                bool good = file.read(magic, sizeof(magic)) && memcmp(magic, backup_magic, sizeof(magic)) == 0 &&
+                            file.read(reinterpret_cast<char *>(&size), sizeof(int)) && size == page_size &&
+                            file.read(reinterpret_cast<char *>(&kind), sizeof(int)) &&
+                            kind == (i ? incremental_backup : full_backup) &&
+                            file.read(reinterpret_cast<char *>(&file_lineage), sizeof(long long)) &&
+                            (!i || file_lineage == lineage) &&
+                            file.read(reinterpret_cast<char *>(&file_seq), sizeof(long long)) &&
+                            file_seq == (i ? seq + 1 : 0) &&
+                            file.read(reinterpret_cast<char *>(&page_count), sizeof(int)) && page_count >= 0 &&
+                            file.read(reinterpret_cast<char *>(&free_size), sizeof(int)) && free_size >= 0;
+                if (good) {
+                    free_pages.resize(free_size);
+                    good = (!free_size || file.read(reinterpret_cast<char *>(&free_pages[0]),
+                                                    (long long) sizeof(int) * free_size)) &&
+                           file.read(reinterpret_cast<char *>(&meta_size), sizeof(int)) && meta_size >= 0;
+                }
+                if (good) {
+                    meta.resize(meta_size);
+                    good = !meta_size || file.read(&meta[0], meta_size);
+                }
+
+                char image[page_size];
+                while (good) {
+                    FilePos file_pos;
+                    if (!file.read(reinterpret_cast<char *>(&file_pos), sizeof(int)))
+                        good = false;
+                    else if (file_pos == -1) {
+                        good = file.read(reinterpret_cast<char *>(&listed), sizeof(long long)) && listed == records &&
+                               file.peek() == EOF;
+                        break;
+                    }
+                    else if (file_pos < 0 || file_pos >= page_count)
+                        good = false;
+                    else if (pass == 0)
+                        good = (bool) file.seekg(page_size, std::fstream::cur);
+                    else
+                        good = file.read(image, page_size) &&
+                               pwrite(data, image, page_size, (long long) page_size * file_pos) == page_size;
+                    ++records;
+                }
+                if (!good) {
+                    if (data >= 0) {
+                        close(data);
+                        std::remove(restore_data_path.c_str());
+                    }
+                    return i;
+                }
+                lineage = file_lineage;
+                seq = file_seq;
+            }
+            if (pass == 0)
+                continue;
+
+            bool good = ftruncate(data, (long long) page_size * page_count) == 0 && fdatasync(data) == 0;
+            close(data);
+            std::fstream info_file(restore_info_path, std::fstream::out | std::fstream::trunc | std::fstream::binary);
+            int free_size = free_pages.size(), compressed_flag = 0;
+            info_file.write(reinterpret_cast<char *>(&page_count), sizeof(int));
+            info_file.write(reinterpret_cast<char *>(&free_size), sizeof(int));
+            if (free_size)
+                info_file.write(reinterpret_cast<char *>(&free_pages[0]), (long long) sizeof(int) * free_size);
+            info_file.write(reinterpret_cast<char *>(&compressed_flag), sizeof(int));
+            if (!good || !info_file.good())
+                return 0;
+        }
+        return count;
+    }
+
+    void read_image(FilePos file_pos, char *buffer) {
+
+        // the stored image of a page, bypassing the cache; safe on any thread, current after checkpoint()
+
+        read_page(buffer, file_pos);
+    }
+
+    FilePos page_count() {
+        return file_size;
+    }
+
+    void free_list(Vector<FilePos> &result) {
+
+        // retired page numbers are free too, only not reusable yet
+
+        result.resize(recycle_heap.size() + retired_pages.size() - retired_page_head);
+        for (int i = 0; i < recycle_heap.size(); ++i)
+            result[i] = recycle_heap.raw()[i];
+        for (int i = retired_page_head; i < retired_pages.size(); ++i)
+            result[recycle_heap.size() + i - retired_page_head] = retired_pages[i].second;
+    }
+
+    bool opened() {
+        return data_fd >= 0;
+    }
+
+    int frame_capacity() {
+        return frame_limit;
+    }
+
+    bool set_frame_arena(int huge, int numa) {
+
+        /*
+         * moves the frames into a new arena with the given huge page mode and NUMA policy; between calls nothing
+         * outside holds a frame's address, only its number, so copying the frames in use is enough
+         * false when no memory could be mapped, the old arena is kept then
+         */
+
+        wait_batch();
+        FrameArena next;
+        if (!next.allocate(frame_stride * frame_reserved, huge, numa))
+            return false;
+        memcpy(next.data(), pages, frame_stride * frame_count);
+        arena.swap(next);
+        pages = arena.data();
+        quiesce();
+        arena_huge = huge;
+        arena_numa = numa;
+        return true;
+    }
+
+    bool resize_frames(int frames) {
+
+        /*
+         * makes the pool frames large, at least min_frames, between calls while no guard holds a frame;
+         * growing past the reserved frames moves them into a larger arena, shrinking keeps the hottest pages
+         * and gives the memory of the frames past the end back to the kernel
+         * false when a larger arena could not be mapped, the pool is unchanged then
+         */
+
+        if (frames < min_frames)
+            frames = min_frames;
+        wait_batch();
+        if (!reserve_frames(frames))
+            return false;
+        if (frames < frame_count)
+            shrink_frames(frames);
+        if (frames != frame_limit)
+            ++pool_resizes;
+        frame_limit = frames;
+        update_limits();
+        return true;
+    }
+
+    void release_pins(int limit) {
+
+        // turns pinned frames back into cached ones until at most limit stay pinned, after the pool shrank
+
+        for (MemoryPos mem_pos = 0; mem_pos < frame_count && pinned_frames > limit; ++mem_pos) {
+            FilePos file_pos = frame_page[mem_pos];
+            if (file_pos == -1 || frame_state[mem_pos] != frame_pinned)
+                continue;
+            pin_count[file_pos] = 0;
+            --pinned_frames;
+            frame_state[mem_pos] = frame_cached;
+            cache_heap.insert(file_pos, mem_pos);
+            if (frame_dirty[mem_pos])
+                ++dirty_count;
+        }
+        maintain();
+    }
+
+    void set_pool_budget(long long bytes, double miss_rate) {
+
+        // 0 bytes turns auto-sizing off, a pool already over the budget shrinks to it right away
+
+        pool_budget = bytes > 0 ? bytes : 0;
+        target_miss_rate = miss_rate;
+        window_accesses = window_misses = 0;
+        if (pool_budget && frame_stride * frame_limit > pool_budget)
+            resize_frames((int) (pool_budget / frame_stride));
+    }
+
+    bool review_due() {
+        return pool_budget && window_accesses >= review_window;
+    }
+
+    bool review_pool() {
+
+        // one auto-sizing step at the end of a window, true when the pool changed size
+
+        double miss_rate = (double) window_misses / window_accesses;
+        window_accesses = window_misses = 0;
+        long long budget_frames = pool_budget / frame_stride;
+        int frames = frame_limit;
+        calm_count = miss_rate < target_miss_rate / 8 ? calm_count + 1 : 0;
+        if (miss_rate > target_miss_rate)
+            frames = frame_limit + frame_limit / 4 < budget_frames ? frame_limit + frame_limit / 4 : (int) budget_frames;
+        else if (calm_count >= calm_windows) {
+            frames = frame_limit - frame_limit / 8;
+            calm_count = 0;
+        }
+        if (frames < min_frames)
+            frames = min_frames;
+        return frames != frame_limit && resize_frames(frames);
+    }
+
+    void set_epochs(EpochManager *attached) {
+
+        /*
+         * with a manager, a freed page number or a frame freed or evicted is reused only after every reader that
+         * entered an epoch on another thread before it was let go has left; nullptr waits those out and goes back
+         * to reusing at once; the manager outlives this one
+         */
+
+        wait_batch();
+        quiesce();
+        epochs = attached;
+    }
+
+    long long retired_count() {
+        return retired_pages.size() - retired_page_head + retired_frames.size() - retired_frame_head;
+    }
+
+    long long epoch_wait_count() {
+        return epochs ? epochs->wait_count() : 0;
+    }
+
+    void set_profiler(PhaseProfiler *attached, int phase) {
+        profiler = attached;
+        io_phase = phase;
+    }
+
+    long long frame_bytes() {
+        return frame_stride;
+    }
+
+    long long resident_bytes() {
+        return frame_stride * (frame_count - free_frames.size());
+    }
+
+    long long pool_bytes() {
+        return frame_stride * frame_limit;
+    }
+
+    long long resize_count() {
+        return pool_resizes;
+    }
+
+    int frame_huge_pages() {
+        return arena.huge_pages();
+    }
+
+    bool frame_numa_placed() {
+        return arena.numa_placed();
+    }
+
+    char *operator[](FilePos file_pos) {
+        return access(file_pos, true);
+    }
+
+    // same as operator[] for a caller that will not modify the page, so it stays clean
+
+    const char *read(FilePos file_pos) {
+        return access(file_pos, false);
+    }
+
+    char *access(FilePos file_pos, bool modify) {
+
+        track(file_pos);
+        ++window_accesses;
+        MemoryPos mem_pos = page_frame[file_pos];
+
+        if (mem_pos != -1 && frame_state[mem_pos] == frame_writing)
+            wait_batch();
+
+        if (mem_pos == -1) {
+            mem_pos = load(file_pos);
+            map_frame(file_pos, mem_pos, frame_cached, false);
+            cache_heap.insert(file_pos, mem_pos);
+            maintain();
+        }
+        else if (frame_state[mem_pos] == frame_cached) {
+            cache_heap.reset_priority(file_pos);
+        }
+        else if (frame_state[mem_pos] == frame_clean) {
+            unlink_clean(mem_pos);
+            frame_state[mem_pos] = frame_cached;
+            cache_heap.insert(file_pos, mem_pos);
+        }
+
+        if (modify)
+            mark_dirty(mem_pos);
+        return frame(mem_pos);
+    }
+
+    char *pinned(FilePos file_pos, bool modify = false) {
+        if (file_pos >= page_frame.size())
+            return nullptr;
+
+        MemoryPos mem_pos = page_frame[file_pos];
+        if (mem_pos == -1 || frame_state[mem_pos] != frame_pinned)
+            return nullptr;
+
+        if (modify && !read_only)
+            frame_dirty[mem_pos] = 1;
+        return frame(mem_pos);
+    }
+
+    char *pin(FilePos file_pos, bool modify = true) {
+
+        track(file_pos);
+        ++window_accesses;
+        MemoryPos mem_pos = page_frame[file_pos];
+
+        if (mem_pos != -1 && frame_state[mem_pos] == frame_writing)
+            wait_batch();
+
+        if (mem_pos == -1) {
+            mem_pos = load(file_pos);
+            map_frame(file_pos, mem_pos, frame_pinned, false);
+            ++pinned_frames;
+            maintain();
+        }
+        else if (frame_state[mem_pos] != frame_pinned) {
+            if (frame_state[mem_pos] == frame_cached) {
+                cache_heap.erase(file_pos);
+                if (frame_dirty[mem_pos])
+                    --dirty_count;
+            }
+            else
+                unlink_clean(mem_pos);
+            frame_state[mem_pos] = frame_pinned;
+            ++pinned_frames;
+        }
+
+        ++pin_count[file_pos];
+        if (modify && !read_only)
+            frame_dirty[mem_pos] = 1;
+        return frame(mem_pos);
+    }
+
+    void unpin(FilePos file_pos, int version) {
+
+        // the page might have been freed (and even reallocated) while pinned
+
+        if (file_pos >= page_frame.size() || page_version[file_pos] != version)
+            return;
+
+        MemoryPos mem_pos = page_frame[file_pos];
+        if (mem_pos == -1 || frame_state[mem_pos] != frame_pinned)
+            return;
+
+        if (--pin_count[file_pos])
+            return;
+
+        cache_heap.insert(file_pos, mem_pos);
+        frame_state[mem_pos] = frame_cached;
+        --pinned_frames;
+        if (frame_dirty[mem_pos]) {
+            ++dirty_count;
+            maintain();
+        }
+    }
+
+    int version(FilePos file_pos) {
+        return file_pos < page_version.size() ? page_version[file_pos] : 0;
+    }
+
+    int pinned_size() {
+        return pinned_frames;
+    }
+
+    void prefetch(FilePos file_pos) {
+
+        // only pages that are neither resident nor staged are worth a read
+
+        if (file_pos < 0 || file_pos >= file_size)
+            return;
+
+        track(file_pos);
+        if (page_frame[file_pos] != -1 || page_slot[file_pos] != -1)
+            return;
+
+        int slot = take_slot();
+        if (slot == -1)
+            return;
+
+        page_slot[file_pos] = slot;
+        slot_page[slot] = file_pos;
+        slot_read[slot] = file_pos;
+        slot_stamp[slot] = ++prefetch_clock;
+        slot_ready[slot].store(false, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(prefetch_lock);
+            prefetch_queue[(queue_head + queue_size) % prefetch_slots] = slot;
+            ++queue_size;
+        }
+        prefetch_signal.notify_one();
+        ++prefetch_issued;
+    }
+
+    // the frame of a resident page, without touching the replacement order, or nullptr
+
+    const char *resident(FilePos file_pos) {
+        if (file_pos >= page_frame.size() || page_frame[file_pos] == -1)
+            return nullptr;
+        return frame(page_frame[file_pos]);
+    }
+
+    /*
+     * resident() for a reader on another thread, inside an epoch of the EpochManager attached: the mapping is read
+     * once, and the frame it gives keeps the page's image until the reader exits, though the owner may evict or free
+     * the page or move the pool meanwhile; the page must be below what reserve_pages() sized the table for, since a
+     * table that grows moves
+     */
+
+    const char *shared_frame(FilePos file_pos) {
+        MemoryPos mem_pos = __atomic_load_n(&page_frame[file_pos], __ATOMIC_ACQUIRE);
+        char *base = __atomic_load_n(&pages, __ATOMIC_ACQUIRE);
+        return mem_pos == -1 ? nullptr : base + frame_stride * mem_pos;
+    }
+
+    void reserve_pages(FilePos count) {
+        page_frame.reserve(count + 1); // resize() to a vector's capacity grows it
+        pin_count.reserve(count + 1);
+        page_version.reserve(count + 1);
+        page_slot.reserve(count + 1);
+    }
+
+    // true when an access to the page will not wait for the file
+
+    bool ready(FilePos file_pos) {
+        if (file_pos >= page_frame.size())
+            return false;
+        if (page_frame[file_pos] != -1)
+            return true;
+        int slot = page_slot[file_pos];
+        return slot != -1 && slot_ready[slot].load(std::memory_order_acquire);
+    }
+
+    int prefetch_depth() {
+        return depth_limit ? depth : 0;
+    }
+
+    void set_read_ahead(int max_depth) {
+
+        // 0 turns read-ahead off
+
+        depth_limit = max_depth < prefetch_slots ? max_depth : prefetch_slots;
+        depth = depth < depth_limit ? depth : depth_limit;
+        if (depth < 1)
+            depth = 1;
+    }
+
+    long long prefetch_issue_count() {
+        return prefetch_issued;
+    }
+
+    long long prefetch_use_count() {
+        return prefetch_used;
+    }
+
+    long long prefetch_waste_count() {
+        return prefetch_wasted;
+    }
+
+    void set_dirty_ratio(double ratio) {
+        dirty_ratio = ratio;
+        update_limits();
+    }
+
+    long long flushed_size() {
+        return flushed_pages;
+    }
+
+    long long write_count() {
+        return write_calls;
+    }
+
+    long long stall_count() {
+        return flush_stalls;
+    }
+
+    bool set_compression(bool enable) {
+
+        // the layout is fixed once a page is on disk, so only a data file still empty can switch
+
+        if (enable == compressed)
+            return true;
+        if (batch_busy || flushed_pages || lseek(data_fd, 0, SEEK_END) > 0)
+            return false;
+        compressed = enable;
+        return true;
+    }
+
+    bool compression() {
+        return compressed;
+    }
+
+    long long disk_size() {
+        return compressed ? (long long) slot_unit * place_end : (long long) page_size * file_size;
+    }
+
+    long long written_size() {
+        return written_bytes;
+    }
+
+    long long compress_time() {
+        return compress_ns;
+    }
+
+    long long decompress_time() {
+        return decompress_ns;
+    }
+
+    long long decompressed_count() {
+        return decompressed_pages;
+    }
+
+    template<typename alloc_type>
+    FilePos alloc_page() {
+
+        FilePos alloc_pos;
+
+        if (recycle_heap.size()) {
+            FilePos top = recycle_heap.top();
+            recycle_heap.pop();
+            alloc_pos = top;
+        }
+        else
+            alloc_pos = file_size++;
+
+        track(alloc_pos);
+        ++page_version[alloc_pos];
+        drop_slot(alloc_pos);
+
+        MemoryPos mem_pos = acquire_frame();
+        new(frame(mem_pos)) alloc_type;
+        map_frame(alloc_pos, mem_pos, frame_cached, true);
+        cache_heap.insert(alloc_pos, mem_pos);
+        ++dirty_count;
+        maintain();
+        return alloc_pos;
+    }
+
+    void free_page(FilePos file_pos) {
+
+        // the content is garbage from now on, so its frame is released without write back
+
+        track(file_pos);
+        ++page_version[file_pos];
+        drop_slot(file_pos);
+
+        MemoryPos mem_pos = page_frame[file_pos];
+        if (mem_pos != -1) {
+            page_frame[file_pos] = -1;
+            frame_page[mem_pos] = -1; // a frame being written is released by harvest instead
+
+            if (frame_state[mem_pos] == frame_pinned) {
+                pin_count[file_pos] = 0;
+                --pinned_frames;
+                release_frame(mem_pos);
+            }
+            else if (frame_state[mem_pos] == frame_cached) {
+                cache_heap.erase(file_pos);
+                if (frame_dirty[mem_pos])
+                    --dirty_count;
+                release_frame(mem_pos);
+            }
+            else if (frame_state[mem_pos] == frame_clean) {
+                unlink_clean(mem_pos);
+                release_frame(mem_pos);
+            }
+        }
+
+        release_page(file_pos);
+    }
+
+    FilePos size() {
+        return file_size;
+    }
+
+    void reset() {
+
+        // empties the file in place, the descriptor is already open so unlinking it would leave writes on an orphan
+
+        backup_abort();
+        changed_pages.resize(0);
+        changes_known = false;
+        ftruncate(data_fd, 0);
+        file_size = 0;
+        while (recycle_heap.size())
+            recycle_heap.pop();
+        retired_pages.resize(0);
+        retired_page_head = 0;
+        page_place.resize(0);
+        for (int units = 1; units <= slot_classes; ++units)
+            free_places[units].resize(0);
+        place_end = 0;
     }
 
 };
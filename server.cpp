@@ -0,0 +1,510 @@
+/*
+ *  long-lived server for the B+ tree engine
+ *  speaks the insert / delete / find protocol of main.cpp, one request per line and no leading count,
+ *  over TCP on 127.0.0.1 (--port=N) or a Unix domain socket (--unix=path)
+ *  only find answers, with the same line print_value writes, so replies follow the order of the finds
+ *  --publish=N publishes a snapshot after every N writes and at shutdown, --replica serves finds from the newest one
+ *  and ignores writes, so several replica processes share one copy of the pages through the kernel's cache
+ *  --memory serves a memory-only tree, read from the tree files at start and written back at shutdown
+ *  --tree=name serves a named tree of the catalog in the data file; the tree tuning and buffer pool flags are those of
+ *  main.cpp, read by tree_flags.h
+ *  --backup=N starts a backup of the pages changed since the last one after every N writes, into
+ *  backup-<time>-<number>.bin, and streams it between batches; the first of a chain is a full backup
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <ctime>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "tree_flags.h"
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int) {
+    stop_requested = 1;
+}
+
+struct Connection {
+    int fd;
+    std::string input; // received bytes not yet parsed, always the start of an incomplete line
+    Vector<std::string> output; // one chunk per served batch, written together by writev
+    int output_head;
+    size_t output_sent; // bytes of output[output_head] already written
+    size_t output_pending; // bytes of output not yet written
+    bool peer_closed;
+    bool want_write;
+    bool reading; // false while the client is too far behind on its replies
+};
+
+class Server {
+
+    static constexpr int max_events = 64, read_chunk = 1 << 16, max_iov = 64;
+    static constexpr int backup_wait_ms = 1; // the longest an idle server waits between two steps of a backup
+
+    /*
+     * a connection reads at most read_round bytes per wakeup, so one busy client cannot make a batch of its whole
+     * backlog; once output_limit bytes of replies wait for a client that does not read them, requests from it are left
+     * in the socket until the replies drain below that, and a line longer than max_line closes the connection
+     */
+
+    static constexpr int read_round = 1 << 20, output_limit = 4 << 20, max_line = 1 << 16;
+
+    BPlusTree &bpt;
+    int listen_fd, epoll_fd;
+    Vector<Connection *> connections; // indexed by fd
+    char read_buffer[read_chunk];
+
+    // consecutive finds of a batch are answered together by find_batch
+    int batch_limit, batch_size;
+    char (*batch_keys)[65];
+    const char **batch_ptrs;
+
+    long long served_requests, served_batches, accepted, write_calls;
+
+    // a snapshot is published once a batch brings the writes since the last one to publish_every
+    int publish_every;
+    long long writes_since_publish, published;
+
+    // a backup starts once a batch brings the writes since the last one to backup_every, then runs beside the batches
+    int backup_every;
+    long long writes_since_backup, backups, backup_started;
+
+    static void set_nonblocking(int fd) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    void watch(Connection *conn, bool write) {
+        epoll_event event;
+        event.events = (conn->reading ? (uint32_t) EPOLLIN : 0u) | (write ? (uint32_t) EPOLLOUT : 0u);
+        event.data.fd = conn->fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+        conn->want_write = write;
+    }
+
+    void accept_all() {
+        while (true) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0)
+                return;
+            set_nonblocking(fd);
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // fails harmlessly on Unix sockets
+
+            Connection *conn = new Connection;
+            conn->fd = fd;
+            conn->output_head = 0;
+            conn->output_sent = 0;
+            conn->output_pending = 0;
+            conn->peer_closed = false;
+            conn->want_write = false;
+            conn->reading = true;
+            while (connections.size() <= fd)
+                connections.push_back(nullptr);
+            connections[fd] = conn;
+
+            epoll_event event;
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+            ++accepted;
+        }
+    }
+
+    void close_connection(Connection *conn) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        close(conn->fd);
+        connections[conn->fd] = nullptr;
+        delete conn;
+    }
+
+    void flush_finds() {
+        if (!batch_size)
+            return;
+        if (batch_size == 1)
+            bpt.print_value(batch_ptrs[0]);
+        else
+            bpt.find_batch(batch_ptrs, batch_size);
+        batch_size = 0;
+    }
+
+    static const char *next_token(const char *&cur, const char *end, int &length) {
+        while (cur < end && *cur <= ' ')
+            ++cur;
+        const char *start = cur;
+        while (cur < end && *cur > ' ')
+            ++cur;
+        length = cur - start;
+        return start;
+    }
+
+    static int parse_int(const char *str, int length) {
+        int x = 0, f = 1, i = 0;
+        if (length && str[0] == '-') {
+            f = -1;
+            ++i;
+        }
+        for (; i < length && '0' <= str[i] && str[i] <= '9'; ++i)
+            x = x * 10 + str[i] - '0';
+        return x * f;
+    }
+
+    void serve(Connection *conn) {
+
+        // runs every complete line received so far as one batch, the replies become one output chunk
+
+        size_t line_end = conn->input.rfind('\n');
+        if (line_end == std::string::npos)
+            return;
+
+        std::ostringstream replies;
+        std::streambuf *saved = std::cout.rdbuf(replies.rdbuf());
+
+        const char *cur = conn->input.data(), *end = cur + line_end + 1;
+        char key[65];
+        while (cur < end) {
+            const char *line = cur;
+            const char *line_stop = static_cast<const char *>(memchr(cur, '\n', end - cur));
+            cur = line_stop + 1;
+
+            int length;
+            const char *command = next_token(line, line_stop, length);
+            if (!length)
+                continue;
+            int command_length = length;
+            const char *key_start = next_token(line, line_stop, length);
+            if (!length)
+                continue;
+            int key_length = length < 64 ? length : 64;
+
+            if (command_length == 4 && strncmp(command, "find", 4) == 0) {
+                if (batch_size == batch_limit)
+                    flush_finds();
+                memcpy(batch_keys[batch_size], key_start, key_length);
+                batch_keys[batch_size++][key_length] = 0;
+                ++served_requests;
+                continue;
+            }
+
+            flush_finds();
+            memcpy(key, key_start, key_length);
+            key[key_length] = 0;
+            const char *value_start = next_token(line, line_stop, length);
+            if (!length)
+                continue;
+            int value = parse_int(value_start, length);
+
+            if (command_length == 6 && strncmp(command, "insert", 6) == 0)
+                bpt.insert(key, value);
+            else if (command_length == 6 && strncmp(command, "delete", 6) == 0)
+                bpt.remove(key, value);
+            else
+                continue;
+            ++served_requests;
+            ++writes_since_publish;
+            ++writes_since_backup;
+        }
+        flush_finds();
+        if (publish_every && writes_since_publish >= publish_every)
+            publish();
+        if (backup_every && writes_since_backup >= backup_every && !bpt.backing_up())
+            start_backup();
+
+        std::cout.rdbuf(saved);
+        conn->input.erase(0, line_end + 1);
+        ++served_batches;
+
+        std::string chunk = replies.str();
+        if (!chunk.empty()) {
+            conn->output_pending += chunk.size();
+            conn->output.push_back(chunk);
+        }
+    }
+
+    bool write_output(Connection *conn) {
+
+        // gathers the pending chunks into one writev, false once the peer is gone
+
+        while (conn->output_head < conn->output.size()) {
+            iovec iov[max_iov];
+            int count = 0;
+            for (int i = conn->output_head; i < conn->output.size() && count < max_iov; ++i, ++count) {
+                size_t skip = i == conn->output_head ? conn->output_sent : 0;
+                iov[count].iov_base = const_cast<char *>(conn->output[i].data()) + skip;
+                iov[count].iov_len = conn->output[i].size() - skip;
+            }
+
+            ssize_t written = writev(conn->fd, iov, count);
+            ++write_calls;
+            if (written < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    if (!conn->want_write)
+                        watch(conn, true);
+                    return true;
+                }
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+
+            conn->output_pending -= written;
+            while (written > 0) {
+                size_t left = conn->output[conn->output_head].size() - conn->output_sent;
+                if ((size_t) written < left) {
+                    conn->output_sent += written;
+                    break;
+                }
+                written -= left;
+                conn->output[conn->output_head++].clear();
+                conn->output_sent = 0;
+            }
+        }
+
+        conn->output.resize(0);
+        conn->output_head = 0;
+        if (conn->want_write)
+            watch(conn, false);
+        return true;
+    }
+
+    void handle(int fd, unsigned events) {
+        Connection *conn = fd < connections.size() ? connections[fd] : nullptr;
+        if (!conn)
+            return;
+
+        if (conn->reading && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+            for (int round = 0; round < read_round; ) {
+                ssize_t got = read(fd, read_buffer, read_chunk);
+                if (got > 0) {
+                    conn->input.append(read_buffer, got);
+                    round += got;
+                    continue;
+                }
+                if (got < 0 && errno == EINTR)
+                    continue;
+                if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                    conn->peer_closed = true;
+                break;
+            }
+            serve(conn);
+            if (conn->input.size() > max_line) {
+                close_connection(conn);
+                return;
+            }
+        }
+
+        if (!write_output(conn) || (conn->peer_closed && conn->output_head == conn->output.size())) {
+            close_connection(conn);
+            return;
+        }
+
+        // the socket holds the requests while reading is off, level-triggered epoll reports them again once it is on
+
+        bool reading = conn->output_pending < output_limit;
+        if (reading != conn->reading) {
+            conn->reading = reading;
+            watch(conn, conn->want_write);
+        }
+    }
+
+public:
+
+    Server(BPlusTree &bpt, int listen_fd, int batch_limit, int publish_every, int backup_every) :
+            bpt(bpt), listen_fd(listen_fd), batch_limit(batch_limit), batch_size(0),
+            served_requests(0), served_batches(0), accepted(0), write_calls(0),
+            publish_every(publish_every), writes_since_publish(0), published(0),
+            backup_every(backup_every), writes_since_backup(0), backups(0), backup_started(time(nullptr)) {
+        batch_keys = new char[batch_limit][65];
+        batch_ptrs = new const char *[batch_limit];
+        for (int i = 0; i < batch_limit; ++i)
+            batch_ptrs[i] = batch_keys[i];
+
+        set_nonblocking(listen_fd);
+        epoll_fd = epoll_create1(0);
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = listen_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    }
+
+    ~Server() {
+        for (int i = 0; i < connections.size(); ++i)
+            if (connections[i])
+                close_connection(connections[i]);
+        close(epoll_fd);
+        delete[] batch_keys;
+        delete[] batch_ptrs;
+    }
+
+    void run() {
+
+        // a running backup takes a step per round, an idle loop waits backup_wait_ms for requests instead of spinning
+
+        epoll_event events[max_events];
+        while (!stop_requested) {
+            int ready = epoll_wait(epoll_fd, events, max_events, bpt.backing_up() ? backup_wait_ms : -1);
+            for (int i = 0; i < ready; ++i) {
+                if (events[i].data.fd == listen_fd)
+                    accept_all();
+                else
+                    handle(events[i].data.fd, events[i].events);
+            }
+            if (bpt.backing_up())
+                step_backup();
+        }
+    }
+
+    void publish() {
+        if (bpt.publish())
+            ++published;
+        else
+            std::cerr << "publish failed\n";
+        writes_since_publish = 0;
+    }
+
+    void start_backup() {
+        char path[64];
+        snprintf(path, sizeof(path), "backup-%lld-%06lld.bin", backup_started, backups + 1);
+        if (!bpt.backup_begin(path, true))
+            std::cerr << "backup to " << path << " failed\n";
+        writes_since_backup = 0;
+    }
+
+    void step_backup() {
+        long long left = bpt.backup_step();
+        if (left == 0)
+            ++backups;
+        else if (left < 0)
+            std::cerr << "backup failed\n";
+    }
+
+    void finish() {
+
+        // a backup under way is completed, the writes after it go into the next one
+
+        if (publish_every && writes_since_publish)
+            publish();
+        while (bpt.backing_up())
+            step_backup();
+    }
+
+    void print_stats() {
+        std::cerr << "server: " << accepted << " connections, " << served_requests << " requests in "
+                  << served_batches << " batches, " << write_calls << " writes, " << published << " snapshots, "
+                  << backups << " backups\n";
+    }
+};
+
+int open_listener(int port, const char *unix_path) {
+    int fd;
+    if (unix_path) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, unix_path, sizeof(addr.sun_path) - 1);
+        unlink(unix_path);
+        if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+            return -1;
+    }
+    else {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+            return -1;
+    }
+    if (listen(fd, 128) < 0)
+        return -1;
+    return fd;
+}
+
+int main(int argc, char **argv) {
+    std::ios::sync_with_stdio(false);
+
+    int port = 7070, batch_limit = 64;
+    const char *unix_path = nullptr;
+    bool print_stats = false;
+    int publish_every = 0, backup_every = 0;
+
+    // a replica, a memory-only or a catalog tree is opened as one, so these flags are looked at before the tree exists
+    TreeFlags flags;
+    read_open_flags(argc, argv, flags);
+    BPlusTree::Catalog *catalog;
+    BPlusTree *tree = open_flagged_tree(flags, catalog);
+    if (!tree)
+        return 1;
+    BPlusTree &bpt = *tree;
+
+    for (int i = 1; i < argc; ++i) {
+        if (apply_tree_flag(bpt, argv[i], flags))
+            continue;
+        if (strncmp(argv[i], "--port=", 7) == 0)
+            port = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--unix=", 7) == 0)
+            unix_path = argv[i] + 7;
+        else if (strncmp(argv[i], "--find-batch=", 13) == 0)
+            batch_limit = atoi(argv[i] + 13) > 1 ? atoi(argv[i] + 13) : 1;
+        else if (strncmp(argv[i], "--publish=", 10) == 0)
+            publish_every = atoi(argv[i] + 10) > 0 ? atoi(argv[i] + 10) : 0;
+        else if (strncmp(argv[i], "--backup=", 9) == 0)
+            backup_every = atoi(argv[i] + 9) > 0 ? atoi(argv[i] + 9) : 0;
+        else if (strcmp(argv[i], "--stats") == 0)
+            print_stats = true;
+    }
+    apply_pool_flags(bpt, flags);
+
+    if (backup_every && (flags.replica || flags.memory || flags.tree_name)) {
+        std::cerr << "--backup ignored, a replica, memory-only or catalog tree has no file of its own to back up\n";
+        backup_every = 0;
+    }
+
+    int listen_fd = open_listener(port, unix_path);
+    if (listen_fd < 0) {
+        std::cerr << "cannot listen: " << strerror(errno) << '\n';
+        delete tree;
+        delete catalog;
+        return 1;
+    }
+
+    // SIGINT / SIGTERM end the loop, the tree then closes normally and is durable
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    {
+        Server server(bpt, listen_fd, batch_limit, publish_every, backup_every);
+        server.run();
+        server.finish();
+        if (flags.memory && !bpt.persist())
+            std::cerr << "cannot write the tree files\n";
+        if (print_stats)
+            server.print_stats();
+    }
+    close(listen_fd);
+    if (unix_path)
+        unlink(unix_path);
+    delete tree;
+    delete catalog;
+    return 0;
+}
@@ -0,0 +1,390 @@
+/*
+ *  maintenance tool for the database in the working directory
+ *  usage: tool verify [--threads=N] [--tree=name]
+ *         tool export <file | -> [--tree=name]
+ *         tool import <file | -> [--fill-factor=P] [--tree=name]
+ *         tool load <file | -> [--memory=MB] [--threads=N] [--fill-factor=P] [--tree=name]
+ *         tool replay <trace> [--copy=dir] [--timed] [--output=file]
+ *         tool backup <file> [--incremental]
+ *         tool restore <full backup> [incremental backup ...]
+ *  verify walks the whole file and exits with 1 when it finds errors; export writes every entry in index order,
+ *  import loads such a dump into an empty database; "-" is stdout or stdin, and the summary goes to stderr
+ *  load builds an empty database from "key value" lines in any order, sorted in --memory MB (256) and spilled to
+ *  TMPDIR beyond that, on --threads threads (all cores)
+ *  --tree=name works on a named tree of the catalog in the data file instead of the file's only tree
+ *  replay runs a trace recorded by main --record against a copy of the database made in dir (./replay), as fast
+ *  as it can or with the recorded gaps, and reports latency by command and time and hardware counters by phase
+ *  backup writes a full backup of the database, or with --incremental the pages changed since the last backup;
+ *  restore rebuilds the database in an empty working directory from a full backup and the incremental ones taken
+ *  after it, in order
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "b_plus_tree.h"
+#include "utils/trace.h"
+#include "utils/qsort.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static double file_mb(const char *path) {
+    struct stat info;
+    if (strcmp(path, "-") == 0 || stat(path, &info) != 0)
+        return 0;
+    return info.st_size / 1048576.0;
+}
+
+static int usage() {
+    std::cerr << "usage: tool verify [--threads=N] | tool export <file|-> | tool import <file|-> [--fill-factor=P]\n"
+                 "       tool load <file|-> [--memory=MB] [--threads=N] [--fill-factor=P]\n"
+                 "       tool replay <trace> [--copy=dir] [--timed] [--output=file]\n"
+                 "       tool backup <file> [--incremental] | tool restore <full backup> [incremental backup ...]\n"
+                 "       verify, export, import and load take --tree=name for a named tree of a catalog\n";
+    return 2;
+}
+
+static void copy_file(const std::string &from, const std::string &to) {
+
+    // a file missing at the source is removed at the target, so the copy never mixes two databases
+
+    std::ifstream in(from, std::ios::binary);
+    if (!in.is_open()) {
+        std::remove(to.c_str());
+        return;
+    }
+    std::ofstream out(to, std::ios::binary | std::ios::trunc);
+    out << in.rdbuf();
+}
+
+static BPlusTree *open_tree(int argc, char **argv, BPlusTree::Catalog *&catalog, bool create) {
+
+    // the file's only tree, or with --tree=name that tree of its catalog; nullptr, with the reason printed, when there
+    // is no such tree and create is false
+
+    catalog = nullptr;
+    const char *name = nullptr;
+    for (int i = 2; i < argc; ++i)
+        if (strncmp(argv[i], "--tree=", 7) == 0)
+            name = argv[i] + 7;
+    if (!name) {
+        struct stat info;
+        if (file_mb("data.bin") > 0 && stat("root.bin", &info) != 0) {
+            std::cerr << "the data file has no root file, the trees of a catalog are picked with --tree=name\n";
+            return nullptr;
+        }
+        return new BPlusTree;
+    }
+
+    catalog = new BPlusTree::Catalog;
+    BPlusTree *tree = catalog->opened() && (create || catalog->contains(name)) ? catalog->open(name) : nullptr;
+    if (!tree) {
+        std::cerr << (catalog->opened() ? "no tree named " : "the data file holds no catalog for ") << name << '\n';
+        delete catalog;
+        catalog = nullptr;
+    }
+    return tree;
+}
+
+static int replay(int argc, char **argv) {
+    std::string copy_dir = "replay";
+    const char *output_path = "/dev/null";
+    bool timed = false;
+    for (int i = 3; i < argc; ++i) {
+        if (strncmp(argv[i], "--copy=", 7) == 0)
+            copy_dir = argv[i] + 7;
+        else if (strncmp(argv[i], "--output=", 9) == 0)
+            output_path = argv[i] + 9;
+        else if (strcmp(argv[i], "--timed") == 0)
+            timed = true;
+    }
+
+    TraceReader trace(argv[2]);
+    if (!trace.opened()) {
+        std::cerr << "cannot read trace " << argv[2] << '\n';
+        return 1;
+    }
+    std::ofstream output(output_path);
+    if (!output.is_open()) {
+        std::cerr << "cannot write " << output_path << '\n';
+        return 1;
+    }
+
+    mkdir(copy_dir.c_str(), 0755);
+    copy_file(BPlusTree::data_path, copy_dir + "/" + BPlusTree::data_path);
+    copy_file(BPlusTree::info_path, copy_dir + "/" + BPlusTree::info_path);
+    copy_file(BPlusTree::root_path, copy_dir + "/" + BPlusTree::root_path);
+    if (chdir(copy_dir.c_str()) != 0) {
+        std::cerr << "cannot enter " << copy_dir << '\n';
+        return 1;
+    }
+
+    // microseconds per command, by trace op
+
+    const char *op_names[3] = {"insert", "delete", "find"};
+    Vector<double> latency[3];
+    PhaseProfiler profiler;
+    long long commands = 0;
+    double elapsed;
+    {
+        BPlusTree tree;
+        tree.set_profiler(&profiler);
+        std::streambuf *saved = std::cout.rdbuf(output.rdbuf());
+
+        TraceRecord record;
+        Clock::time_point start = Clock::now(), due = start;
+        profiler.start();
+        while (trace.next(record)) {
+            due += std::chrono::microseconds(record.gap_us);
+            if (timed)
+                std::this_thread::sleep_until(due);
+            Clock::time_point begin = Clock::now();
+            if (record.op == trace_insert)
+                tree.insert(record.key, record.value);
+            else if (record.op == trace_delete)
+                tree.remove(record.key, record.value);
+            else
+                tree.print_value(record.key);
+            latency[record.op].push_back(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+            ++commands;
+        }
+        profiler.stop();
+        elapsed = seconds_since(start);
+        std::cout.rdbuf(saved);
+        tree.set_profiler(nullptr);
+    }
+
+    std::cerr << "replayed " << commands << " commands in " << elapsed << " s, "
+              << (long long) (elapsed > 0 ? commands / elapsed : 0) << " commands/s"
+              << (timed ? " with the recorded gaps\n" : "\n");
+    for (int op = 0; op < 3; ++op) {
+        int count = latency[op].size();
+        if (!count)
+            continue;
+        qsort(&latency[op][0], &latency[op][0] + count);
+        double total = 0;
+        for (int i = 0; i < count; ++i)
+            total += latency[op][i];
+        std::cerr << op_names[op] << ": " << count << " commands, mean " << total / count << " us, p50 "
+                  << latency[op][count / 2] << " us, p99 " << latency[op][(int) (count * 0.99)] << " us, max "
+                  << latency[op][count - 1] << " us\n";
+    }
+
+    // counters per command, so two replays of one trace compare directly
+
+    const char *phase_names[BPlusTree::phase_count] = {"other", "descent", "leaf search", "split/merge", "I/O"};
+    const char *counter_names[PhaseProfiler::counter_count] = {"cycles", "instructions", "LLC misses", "dTLB misses"};
+    long long total_ns = 0;
+    for (int phase = 0; phase < BPlusTree::phase_count; ++phase)
+        total_ns += profiler.phase(phase).ns;
+    std::cerr << "by phase, counters per command:\n";
+    for (int phase = 0; phase < BPlusTree::phase_count; ++phase) {
+        const PhaseProfiler::Totals &spent = profiler.phase(phase);
+        std::cerr << phase_names[phase] << ": " << spent.ns / 1e6 << " ms ("
+                  << (total_ns ? spent.ns * 100.0 / total_ns : 0) << "%)";
+        for (int counter = 0; counter < PhaseProfiler::counter_count; ++counter)
+            if (profiler.counting(counter))
+                std::cerr << ", " << (commands ? (double) spent.counter[counter] / commands : 0) << ' '
+                          << counter_names[counter];
+        if (profiler.counting(PhaseProfiler::cycles) && profiler.counting(PhaseProfiler::instructions) &&
+            spent.counter[PhaseProfiler::cycles])
+            std::cerr << ", IPC " << (double) spent.counter[PhaseProfiler::instructions] / spent.counter[PhaseProfiler::cycles];
+        std::cerr << '\n';
+    }
+    if (!profiler.counting(PhaseProfiler::cycles))
+        std::cerr << "hardware counters not available, perf_event_open was refused\n";
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2)
+        return usage();
+
+    if (strcmp(argv[1], "verify") == 0) {
+        int threads = 0;
+        for (int i = 2; i < argc; ++i)
+            if (strncmp(argv[i], "--threads=", 10) == 0)
+                threads = atoi(argv[i] + 10);
+        BPlusTree::Catalog *catalog;
+        BPlusTree *tree = open_tree(argc, argv, catalog, false);
+        if (!tree)
+            return 1;
+        Clock::time_point start = Clock::now();
+        BPlusTree::Report report = tree->verify(threads);
+        double elapsed = seconds_since(start);
+        delete tree;
+        delete catalog;
+        double mb = file_mb("data.bin");
+
+        std::cerr << report.messages;
+        std::cerr << "depth " << report.depth << ", " << report.leaf_pages << " leaves, " << report.internal_pages
+                  << " internal, " << report.free_pages << " free, " << report.unreachable_pages << " unreachable, "
+                  << report.entries << " entries\n";
+        std::cerr << "verified " << mb << " MB in " << elapsed << " s, " << (elapsed > 0 ? mb / elapsed : 0)
+                  << " MB/s, " << report.errors << " errors\n";
+        return report.errors ? 1 : 0;
+    }
+
+    if (strcmp(argv[1], "export") == 0) {
+        if (argc < 3)
+            return usage();
+        BPlusTree::Catalog *catalog;
+        BPlusTree *tree = open_tree(argc, argv, catalog, false);
+        if (!tree)
+            return 1;
+        Clock::time_point start = Clock::now();
+        bool ok = tree->export_to(argv[2]);
+        double elapsed = seconds_since(start);
+        delete tree;
+        delete catalog;
+        if (!ok) {
+            std::cerr << "export to " << argv[2] << " failed\n";
+            return 1;
+        }
+        double mb = file_mb(argv[2]);
+        std::cerr << "exported " << mb << " MB in " << elapsed << " s, " << (elapsed > 0 ? mb / elapsed : 0) << " MB/s\n";
+        return 0;
+    }
+
+    if (strcmp(argv[1], "import") == 0) {
+        if (argc < 3)
+            return usage();
+        BPlusTree::Catalog *catalog;
+        BPlusTree *tree = open_tree(argc, argv, catalog, true);
+        if (!tree)
+            return 1;
+        for (int i = 3; i < argc; ++i)
+            if (strncmp(argv[i], "--fill-factor=", 14) == 0)
+                tree->set_fill_factor(atoi(argv[i] + 14));
+        Clock::time_point start = Clock::now();
+        bool ok = tree->import_from(argv[2]);
+        double elapsed = seconds_since(start);
+        delete tree;
+        delete catalog;
+        if (!ok) {
+            std::cerr << "import from " << argv[2] << " failed: the database is not empty or the dump is not valid\n";
+            return 1;
+        }
+        double mb = file_mb(argv[2]);
+        std::cerr << "imported " << mb << " MB in " << elapsed << " s, " << (elapsed > 0 ? mb / elapsed : 0) << " MB/s\n";
+        return 0;
+    }
+
+    if (strcmp(argv[1], "load") == 0) {
+        if (argc < 3)
+            return usage();
+        long long memory_mb = 256;
+        int threads = 0;
+        for (int i = 3; i < argc; ++i) {
+            if (strncmp(argv[i], "--memory=", 9) == 0)
+                memory_mb = atoll(argv[i] + 9);
+            else if (strncmp(argv[i], "--threads=", 10) == 0)
+                threads = atoi(argv[i] + 10);
+        }
+        std::ifstream file;
+        if (strcmp(argv[2], "-") != 0) {
+            file.open(argv[2]);
+            if (!file.is_open()) {
+                std::cerr << "cannot read " << argv[2] << '\n';
+                return 1;
+            }
+        }
+        std::istream &in = strcmp(argv[2], "-") == 0 ? std::cin : file;
+
+        BPlusTree::Catalog *catalog;
+        BPlusTree *tree = open_tree(argc, argv, catalog, true);
+        if (!tree)
+            return 1;
+        for (int i = 3; i < argc; ++i)
+            if (strncmp(argv[i], "--fill-factor=", 14) == 0)
+                tree->set_fill_factor(atoi(argv[i] + 14));
+        Clock::time_point start = Clock::now();
+        bool ok;
+        long long entries;
+        int runs;
+        {
+            BPlusTree::BulkLoader loader(*tree, memory_mb * 1048576 / sizeof(BPlusTree::Data), threads);
+            std::string key;
+            int value;
+            while (in >> key >> value)
+                loader.add(key.substr(0, 64).c_str(), value);
+            ok = loader.finish();
+            entries = loader.size();
+            runs = loader.spilled_runs();
+        }
+        double elapsed = seconds_since(start);
+        delete tree;
+        delete catalog;
+        if (!ok) {
+            std::cerr << "load from " << argv[2] << " failed: the database is not empty or a sorted run was lost\n";
+            return 1;
+        }
+        std::cerr << "loaded " << entries << " entries in " << elapsed << " s, "
+                  << (long long) (elapsed > 0 ? entries / elapsed : 0) << " entries/s, " << runs
+                  << (runs == 1 ? " run" : " runs") << " spilled\n";
+        return 0;
+    }
+
+    if (strcmp(argv[1], "replay") == 0)
+        return argc < 3 ? usage() : replay(argc, argv);
+
+    if (strcmp(argv[1], "backup") == 0) {
+        if (argc < 3)
+            return usage();
+        bool incremental = false;
+        for (int i = 3; i < argc; ++i)
+            if (strcmp(argv[i], "--incremental") == 0)
+                incremental = true;
+        BPlusTree::Catalog *catalog;
+        BPlusTree *tree = open_tree(argc, argv, catalog, false);
+        if (!tree)
+            return 1;
+        Clock::time_point start = Clock::now();
+        bool ok = tree->backup(argv[2], incremental);
+        bool full = tree->backup_full();
+        double elapsed = seconds_since(start);
+        delete tree;
+        delete catalog;
+        if (!ok) {
+            std::cerr << "backup to " << argv[2] << " failed\n";
+            return 1;
+        }
+        double mb = file_mb(argv[2]);
+        std::cerr << (full ? "full" : "incremental") << " backup of " << mb << " MB in " << elapsed << " s"
+                  << (full && incremental ? ", no earlier backup to follow" : "") << '\n';
+        return 0;
+    }
+
+    if (strcmp(argv[1], "restore") == 0) {
+        if (argc < 3)
+            return usage();
+        if (file_mb(BPlusTree::data_path) > 0) {
+            std::cerr << "the working directory already holds a database, restore writes into an empty one\n";
+            return 1;
+        }
+        Clock::time_point start = Clock::now();
+        int applied = BPlusTree::restore(argv + 2, argc - 2);
+        double elapsed = seconds_since(start);
+        if (applied != argc - 2) {
+            std::cerr << argv[2 + applied] << (applied ? " is cut short or does not follow the backup before it"
+                                                       : " is not a full backup") << ", nothing restored\n";
+            return 1;
+        }
+        std::cerr << "restored " << file_mb(BPlusTree::data_path) << " MB from " << applied << " backups in "
+                  << elapsed << " s\n";
+        return 0;
+    }
+
+    return usage();
+}
@@ -0,0 +1,113 @@
+#ifndef TREE_FLAGS_H
+#define TREE_FLAGS_H
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include "b_plus_tree.h"
+
+/*
+ * the tree flags main.cpp and server.cpp share, in three steps: read_open_flags looks at the flags that decide how
+ * the tree is opened, before it exists; apply_tree_flag takes one argument at a time once it is open, and says
+ * whether the argument was a tree flag, so each binary parses only its own; apply_pool_flags moves the buffer pool
+ * after all of them are read
+ */
+
+struct TreeFlags {
+    // --replica opens the newest published snapshot, --memory loads the tree files into memory at start and writes
+    // them back at exit, --tree=name works on a named tree of the catalog in the data file, which holds many of them
+    bool replica, memory;
+    const char *tree_name;
+    int huge_pages, numa;
+    long long pool_mb, pool_budget_mb;
+
+    TreeFlags() : replica(false), memory(false), tree_name(nullptr), huge_pages(FrameArena::small_pages),
+                  numa(FrameArena::numa_default), pool_mb(0), pool_budget_mb(0) {}
+};
+
+inline void read_open_flags(int argc, char **argv, TreeFlags &flags) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--replica") == 0)
+            flags.replica = true;
+        else if (strcmp(argv[i], "--memory") == 0)
+            flags.memory = true;
+        else if (strncmp(argv[i], "--tree=", 7) == 0)
+            flags.tree_name = argv[i] + 7;
+    }
+}
+
+// null when the catalog cannot hold the named tree; a catalog tree is neither a replica nor memory-only
+inline BPlusTree *open_flagged_tree(TreeFlags &flags, BPlusTree::Catalog *&catalog) {
+    catalog = flags.tree_name ? new BPlusTree::Catalog : nullptr;
+    BPlusTree *tree = catalog ? catalog->open(flags.tree_name) :
+                      flags.replica ? new BPlusTree(BPlusTree::replica) :
+                      flags.memory ? new BPlusTree(BPlusTree::memory_only, true) : new BPlusTree(false);
+    if (!tree) {
+        std::cerr << "cannot open tree " << flags.tree_name << ": the data file holds no catalog, or it is full\n";
+        delete catalog;
+        catalog = nullptr;
+        return nullptr;
+    }
+    if (catalog)
+        flags.replica = flags.memory = false;
+    return tree;
+}
+
+inline bool apply_tree_flag(BPlusTree &bpt, const char *arg, TreeFlags &flags) {
+    if (strncmp(arg, "--hint-cache=", 13) == 0)
+        bpt.enable_hint_cache(atoll(arg + 13));
+    else if (strncmp(arg, "--mem-table=", 12) == 0)
+        bpt.enable_mem_table(atoi(arg + 12));
+    else if (strncmp(arg, "--fill-factor=", 14) == 0)
+        bpt.set_fill_factor(atoi(arg + 14));
+    else if (strncmp(arg, "--lazy-delete=", 14) == 0)
+        bpt.set_lazy_delete(atoi(arg + 14));
+    else if (strncmp(arg, "--read-ahead=", 13) == 0)
+        bpt.set_read_ahead(atoi(arg + 13));
+    else if (strncmp(arg, "--dirty-ratio=", 14) == 0)
+        bpt.set_dirty_ratio(atof(arg + 14));
+    else if (strcmp(arg, "--write-optimized") == 0)
+        bpt.set_write_optimized(true);
+    else if (strcmp(arg, "--no-write-optimized") == 0)
+        bpt.set_write_optimized(false);
+    else if (strcmp(arg, "--compress") == 0) {
+        if (!bpt.set_compression(true))
+            std::cerr << "--compress ignored, the data file already holds uncompressed pages\n";
+    }
+    else if (strncmp(arg, "--huge-pages=", 13) == 0)
+        flags.huge_pages = strcmp(arg + 13, "explicit") == 0 ? FrameArena::explicit_huge_pages :
+                           strcmp(arg + 13, "transparent") == 0 ? FrameArena::transparent_huge_pages :
+                           FrameArena::small_pages;
+    else if (strncmp(arg, "--numa=", 7) == 0)
+        flags.numa = strcmp(arg + 7, "interleave") == 0 ? FrameArena::numa_interleave : atoi(arg + 7);
+    else if (strncmp(arg, "--pool=", 7) == 0)
+        flags.pool_mb = atoll(arg + 7);
+    else if (strncmp(arg, "--pool-budget=", 14) == 0)
+        flags.pool_budget_mb = atoll(arg + 14);
+    else
+        return false;
+    return true;
+}
+
+inline void apply_pool_flags(BPlusTree &bpt, TreeFlags &flags) {
+    if (flags.memory && (flags.huge_pages != FrameArena::small_pages || flags.numa != FrameArena::numa_default ||
+                         flags.pool_mb || flags.pool_budget_mb)) {
+        std::cerr << "--huge-pages, --numa and --pool ignored, a memory-only tree has no buffer pool\n";
+        flags.huge_pages = FrameArena::small_pages;
+        flags.numa = FrameArena::numa_default;
+        flags.pool_mb = flags.pool_budget_mb = 0;
+    }
+
+    // the buffer pool moves once, after both of its flags are known
+    if ((flags.huge_pages != FrameArena::small_pages || flags.numa != FrameArena::numa_default) &&
+        !bpt.set_frame_arena(flags.huge_pages, flags.numa))
+        std::cerr << "--huge-pages and --numa ignored, no memory for a new buffer pool\n";
+
+    // sizes in MB; with a budget the pool starts at --pool, or where it is, and finds its own size from there
+    if (flags.pool_mb > 0 && !bpt.set_pool_size(flags.pool_mb << 20))
+        std::cerr << "--pool ignored, no memory for a pool that large\n";
+    if (flags.pool_budget_mb > 0)
+        bpt.set_pool_budget(flags.pool_budget_mb << 20);
+}
+
+#endif
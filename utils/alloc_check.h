@@ -0,0 +1,110 @@
+#ifndef UTILS_ALLOC_CHECK_H
+#define UTILS_ALLOC_CHECK_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+/*
+ * a debug check that hot paths stay off the heap: a program built with BPT_ALLOC_CHECK gets a global operator new
+ * that counts the calling thread's allocations, and an armed AllocationCheck aborts when its scope made any
+ * the replacement is defined here, so only a program of one translation unit that includes this can set the flag;
+ * without it nothing is counted and a check costs nothing
+ */
+
+inline thread_local long long heap_allocations = 0;
+
+#ifdef BPT_ALLOC_CHECK
+
+static void *counted_allocation(std::size_t size, std::size_t align) {
+    ++heap_allocations;
+    void *memory = align > alignof(std::max_align_t) ? std::aligned_alloc(align, (size + align - 1) / align * align)
+                                                    : std::malloc(size ? size : 1);
+    if (!memory)
+        throw std::bad_alloc();
+    return memory;
+}
+
+void *operator new(std::size_t size) {
+    return counted_allocation(size, 0);
+}
+
+void *operator new[](std::size_t size) {
+    return counted_allocation(size, 0);
+}
+
+void *operator new(std::size_t size, std::align_val_t align) {
+    return counted_allocation(size, (std::size_t) align);
+}
+
+void *operator new[](std::size_t size, std::align_val_t align) {
+    return counted_allocation(size, (std::size_t) align);
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory, std::size_t, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+#endif
+
+class AllocationCheck {
+
+#ifdef BPT_ALLOC_CHECK
+
+    const char *operation;
+    long long start;
+
+public:
+
+    AllocationCheck(bool armed, const char *operation) : operation(armed ? operation : nullptr),
+                                                         start(heap_allocations) {}
+
+    ~AllocationCheck() {
+        if (operation && heap_allocations != start) {
+            fprintf(stderr, "%s made %lld heap allocations in steady state\n", operation, heap_allocations - start);
+            abort();
+        }
+    }
+
+#else
+
+public:
+
+    AllocationCheck(bool, const char *) {}
+
+#endif
+
+    AllocationCheck(const AllocationCheck &) = delete;
+
+    AllocationCheck &operator=(const AllocationCheck &) = delete;
+};
+
+#endif
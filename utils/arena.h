@@ -0,0 +1,104 @@
+#ifndef UTILS_ARENA_H
+#define UTILS_ARENA_H
+
+#include <cstddef>
+#include <new>
+
+/*
+ * a bump allocator over blocks: allocate() carves from the current block and moves to the next when it is full,
+ * nothing is freed one by one; reset() drops everything handed out but keeps the blocks, so a container that is
+ * filled and emptied over and over stops allocating once the arena has grown to its high water mark
+ */
+
+class Arena {
+
+    struct Block {
+        char *memory;
+        long long size;
+    };
+
+    Block *blocks;
+    int block_count, block_space;
+    int current; // the block allocations come from
+    long long used; // bytes taken from it
+    long long block_size;
+
+    void add_block(long long size) {
+        if (block_count == block_space) {
+            block_space = block_space ? block_space * 2 : 8;
+            Block *grown = static_cast<Block *>(::operator new(sizeof(Block) * block_space));
+            for (int i = 0; i < block_count; ++i)
+                grown[i] = blocks[i];
+            ::operator delete(blocks);
+            blocks = grown;
+        }
+        blocks[block_count].memory = static_cast<char *>(::operator new(size));
+        blocks[block_count].size = size;
+        ++block_count;
+    }
+
+public:
+
+    static constexpr long long default_block_size = 1 << 16;
+
+    explicit Arena(long long block_size = default_block_size) :
+            blocks(nullptr), block_count(0), block_space(0), current(0), used(0), block_size(block_size) {}
+
+    Arena(const Arena &) = delete;
+
+    Arena &operator=(const Arena &) = delete;
+
+    ~Arena() {
+        release();
+    }
+
+    void *allocate(long long size, long long align = alignof(std::max_align_t)) {
+        while (current < block_count) {
+            long long start = (used + align - 1) / align * align;
+            if (start + size <= blocks[current].size) {
+                used = start + size;
+                return blocks[current].memory + start;
+            }
+            ++current; // blocks are aligned for anything, so a fresh one fits whatever its size allows
+            used = 0;
+        }
+        add_block(size > block_size ? size : block_size);
+        used = size;
+        return blocks[current].memory;
+    }
+
+    // blocks for bytes more, so that many come without a call into the heap
+
+    void reserve(long long bytes) {
+        long long spare = current < block_count ? blocks[current].size - used : 0;
+        for (int i = current + 1; i < block_count; ++i)
+            spare += blocks[i].size;
+        while (spare < bytes) {
+            add_block(block_size);
+            spare += block_size;
+        }
+    }
+
+    void reset() {
+        current = 0;
+        used = 0;
+    }
+
+    void release() {
+        for (int i = 0; i < block_count; ++i)
+            ::operator delete(blocks[i].memory);
+        ::operator delete(blocks);
+        blocks = nullptr;
+        block_count = block_space = 0;
+        reset();
+    }
+
+    long long capacity() const {
+        long long result = 0;
+        for (int i = 0; i < block_count; ++i)
+            result += blocks[i].size;
+        return result;
+    }
+};
+
+#endif
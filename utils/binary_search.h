@@ -20,5 +20,26 @@ int binary_search(T *arr, int size, const T &val) {
     return result;
 }
 
+// first element greater than val, where binary_search finds the first not less than it
+
+template<typename T>
+int upper_search(T *arr, int size, const T &val) {
+    int left = 0;
+    int right = size - 1;
+    int result = size;
+
+    while (left <= right) {
+        int mid = left + (right - left) / 2;
+        if (val < arr[mid]) {
+            result = mid;
+            right = mid - 1;
+        }
+        else {
+            left = mid + 1;
+        }
+    }
+    return result;
+}
+
 
 #endif
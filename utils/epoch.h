@@ -0,0 +1,145 @@
+#ifndef UTILS_EPOCH_H
+#define UTILS_EPOCH_H
+
+#include <atomic>
+#include <thread>
+#include <climits>
+
+/*
+ * epoch based reclamation: a reader announces the global epoch when it starts and clears it when done, a writer
+ * retires what it unlinked under the epoch current at that moment and advances it; the item may be reused once every
+ * announced epoch is past the retiring one, since a reader that started later could not have reached it
+ * a reader joins once for a slot, then entering is a store and a fence, leaving a store
+ */
+
+class EpochManager {
+public:
+
+    static constexpr int max_readers = 64;
+    static constexpr long long idle = LLONG_MAX;
+
+private:
+
+    struct alignas(64) Slot {
+        std::atomic<long long> epoch;
+        std::atomic<bool> taken;
+        std::atomic<std::thread::id> owner;
+    };
+
+    Slot slot[max_readers];
+    alignas(64) std::atomic<long long> global;
+    std::atomic<long long> waits;
+
+public:
+
+    EpochManager() : global(1), waits(0) {
+        for (int i = 0; i < max_readers; ++i) {
+            slot[i].epoch.store(idle, std::memory_order_relaxed);
+            slot[i].taken.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    EpochManager(const EpochManager &) = delete;
+
+    EpochManager &operator=(const EpochManager &) = delete;
+
+    // a slot for the calling thread, -1 when all are taken
+
+    int join() {
+        for (int i = 0; i < max_readers; ++i) {
+            bool expected = false;
+            if (!slot[i].taken.load(std::memory_order_relaxed) &&
+                slot[i].taken.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                slot[i].owner.store(std::this_thread::get_id(), std::memory_order_relaxed);
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void leave(int reader) {
+        slot[reader].epoch.store(idle, std::memory_order_relaxed);
+        slot[reader].owner.store(std::thread::id(), std::memory_order_relaxed);
+        slot[reader].taken.store(false, std::memory_order_release);
+    }
+
+    void enter(int reader) {
+
+        // the fence orders the announcement before every read of shared state that follows
+
+        slot[reader].epoch.store(global.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void exit(int reader) {
+        slot[reader].epoch.store(idle, std::memory_order_release);
+    }
+
+    long long retire() {
+
+        // the epoch for something just unlinked, readers that announce a later one cannot see it
+
+        return global.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    long long oldest() const {
+
+        // the epoch of the oldest reader in progress on another thread, idle without one; the calling thread is left
+        // out, whatever it holds is the business of its own code
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::thread::id self = std::this_thread::get_id();
+        long long result = idle;
+        for (int i = 0; i < max_readers; ++i) {
+            long long epoch = slot[i].epoch.load(std::memory_order_acquire);
+            if (epoch < result && slot[i].owner.load(std::memory_order_relaxed) != self)
+                result = epoch;
+        }
+        return result;
+    }
+
+    bool reclaimable(long long retired) const {
+        return oldest() > retired;
+    }
+
+    void wait(long long retired) {
+
+        // until the readers that may hold what was retired under that epoch are gone, they are short
+
+        if (reclaimable(retired))
+            return;
+        waits.fetch_add(1, std::memory_order_relaxed);
+        while (!reclaimable(retired))
+            std::this_thread::yield();
+    }
+
+    long long wait_count() const {
+        return waits.load(std::memory_order_relaxed);
+    }
+
+    // a read section of a joined reader, a null manager costs a branch
+
+    class Guard {
+
+        EpochManager *epochs;
+        int reader;
+
+    public:
+
+        Guard(EpochManager *epochs, int reader) : epochs(reader >= 0 ? epochs : nullptr), reader(reader) {
+            if (this->epochs)
+                this->epochs->enter(reader);
+        }
+
+        Guard(const Guard &) = delete;
+
+        Guard &operator=(const Guard &) = delete;
+
+        ~Guard() {
+            if (epochs)
+                epochs->exit(reader);
+        }
+    };
+};
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef UTILS_FRAME_ARENA_H
+#define UTILS_FRAME_ARENA_H
+
+#include <cstdio>
+#include <cstdint>
+#include <utility>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/*
+ * one anonymous mapping for the page frames, aligned to the page it is backed by, so every frame whose size is a
+ * multiple of 512 sits on cache line and O_DIRECT boundaries
+ * huge pages are asked for in steps: explicit ones from the hugetlbfs pool, then transparent ones through
+ * MADV_HUGEPAGE, then plain pages; the NUMA policy is set with mbind before anything is touched, so the kernel
+ * places each frame on its first fault
+ */
+
+class FrameArena {
+public:
+
+    static constexpr int small_pages = 0, transparent_huge_pages = 1, explicit_huge_pages = 2;
+
+    // a NUMA node number, or one of these
+    static constexpr int numa_default = -1, numa_interleave = -2;
+
+    static constexpr long long huge_page_size = 2 << 20, small_page_size = 4096;
+
+private:
+
+    // the mempolicy modes of <linux/mempolicy.h>, the system call is used directly so libnuma is not needed
+    static constexpr int mpol_bind = 2, mpol_interleave = 3;
+
+    char *base;
+    long long length;
+    int granted;
+    bool placed;
+
+    static uint64_t memory_nodes() {
+
+        // parses a node list like "0-1,3" from sysfs, nodes without memory cannot take an interleaved page
+
+        FILE *file = fopen("/sys/devices/system/node/has_memory", "r");
+        if (!file)
+            file = fopen("/sys/devices/system/node/online", "r");
+        if (!file)
+            return 1;
+        uint64_t mask = 0;
+        int low, high;
+        while (fscanf(file, "%d", &low) == 1) {
+            high = low;
+            int next = fgetc(file);
+            if (next == '-') {
+                if (fscanf(file, "%d", &high) != 1)
+                    break;
+                next = fgetc(file);
+            }
+            for (int node = low; node <= high && node < 64; ++node)
+                mask |= (uint64_t) 1 << node;
+            if (next != ',')
+                break;
+        }
+        fclose(file);
+        return mask ? mask : 1;
+    }
+
+    bool set_policy(int numa) {
+#ifdef SYS_mbind
+        uint64_t mask;
+        int mode;
+        if (numa == numa_interleave) {
+            mask = memory_nodes();
+            mode = mpol_interleave;
+        }
+        else if (numa >= 0 && numa < 64) {
+            mask = (uint64_t) 1 << numa;
+            mode = mpol_bind;
+        }
+        else
+            return false;
+        return syscall(SYS_mbind, base, length, mode, &mask, 65, 0) == 0; // the kernel reads maxnode - 1 bits
+#else
+        return false;
+#endif
+    }
+
+public:
+
+    FrameArena() : base(nullptr), length(0), granted(small_pages), placed(false) {}
+
+    ~FrameArena() {
+        release();
+    }
+
+    bool allocate(long long size, int huge = small_pages, int numa = numa_default) {
+
+        // false only when not even plain pages could be mapped
+
+        release();
+
+        if (huge >= explicit_huge_pages) {
+            long long rounded = (size + huge_page_size - 1) / huge_page_size * huge_page_size;
+            void *map = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (map != MAP_FAILED) {
+                base = static_cast<char *>(map);
+                length = rounded;
+                granted = explicit_huge_pages;
+            }
+        }
+
+        if (!base && huge >= transparent_huge_pages) {
+
+            // a transparent huge page needs a 2 MB aligned range, so a larger mapping is trimmed around one
+
+            long long rounded = (size + huge_page_size - 1) / huge_page_size * huge_page_size;
+            void *map = mmap(nullptr, rounded + huge_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (map != MAP_FAILED) {
+                char *start = static_cast<char *>(map);
+                char *aligned = reinterpret_cast<char *>(
+                        (reinterpret_cast<uintptr_t>(start) + huge_page_size - 1) & ~(uintptr_t) (huge_page_size - 1));
+                if (aligned > start)
+                    munmap(start, aligned - start);
+                if (aligned + rounded < start + rounded + huge_page_size)
+                    munmap(aligned + rounded, start + rounded + huge_page_size - (aligned + rounded));
+                base = aligned;
+                length = rounded;
+                granted = madvise(base, length, MADV_HUGEPAGE) == 0 ? transparent_huge_pages : small_pages;
+            }
+        }
+
+        if (!base) {
+            long long rounded = (size + small_page_size - 1) / small_page_size * small_page_size;
+            void *map = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (map == MAP_FAILED)
+                return false;
+            base = static_cast<char *>(map);
+            length = rounded;
+            granted = small_pages;
+        }
+
+        placed = numa != numa_default && set_policy(numa);
+        return true;
+    }
+
+    void release() {
+        if (base)
+            munmap(base, length);
+        base = nullptr;
+        length = 0;
+        granted = small_pages;
+        placed = false;
+    }
+
+    void discard(long long offset, long long size) {
+
+        // hands the memory of a range back to the kernel, it reads as zeros when touched again;
+        // explicit huge pages only go whole, a transparent one is split
+
+        long long unit = granted == explicit_huge_pages ? huge_page_size : small_page_size;
+        long long begin = (offset + unit - 1) / unit * unit, end = (offset + size) / unit * unit;
+        if (end > length)
+            end = length;
+        if (begin < end)
+            madvise(base + begin, end - begin, MADV_DONTNEED);
+    }
+
+    void swap(FrameArena &other) {
+        std::swap(base, other.base);
+        std::swap(length, other.length);
+        std::swap(granted, other.granted);
+        std::swap(placed, other.placed);
+    }
+
+    char *data() const {
+        return base;
+    }
+
+    long long size() const {
+        return length;
+    }
+
+    // what the kernel agreed to, which is less than asked when huge pages or the node were not available
+
+    int huge_pages() const {
+        return granted;
+    }
+
+    bool numa_placed() const {
+        return placed;
+    }
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <utility>
 #include "vector.h"
 #include "pair.h"
+#include "qsort.h"
 
 template<typename T, bool using_key = false>
 class Heap;
@@ -18,9 +19,9 @@ protected:
     using Vector<T>::push_back;
 
     void swap(int index_a, int index_b) {
-        T tmp = data[index_a];
-        data[index_a] = data[index_b];
-        data[index_b] = tmp;
+        T tmp = std::move(data[index_a]);
+        data[index_a] = std::move(data[index_b]);
+        data[index_b] = std::move(tmp);
     }
 
     void move_up(int index) {
@@ -62,8 +63,14 @@ public:
 
     Heap() : Vector<T>() {}
 
+    explicit Heap(int capacity, Arena *arena = nullptr) : Vector<T>(capacity, arena) {}
+
     ~Heap() = default;
 
+    void reserve(int capacity) {
+        Vector<T>::reserve(capacity);
+    }
+
     template<typename U>
     void push(U &&val) {
         push_back(std::forward<U>(val));
@@ -86,10 +93,17 @@ public:
             return;
         }
 
-        data[0] = data[--pos];
+        data[0] = std::move(data[--pos]);
         move_down(0);
     }
 
+    void sort() {
+
+        // ascending order, which is a heap too, so raw() can be read in order without a copy
+
+        qsort(data, data + pos);
+    }
+
     int size() {
         return pos;
     }
@@ -107,9 +121,9 @@ protected:
     Vector<int> key_map;
 
     void swap(int index_a, int index_b) {
-        Pair<int, T> tmp_T = data[index_a];
-        data[index_a] = data[index_b];
-        data[index_b] = tmp_T;
+        Pair<int, T> tmp_T = std::move(data[index_a]);
+        data[index_a] = std::move(data[index_b]);
+        data[index_b] = std::move(tmp_T);
 
         key_map[data[index_a].first] = index_a;
         key_map[data[index_b].first] = index_b;
@@ -154,8 +168,18 @@ public:
 
     Heap() : Vector<Pair<int, T>>() {}
 
+    explicit Heap(int capacity, Arena *arena = nullptr) : Vector<Pair<int, T>>(capacity, arena), key_map(0, arena) {}
+
     ~Heap() = default;
 
+    void reserve(int capacity, int keys) {
+
+        // entries and key range up front, keys covers 0 .. keys - 1
+
+        Vector<Pair<int, T>>::reserve(capacity);
+        key_map.reserve(keys);
+    }
+
     template<typename U>
     void push(int key, U &&val) {
         int map_size = key_map.size();
@@ -192,6 +216,26 @@ public:
         return data[key_map[key]].second;
     }
 
+    void erase(int key) {
+        if (key >= key_map.size())
+            return;
+
+        int index = key_map[key];
+        if (index == -1)
+            return;
+
+        key_map[key] = -1;
+        if (index == --pos)
+            return;
+
+        data[index] = std::move(data[pos]);
+        key_map[data[index].first] = index;
+        if (index && data[index].second < data[(index - 1) / 2].second)
+            move_up(index);
+        else
+            move_down(index);
+    }
+
     Pair<int, T> top() {
         return data[0];
     }
@@ -210,7 +254,7 @@ public:
         }
 
         key_map[data[0].first] = -1;
-        data[0] = data[--pos];
+        data[0] = std::move(data[--pos]);
         key_map[data[0].first] = 0;
         move_down(0);
     }
@@ -0,0 +1,145 @@
+#ifndef UTILS_LZ_H
+#define UTILS_LZ_H
+
+#include <cstring>
+#include <cstdint>
+
+/*
+ * LZ77 in the LZ4 block layout: each sequence is a token (literal length << 4 | match length - 4),
+ * extra length bytes when a nibble is 15, the literals, then a 2 byte little endian match offset
+ * the last sequence has literals only, so the input ends right after them
+ */
+
+static constexpr int lz_hash_bits = 12, lz_min_match = 4, lz_max_offset = 65535;
+
+inline unsigned lz_hash(uint32_t value) {
+    return (value * 2654435761u) >> (32 - lz_hash_bits);
+}
+
+inline bool lz_put_length(unsigned char *dst, int &out, int capacity, int length) {
+    while (length >= 255) {
+        if (out >= capacity)
+            return false;
+        dst[out++] = 255;
+        length -= 255;
+    }
+    if (out >= capacity)
+        return false;
+    dst[out++] = length;
+    return true;
+}
+
+inline bool lz_put_sequence(unsigned char *dst, int &out, int capacity, const unsigned char *literals, int literal_length,
+                            int offset, int match_length) {
+
+    // match_length 0 marks the closing literal-only sequence
+
+    if (out >= capacity)
+        return false;
+    int match_code = match_length ? match_length - lz_min_match : 0;
+    dst[out++] = (literal_length < 15 ? literal_length : 15) << 4 | (match_code < 15 ? match_code : 15);
+    if (literal_length >= 15 && !lz_put_length(dst, out, capacity, literal_length - 15))
+        return false;
+    if (out + literal_length > capacity)
+        return false;
+    memcpy(dst + out, literals, literal_length);
+    out += literal_length;
+    if (!match_length)
+        return true;
+
+    if (out + 2 > capacity)
+        return false;
+    dst[out++] = offset & 255;
+    dst[out++] = offset >> 8;
+    return match_code < 15 || lz_put_length(dst, out, capacity, match_code - 15);
+}
+
+// returns the compressed size, or -1 when it does not fit in capacity
+
+inline int lz_compress(const char *src, int size, char *dst, int capacity) {
+    const unsigned char *in = reinterpret_cast<const unsigned char *>(src);
+    unsigned char *out_bytes = reinterpret_cast<unsigned char *>(dst);
+    int table[1 << lz_hash_bits];
+    memset(table, -1, sizeof(table));
+
+    int pos = 0, anchor = 0, out = 0;
+    while (pos + lz_min_match <= size) {
+        uint32_t value;
+        memcpy(&value, in + pos, sizeof(value));
+        unsigned slot = lz_hash(value);
+        int ref = table[slot];
+        table[slot] = pos;
+        if (ref < 0 || pos - ref > lz_max_offset || memcmp(in + ref, in + pos, lz_min_match) != 0) {
+            ++pos;
+            continue;
+        }
+
+        int length = lz_min_match;
+        while (pos + length < size && in[ref + length] == in[pos + length])
+            ++length;
+        if (!lz_put_sequence(out_bytes, out, capacity, in + anchor, pos - anchor, pos - ref, length))
+            return -1;
+        pos += length;
+        anchor = pos;
+    }
+
+    if (!lz_put_sequence(out_bytes, out, capacity, in + anchor, size - anchor, 0, 0))
+        return -1;
+    return out;
+}
+
+// returns the decompressed size, or -1 for input that is not a valid block or does not fit in capacity
+
+inline int lz_decompress(const char *src, int size, char *dst, int capacity) {
+    const unsigned char *in_bytes = reinterpret_cast<const unsigned char *>(src);
+    int in = 0, out = 0;
+
+    while (in < size) {
+        int token = in_bytes[in++];
+
+        int literal_length = token >> 4;
+        if (literal_length == 15) {
+            int extra;
+            do {
+                if (in >= size)
+                    return -1;
+                extra = in_bytes[in++];
+                literal_length += extra;
+            } while (extra == 255);
+        }
+        if (in + literal_length > size || out + literal_length > capacity)
+            return -1;
+        memcpy(dst + out, src + in, literal_length);
+        in += literal_length;
+        out += literal_length;
+        if (in == size)
+            break;
+
+        if (in + 2 > size)
+            return -1;
+        int offset = in_bytes[in] | in_bytes[in + 1] << 8;
+        in += 2;
+        int match_length = (token & 15) + lz_min_match;
+        if ((token & 15) == 15) {
+            int extra;
+            do {
+                if (in >= size)
+                    return -1;
+                extra = in_bytes[in++];
+                match_length += extra;
+            } while (extra == 255);
+        }
+        if (!offset || offset > out || out + match_length > capacity)
+            return -1;
+
+        if (offset >= match_length)
+            memcpy(dst + out, dst + out - offset, match_length);
+        else // overlapping copy repeats the last offset bytes
+            for (int i = 0; i < match_length; ++i)
+                dst[out + i] = dst[out + i - offset];
+        out += match_length;
+    }
+    return out;
+}
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef UTILS_PHASE_PROFILER_H
+#define UTILS_PHASE_PROFILER_H
+
+#include <cstring>
+#include <chrono>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/*
+ * charges wall time and hardware counters of the calling thread to phases: enter() closes the running phase
+ * with one counter read and opens the next, and returns the one left, so a scope can go back to it
+ * the counters form one perf event group read by a single system call; those the kernel or the machine
+ * refuse are left out and read as 0, and without any only the time is kept
+ */
+
+class PhaseProfiler {
+public:
+
+    static constexpr int max_phases = 8;
+
+    static constexpr int cycles = 0, instructions = 1, llc_misses = 2, dtlb_misses = 3, counter_count = 4;
+
+    struct Totals {
+        long long ns;
+        long long counter[counter_count];
+    };
+
+private:
+
+    int fd[counter_count];
+    int slot[counter_count]; // place in the group read, -1 when the counter did not open
+    int leader, opened;
+
+    int current;
+    long long last_ns;
+    long long last[counter_count];
+    Totals totals[max_phases];
+
+    static int open_counter(unsigned type, unsigned long long config, int group) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = type;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.disabled = group == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return (int) syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+    }
+
+    static long long now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void sample(long long *values) {
+        for (int i = 0; i < counter_count; ++i)
+            values[i] = 0;
+        if (leader < 0)
+            return;
+        unsigned long long group[1 + counter_count];
+        if (read(leader, group, sizeof(group)) < (ssize_t) sizeof(unsigned long long))
+            return;
+        for (int i = 0; i < counter_count; ++i)
+            if (slot[i] >= 0 && slot[i] < (int) group[0])
+                values[i] = (long long) group[1 + slot[i]];
+    }
+
+public:
+
+    PhaseProfiler() : leader(-1), opened(0), current(0), last_ns(0) {
+        memset(totals, 0, sizeof(totals));
+        for (int i = 0; i < counter_count; ++i) {
+            fd[i] = -1;
+            slot[i] = -1;
+            last[i] = 0;
+        }
+
+        const unsigned types[counter_count] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+                                               PERF_TYPE_HW_CACHE};
+        const unsigned long long configs[counter_count] = {
+                PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+                PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16};
+        for (int i = 0; i < counter_count; ++i) {
+            fd[i] = open_counter(types[i], configs[i], leader);
+            if (fd[i] < 0)
+                continue;
+            if (leader < 0)
+                leader = fd[i];
+            slot[i] = opened++;
+        }
+    }
+
+    ~PhaseProfiler() {
+        for (int i = 0; i < counter_count; ++i)
+            if (fd[i] >= 0)
+                close(fd[i]);
+    }
+
+    bool counting(int counter) const {
+        return slot[counter] >= 0;
+    }
+
+    void start(int phase = 0) {
+        if (leader >= 0) {
+            ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+        current = phase;
+        sample(last);
+        last_ns = now_ns();
+    }
+
+    void stop() {
+        enter(current);
+        if (leader >= 0)
+            ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    int enter(int phase) {
+        long long values[counter_count];
+        sample(values);
+        long long ns = now_ns();
+
+        Totals &spent = totals[current];
+        spent.ns += ns - last_ns;
+        for (int i = 0; i < counter_count; ++i)
+            spent.counter[i] += values[i] - last[i];
+
+        int left = current;
+        current = phase;
+        last_ns = ns;
+        for (int i = 0; i < counter_count; ++i)
+            last[i] = values[i];
+        return left;
+    }
+
+    const Totals &phase(int index) const {
+        return totals[index];
+    }
+};
+
+// charges its lifetime to a phase, then returns to the one running before; a null profiler costs a branch
+
+class PhaseScope {
+
+    PhaseProfiler *profiler;
+    int left;
+
+public:
+
+    PhaseScope(PhaseProfiler *profiler, int phase) : profiler(profiler), left(profiler ? profiler->enter(phase) : 0) {}
+
+    ~PhaseScope() {
+        if (profiler)
+            profiler->enter(left);
+    }
+};
+
+#endif
@@ -1,64 +1,108 @@
 #ifndef UTILS_QSORT_H
 #define UTILS_QSORT_H
 
-template<typename T>
-void qsort(T *start, T *end) {
+#include <utility>
 
-    if (end - start <= 1)
-        return;
-    T piv = *(start + (end - start) / 2);
-    T tmp;
-    T *l = start - 1, *r = end, *m = start;
+/*
+ * introsort: a median of three pivot and a partition from both ends, which stops at records equal to the pivot, so
+ * sorted input moves nothing and equal records split evenly; the smaller side recurses and the larger loops, so the
+ * stack stays within log n frames, and a range that has split badly 2 log n times is finished by heap sort, so no
+ * input takes more than n log n; short ranges use insertion sort
+ */
 
-    while (m < r) {
-        if (*m < piv) {
-            ++l;
-            tmp = *l;
-            *l = *m;
-            *m = tmp;
-            ++m;
-        }
-        else if (piv < *m) {
-            --r;
-            tmp = *r;
-            *r = *m;
-            *m = tmp;
-        }
-        else ++m;
+static constexpr long qsort_insertion_size = 16;
+
+template<typename T, typename Comp>
+void qsort_insertion(T *start, T *end, Comp &comp) {
+    for (T *cur = start + 1; cur < end; ++cur) {
+        T value = std::move(*cur);
+        T *hole = cur;
+        for (; hole > start && comp(value, *(hole - 1)); --hole)
+            *hole = std::move(*(hole - 1));
+        *hole = std::move(value);
     }
+}
 
-    qsort(start, l + 1);
-    qsort(r, end);
+template<typename T, typename Comp>
+void qsort_sift_down(T *start, long n, long index, Comp &comp) {
+    T value = std::move(start[index]);
+    for (long child = index * 2 + 1; child < n; child = index * 2 + 1) {
+        if (child + 1 < n && comp(start[child], start[child + 1]))
+            ++child;
+        if (!comp(value, start[child]))
+            break;
+        start[index] = std::move(start[child]);
+        index = child;
+    }
+    start[index] = std::move(value);
 }
 
-template<typename T>
-void qsort(T *start, T *end, bool (*comp)(const T &a, const T &b)) {
+template<typename T, typename Comp>
+void qsort_heap(T *start, T *end, Comp &comp) {
+    long n = end - start;
+    for (long i = n / 2 - 1; i >= 0; --i)
+        qsort_sift_down(start, n, i, comp);
+    for (long i = n - 1; i > 0; --i) {
+        std::swap(start[0], start[i]);
+        qsort_sift_down(start, i, 0, comp);
+    }
+}
 
-    if (end - start <= 1)
-        return;
-    T piv = *(start + (end - start) / 2);
-    T tmp;
-    T *l = start - 1, *r = end, *m = start;
+template<typename T, typename Comp>
+void qsort_range(T *start, T *end, int depth, Comp &comp) {
+    while (end - start > qsort_insertion_size) {
+        if (depth-- == 0) {
+            qsort_heap(start, end, comp);
+            return;
+        }
 
-    while (m < r) {
-        if (comp(*m, piv)) {
-            ++l;
-            tmp = *l;
-            *l = *m;
-            *m = tmp;
-            ++m;
+        // the three samples put in order, so the pivot is the middle record and never the last, and both sides of
+        // the split hold one at least
+
+        T *mid = start + (end - start) / 2, *last = end - 1;
+        if (comp(*mid, *start))
+            std::swap(*mid, *start);
+        if (comp(*last, *mid)) {
+            std::swap(*last, *mid);
+            if (comp(*mid, *start))
+                std::swap(*mid, *start);
+        }
+        T piv = *mid;
+        T *l = start - 1, *r = end;
+
+        while (true) {
+            do ++l; while (comp(*l, piv));
+            do --r; while (comp(piv, *r));
+            if (l >= r)
+                break;
+            std::swap(*l, *r);
+        }
+        l = r + 1;
+
+        if (l - start < end - l) {
+            qsort_range(start, l, depth, comp);
+            start = l;
         }
-        else if (comp(piv, *m)) {
-            --r;
-            tmp = *r;
-            *r = *m;
-            *m = tmp;
+        else {
+            qsort_range(l, end, depth, comp);
+            end = l;
         }
-        else ++m;
     }
+    qsort_insertion(start, end, comp);
+}
+
+template<typename T, typename Comp>
+void qsort(T *start, T *end, Comp comp) {
+    int depth = 0;
+    for (long n = end - start; n > 1; n >>= 1)
+        depth += 2;
+    if (end - start > 1)
+        qsort_range(start, end, depth, comp);
+}
 
-    qsort(start, l + 1, comp);
-    qsort(r, end, comp);
+template<typename T>
+void qsort(T *start, T *end) {
+    qsort(start, end, [](const T &a, const T &b) { return a < b; });
 }
 
 #endif
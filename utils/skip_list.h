@@ -0,0 +1,147 @@
+#ifndef UTILS_SKIP_LIST_H
+#define UTILS_SKIP_LIST_H
+
+#include <new>
+#include <type_traits>
+#include "arena.h"
+
+/*
+ * nodes come from the heap one by one, or from an arena given at construction, with the tower in the same piece;
+ * the list then owns what the arena hands out and clear() resets it, so a list that is filled and cleared in turn
+ * stops allocating once the arena has grown to its largest size
+ */
+
+template<typename T>
+class SkipList {
+
+public:
+
+    struct Node {
+        T value;
+        int level;
+        Node **forward;
+    };
+
+private:
+
+    static constexpr int max_level = 24;
+
+    Node *head;
+    int level;
+    int count;
+    unsigned seed;
+    Arena *arena;
+
+    int random_level() {
+        int result = 1;
+        while (result < max_level) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            if (seed & 3) // p = 1 / 4
+                break;
+            ++result;
+        }
+        return result;
+    }
+
+    Node *new_node(int node_level, Arena *from) {
+        Node *node;
+        if (from) {
+            constexpr long long tower = (sizeof(Node) + alignof(Node *) - 1) / alignof(Node *) * alignof(Node *);
+            char *memory = static_cast<char *>(from->allocate(tower + sizeof(Node *) * node_level, alignof(Node)));
+            node = new(memory) Node;
+            node->forward = reinterpret_cast<Node **>(memory + tower);
+        }
+        else {
+            node = new Node;
+            node->forward = new Node *[node_level];
+        }
+        node->level = node_level;
+        for (int i = 0; i < node_level; ++i)
+            node->forward[i] = nullptr;
+        return node;
+    }
+
+    static void delete_node(Node *node) {
+        delete[] node->forward;
+        delete node;
+    }
+
+public:
+
+    explicit SkipList(Arena *arena = nullptr) : level(1), count(0), seed(2463534242u), arena(arena) {
+        head = new_node(max_level, nullptr);
+    }
+
+    SkipList(const SkipList &) = delete;
+
+    SkipList &operator=(const SkipList &) = delete;
+
+    ~SkipList() {
+        clear();
+        delete_node(head);
+    }
+
+    void insert(const T &value) {
+        Node *update[max_level];
+        Node *cur = head;
+        for (int i = level - 1; i >= 0; --i) {
+            while (cur->forward[i] && cur->forward[i]->value < value)
+                cur = cur->forward[i];
+            update[i] = cur;
+        }
+
+        int node_level = random_level();
+        for (; level < node_level; ++level)
+            update[level] = head;
+
+        Node *node = new_node(node_level, arena);
+        node->value = value;
+        for (int i = 0; i < node_level; ++i) {
+            node->forward[i] = update[i]->forward[i];
+            update[i]->forward[i] = node;
+        }
+        ++count;
+    }
+
+    Node *lower_bound(const T &value) const {
+        Node *cur = head;
+        for (int i = level - 1; i >= 0; --i)
+            while (cur->forward[i] && cur->forward[i]->value < value)
+                cur = cur->forward[i];
+        return cur->forward[0];
+    }
+
+    Node *begin() const {
+        return head->forward[0];
+    }
+
+    static Node *next(Node *node) {
+        return node->forward[0];
+    }
+
+    void clear() {
+        Node *cur = arena && std::is_trivially_destructible<T>::value ? nullptr : head->forward[0];
+        while (cur) {
+            Node *next_node = cur->forward[0];
+            if (arena)
+                cur->~Node();
+            else
+                delete_node(cur);
+            cur = next_node;
+        }
+        if (arena)
+            arena->reset();
+        for (int i = 0; i < max_level; ++i)
+            head->forward[i] = nullptr;
+        level = 1;
+        count = 0;
+    }
+
+    int size() const {
+        return count;
+    }
+};
+
+#endif
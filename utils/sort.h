@@ -0,0 +1,425 @@
+#ifndef UTILS_SORT_H
+#define UTILS_SORT_H
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <unistd.h>
+#include "heap.h"
+#include "qsort.h"
+
+/*
+ * sorting for the bulk paths, where qsort's single core and comparison per step show:
+ * radix_sort for records ordered by a 64 bit key, parallel_merge_sort for any order, and ExternalSorter for more
+ * records than fit in memory, which spills sorted runs to temporary files and merges them
+ */
+
+// a signed or unsigned integer as an unsigned one of the same order, the key radix_sort takes
+
+template<typename I>
+unsigned long long radix_order(I value) {
+    static_assert(std::is_integral<I>::value, "radix keys are integers");
+    if (std::is_signed<I>::value)
+        return (unsigned long long) (long long) value ^ (1ull << 63);
+    return (unsigned long long) value;
+}
+
+template<typename T, typename KeyOf>
+void radix_sort(T *start, T *end, T *buffer, KeyOf key) {
+
+    /*
+     * least significant byte first, stable, buffer holds end - start records and comes back as scratch
+     * one read counts every byte at once, and a byte all records share costs no pass, so small keys in a 64 bit
+     * field, like priorities or file positions, sort in as many passes as they have bytes that differ
+     */
+
+    long long n = end - start;
+    if (n <= 1)
+        return;
+    static constexpr int digits = 8, buckets = 256;
+    long long *count = new long long[digits * buckets]();
+    for (T *cur = start; cur < end; ++cur) {
+        unsigned long long k = key(*cur);
+        for (int d = 0; d < digits; ++d)
+            ++count[d * buckets + (k >> (d * 8) & 255)];
+    }
+
+    T *from = start, *to = buffer;
+    for (int d = 0; d < digits; ++d) {
+        long long *bucket = count + d * buckets;
+        if (bucket[key(*from) >> (d * 8) & 255] == n)
+            continue;
+        long long offset = 0;
+        for (int b = 0; b < buckets; ++b) {
+            long long size = bucket[b];
+            bucket[b] = offset;
+            offset += size;
+        }
+        for (T *cur = from; cur < from + n; ++cur)
+            to[bucket[key(*cur) >> (d * 8) & 255]++] = std::move(*cur);
+        std::swap(from, to);
+    }
+    if (from != start)
+        for (long long i = 0; i < n; ++i)
+            start[i] = std::move(from[i]);
+    delete[] count;
+}
+
+template<typename T>
+void radix_sort(T *start, T *end, T *buffer) {
+    radix_sort(start, end, buffer, [](const T &value) { return radix_order(value); });
+}
+
+/*
+ * merge sort over threads: the range is halved until every thread has a piece, the pieces are qsorted and merged
+ * back up, and a merge splits its larger input at the middle and the other at the matching point, so the last
+ * merges run on all threads too; the halves land alternately in the range and in buffer, so no pass copies back
+ * not stable, equal records come out in any order
+ */
+
+static constexpr long long merge_sort_grain = 1 << 14; // smaller ranges are not worth a thread
+
+template<typename T, typename Comp>
+void merge_parallel(T *a, T *a_end, T *b, T *b_end, T *out, Comp comp, int threads) {
+    if (threads <= 1 || (a_end - a) + (b_end - b) < merge_sort_grain) {
+        while (a < a_end && b < b_end)
+            *out++ = comp(*b, *a) ? std::move(*b++) : std::move(*a++);
+        while (a < a_end)
+            *out++ = std::move(*a++);
+        while (b < b_end)
+            *out++ = std::move(*b++);
+        return;
+    }
+    if (a_end - a < b_end - b) {
+        std::swap(a, b);
+        std::swap(a_end, b_end);
+    }
+
+    // a[mid] goes where the records of b below it end
+
+    T *a_mid = a + (a_end - a) / 2, *low = b, *high = b_end;
+    while (low < high) {
+        T *mid = low + (high - low) / 2;
+        if (comp(*mid, *a_mid))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    T *out_mid = out + (a_mid - a) + (low - b);
+    std::thread left([=] { merge_parallel(a, a_mid, b, low, out, comp, threads / 2); });
+    merge_parallel(a_mid, a_end, low, b_end, out_mid, comp, threads - threads / 2);
+    left.join();
+}
+
+template<typename T, typename Comp>
+void merge_sort_range(T *start, T *buffer, long long n, bool into_buffer, Comp comp, int threads) {
+    if (threads <= 1 || n < merge_sort_grain * 2) {
+        qsort(start, start + n, comp);
+        if (into_buffer)
+            for (long long i = 0; i < n; ++i)
+                buffer[i] = std::move(start[i]);
+        return;
+    }
+    long long half = n / 2;
+    std::thread left([=] { merge_sort_range(start, buffer, half, !into_buffer, comp, threads / 2); });
+    merge_sort_range(start + half, buffer + half, n - half, !into_buffer, comp, threads - threads / 2);
+    left.join();
+
+    T *from = into_buffer ? start : buffer, *to = into_buffer ? buffer : start;
+    merge_parallel(from, from + half, from + half, from + n, to, comp, threads);
+}
+
+template<typename T, typename Comp>
+void parallel_merge_sort(T *start, T *end, T *buffer, Comp comp, int threads) {
+
+    // buffer holds end - start records, threads 0 for one per core
+
+    if (threads <= 0)
+        threads = std::thread::hardware_concurrency() ? (int) std::thread::hardware_concurrency() : 1;
+    merge_sort_range(start, buffer, end - start, false, comp, threads);
+}
+
+template<typename T>
+void parallel_merge_sort(T *start, T *end, T *buffer, int threads) {
+    parallel_merge_sort(start, end, buffer, [](const T &a, const T &b) { return a < b; }, threads);
+}
+
+template<typename T>
+class ExternalSorter {
+
+    /*
+     * push() collects records in a buffer of the memory given, and a full buffer is sorted and written to a
+     * temporary file as a run; finish() sorts the last buffer, and next() then reads everything back in order,
+     * straight from the buffer when nothing was spilled, otherwise through a k-way merge of the runs, each read
+     * through its share of the same buffer
+     * more runs than merge_fan_in are merged into longer runs first, so the open files stay few for any input
+     * T is copied as bytes, the files are unlinked as soon as they are made, and a failed write turns every later
+     * call false
+     */
+
+    typedef bool (*Compare)(const T &a, const T &b);
+
+    struct Run {
+        int fd;
+        long long size;
+    };
+
+    struct Head {
+        T record;
+        int run;
+        Compare comp;
+
+        bool operator<(const Head &other) const {
+            return comp(record, other.record);
+        }
+    };
+
+    struct Reader {
+        int fd;
+        long long left; // records still in the file
+        T *window;
+        int filled, next, space;
+    };
+
+    static bool less(const T &a, const T &b) {
+        return a < b;
+    }
+
+    Compare comp;
+    std::string directory;
+    T *records, *scratch;
+    long long memory_records, filled, served, total;
+    int threads, spilled;
+    bool failed, finished;
+    Vector<Run> runs;
+    Vector<Reader> readers;
+    Heap<Head> heads;
+
+    void sort_buffer() {
+        if (threads == 1 || filled < merge_sort_grain * 2)
+            qsort(records, records + filled, comp);
+        else {
+            if (!scratch)
+                scratch = new T[memory_records];
+            parallel_merge_sort(records, records + filled, scratch, comp, threads);
+        }
+    }
+
+    int open_run() {
+        std::string path = directory + "/bpt-sort-XXXXXX";
+        int fd = mkstemp(&path[0]);
+        if (fd >= 0)
+            unlink(path.c_str());
+        return fd;
+    }
+
+    static bool write_records(int fd, const T *from, long long count) {
+        const char *cur = reinterpret_cast<const char *>(from);
+        long long size = (long long) sizeof(T) * count;
+        while (size > 0) {
+            ssize_t written = ::write(fd, cur, size);
+            if (written <= 0)
+                return false;
+            cur += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    bool spill() {
+        sort_buffer();
+        Run run{open_run(), filled};
+        if (run.fd < 0 || !write_records(run.fd, records, filled)) {
+            if (run.fd >= 0)
+                close(run.fd);
+            return false;
+        }
+        runs.push_back(run);
+        ++spilled;
+        filled = 0;
+        return true;
+    }
+
+    bool refill(Reader &reader) {
+        long long want = reader.left < reader.space ? reader.left : reader.space;
+        char *cur = reinterpret_cast<char *>(reader.window);
+        long long size = (long long) sizeof(T) * want;
+        while (size > 0) {
+            ssize_t got = ::read(reader.fd, cur, size);
+            if (got <= 0)
+                return false;
+            cur += got;
+            size -= got;
+        }
+        reader.left -= want;
+        reader.filled = (int) want;
+        reader.next = 0;
+        return true;
+    }
+
+    bool start_merge(int first, int last, int windows) {
+
+        // a reader and a head per run of [first, last), each reading through one of windows equal parts of the buffer
+
+        readers.resize(0);
+        while (heads.size())
+            heads.pop();
+        long long share = memory_records / windows;
+        int space = share > (1 << 20) ? 1 << 20 : (int) share;
+        for (int i = first; i < last; ++i) {
+            Reader reader{runs[i].fd, runs[i].size, records + (long long) (i - first) * space, 0, 0, space};
+            if (lseek(reader.fd, 0, SEEK_SET) != 0 || !refill(reader))
+                return false;
+            heads.push(Head{reader.window[reader.next++], i - first, comp});
+            readers.push_back(reader);
+        }
+        return true;
+    }
+
+    bool merge_next(T &record) {
+        if (!heads.size())
+            return false;
+        Head head = heads.top();
+        heads.pop();
+        record = head.record;
+        Reader &reader = readers[head.run];
+        if (reader.next == reader.filled && reader.left && !refill(reader)) {
+            failed = true;
+            return false;
+        }
+        if (reader.next < reader.filled)
+            heads.push(Head{reader.window[reader.next++], head.run, comp});
+        return true;
+    }
+
+    bool merge_runs(int first, int last) {
+
+        // runs [first, last) into one run, written out through the window after the readers'
+
+        int count = last - first;
+        if (!start_merge(first, last, count + 1))
+            return false;
+        long long out_space = readers[0].space, out_filled = 0;
+        T *out = records + out_space * count;
+        Run run{open_run(), 0};
+        if (run.fd < 0)
+            return false;
+
+        T record;
+        while (merge_next(record)) {
+            out[out_filled++] = record;
+            ++run.size;
+            if (out_filled == out_space) {
+                if (!write_records(run.fd, out, out_filled)) {
+                    close(run.fd);
+                    return false;
+                }
+                out_filled = 0;
+            }
+        }
+        if (failed || !write_records(run.fd, out, out_filled)) {
+            close(run.fd);
+            return false;
+        }
+
+        for (int i = first; i < last; ++i)
+            close(runs[i].fd);
+        runs[first] = run;
+        for (int i = last; i < runs.size(); ++i)
+            runs[i - count + 1] = runs[i];
+        runs.resize(runs.size() - count + 1);
+        return true;
+    }
+
+public:
+
+    static constexpr int merge_fan_in = 128;
+
+    explicit ExternalSorter(long long memory_records, int threads = 1, Compare comp = nullptr,
+                            const char *directory = nullptr) :
+            comp(comp ? comp : less), records(nullptr), scratch(nullptr),
+            memory_records(memory_records < 1024 ? 1024 : memory_records), filled(0), served(0), total(0),
+            threads(threads), spilled(0), failed(false), finished(false) {
+        static_assert(std::is_trivially_copyable<T>::value, "runs are written as bytes");
+        const char *tmp = getenv("TMPDIR");
+        this->directory = directory ? directory : tmp && *tmp ? tmp : "/tmp";
+        records = new T[this->memory_records];
+    }
+
+    ExternalSorter(const ExternalSorter &) = delete;
+
+    ExternalSorter &operator=(const ExternalSorter &) = delete;
+
+    ~ExternalSorter() {
+        for (int i = 0; i < runs.size(); ++i)
+            close(runs[i].fd);
+        delete[] records;
+        delete[] scratch;
+    }
+
+    bool push(const T &record) {
+        if (failed || finished)
+            return false;
+        if (filled == memory_records && !spill()) {
+            failed = true;
+            return false;
+        }
+        records[filled++] = record;
+        ++total;
+        return true;
+    }
+
+    bool finish() {
+        if (failed || finished)
+            return !failed;
+        finished = true;
+        if (runs.size() && filled && !spill())
+            failed = true;
+        else if (!runs.size())
+            sort_buffer();
+
+        // every merge pass cuts the run count by merge_fan_in - 1
+
+        while (!failed && runs.size() > merge_fan_in)
+            if (!merge_runs(0, merge_fan_in))
+                failed = true;
+        if (!failed && runs.size() && !start_merge(0, runs.size(), runs.size()))
+            failed = true;
+        return !failed;
+    }
+
+    bool next(T &record) {
+
+        // the records in order after finish(), false at the end or after a failed read
+
+        if (failed || !finished)
+            return false;
+        if (!runs.size()) {
+            if (served == filled)
+                return false;
+            record = records[served++];
+            return true;
+        }
+        return merge_next(record);
+    }
+
+    long long size() const {
+        return total;
+    }
+
+    int spilled_runs() const {
+
+        // runs written by push() and finish(), 0 when everything was sorted in memory
+
+        return spilled;
+    }
+
+    bool good() const {
+        return !failed;
+    }
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef UTILS_TRACE_H
+#define UTILS_TRACE_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+/*
+ * a command stream in a compact binary form: the magic, then one record per command, closed by trace_end
+ * a record is the op byte, the time since the previous command in microseconds as a varint, the key length
+ * byte and the key, and for inserts and deletes the value as a zigzag varint
+ */
+
+static constexpr char trace_magic[8] = {'B', 'P', 'T', 'T', 'R', 'C', '0', '1'};
+static constexpr int trace_insert = 0, trace_delete = 1, trace_find = 2, trace_end = 255;
+
+struct TraceRecord {
+    int op;
+    long long gap_us;
+    int value;
+    char key[256];
+};
+
+class TraceWriter {
+
+    FILE *file;
+
+    void put_varint(unsigned long long value) {
+        while (value >= 128) {
+            fputc((int) (value & 127) | 128, file);
+            value >>= 7;
+        }
+        fputc((int) value, file);
+    }
+
+public:
+
+    explicit TraceWriter(const char *path) : file(fopen(path, "wb")) {
+        if (file)
+            fwrite(trace_magic, 1, sizeof(trace_magic), file);
+    }
+
+    ~TraceWriter() {
+        if (!file)
+            return;
+        fputc(trace_end, file);
+        fclose(file);
+    }
+
+    bool opened() const {
+        return file != nullptr;
+    }
+
+    void write(int op, long long gap_us, const char *key, int value = 0) {
+        if (!file)
+            return;
+        int length = (int) strlen(key);
+        if (length > 255)
+            length = 255;
+        fputc(op, file);
+        put_varint(gap_us > 0 ? (unsigned long long) gap_us : 0);
+        fputc(length, file);
+        fwrite(key, 1, length, file);
+        if (op != trace_find)
+            put_varint((unsigned long long) (((long long) value << 1) ^ ((long long) value >> 63)));
+    }
+};
+
+class TraceReader {
+
+    FILE *file;
+    bool valid;
+
+    bool get_varint(unsigned long long &value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int byte = fgetc(file);
+            if (byte == EOF)
+                return false;
+            value |= (unsigned long long) (byte & 127) << shift;
+            if (!(byte & 128))
+                return true;
+        }
+        return false;
+    }
+
+public:
+
+    explicit TraceReader(const char *path) : file(fopen(path, "rb")), valid(false) {
+        char magic[sizeof(trace_magic)];
+        valid = file && fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                memcmp(magic, trace_magic, sizeof(magic)) == 0;
+    }
+
+    ~TraceReader() {
+        if (file)
+            fclose(file);
+    }
+
+    bool opened() const {
+        return valid;
+    }
+
+    // false at the end, and for a trace cut short or damaged
+
+    bool next(TraceRecord &record) {
+        if (!valid)
+            return false;
+        int op = fgetc(file);
+        unsigned long long gap, value;
+        if (op == EOF || op == trace_end || op > trace_find || !get_varint(gap)) {
+            valid = false;
+            return false;
+        }
+        int length = fgetc(file);
+        if (length == EOF || (int) fread(record.key, 1, length, file) != length) {
+            valid = false;
+            return false;
+        }
+        record.key[length] = 0;
+        record.op = op;
+        record.gap_us = (long long) gap;
+        record.value = 0;
+        if (op != trace_find) {
+            if (!get_varint(value)) {
+                valid = false;
+                return false;
+            }
+            record.value = (int) ((long long) (value >> 1) ^ -(long long) (value & 1));
+        }
+        return true;
+    }
+};
+
+#endif
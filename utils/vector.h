@@ -1,7 +1,16 @@
 #ifndef UTILS_VECTOR_H
 #define UTILS_VECTOR_H
 
+#include <new>
 #include <utility>
+#include "arena.h"
+
+/*
+ * every slot up to the capacity holds a constructed element, so resize() exposes old or default values like the
+ * array it grew from; growing moves the elements over, and there is always a slot, so &v[0] is valid when empty
+ * storage comes from the heap, or from an arena given at construction, which takes the old buffer back only with
+ * its next reset(); reserve() sizes either up front, so filling a vector to that size allocates nothing
+ */
 
 template<class T>
 class Vector {
@@ -11,26 +20,53 @@ protected:
     int pos;
     int space;
     T *data;
+    Arena *arena;
 
-    void expand(int req_space = 0) {
-        do
-            space *= 2;
-        while (space < req_space);
+    T *allocate(int count) {
+        void *memory = arena ? arena->allocate((long long) sizeof(T) * count, alignof(T))
+                             : ::operator new(sizeof(T) * count, std::align_val_t(alignof(T)));
+        return static_cast<T *>(memory);
+    }
+
+    void release() {
+        for (int i = 0; i < space; ++i)
+            data[i].~T();
+        if (!arena)
+            ::operator delete(data, std::align_val_t(alignof(T)));
+    }
 
-        T *new_data = new T[space];
+    void grow_to(int new_space) {
+        T *new_data = allocate(new_space);
         for (int i = 0; i < pos; ++i)
-            new_data[i] = data[i];
+            new(new_data + i) T(std::move(data[i]));
+        for (int i = pos; i < new_space; ++i)
+            new(new_data + i) T();
 
-        delete[] data;
+        release();
         data = new_data;
+        space = new_space;
+    }
+
+    void expand(int req_space = 0) {
+        int new_space = space;
+        do
+            new_space *= 2;
+        while (new_space < req_space);
+        grow_to(new_space);
     }
 
 public:
 
-    Vector() : pos(0), space(1), data(new T[1]) {}
+    Vector() : pos(0), space(0), data(nullptr), arena(nullptr) {
+        grow_to(1);
+    }
+
+    explicit Vector(int capacity, Arena *arena = nullptr) : pos(0), space(0), data(nullptr), arena(arena) {
+        grow_to(capacity > 1 ? capacity : 1);
+    }
 
     virtual ~Vector() {
-        delete[] data;
+        release();
     }
 
     template<typename U>
@@ -40,12 +76,25 @@ public:
         data[pos++] = std::forward<U>(val);
     }
 
+    void pop_back() {
+        --pos;
+    }
+
+    T &back() const {
+        return data[pos - 1];
+    }
+
     void resize(int new_size) {
         if (new_size >= space)
             expand(new_size);
         pos = new_size;
     }
 
+    void reserve(int capacity) {
+        if (capacity > space)
+            grow_to(capacity);
+    }
+
     T &operator[](int index) const {
         return data[index];
     }
@@ -53,6 +102,10 @@ public:
     int size() const {
         return pos;
     }
+
+    int capacity() const {
+        return space;
+    }
 };
 
 #endif